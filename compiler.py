@@ -38,23 +38,70 @@ instruction_dict = {
     'DT_FP_READ': 34,
     'DT_TIK': 35,
     'DT_SYSCALL': 36,
+    'DT_MEMCMP': 37,
+    'DT_MEMCHR': 38,
+    'DT_STRLEN': 39,
+    'DT_MEMMOVE': 40,
+    'DT_VADD': 41,
+    'DT_VMUL': 42,
+    'DT_VFP_ADD': 43,
+    'DT_VFP_MUL': 44,
+    'DT_VDOT': 45,
+    'DT_LOD8': 46,
+    'DT_LOD8S': 47,
+    'DT_LOD16': 48,
+    'DT_LOD16S': 49,
+    'DT_LOD64': 50,
+    'DT_STO8': 51,
+    'DT_STO16': 52,
+    'DT_STO64': 53,
+    'DT_ADD64': 54,
+    'DT_SUB64': 55,
+    'DT_MUL64': 56,
+    'DT_DIV64': 57,
+    'DT_SHL64': 58,
+    'DT_SHR64': 59,
+    'DT_GT64': 60,
+    'DT_LT64': 61,
+    'DT_EQ64': 62,
+    'DT_SEXT': 63,
+    'DT_TRUNC': 64,
+    'DT_DP_ADD': 65,
+    'DT_DP_SUB': 66,
+    'DT_DP_MUL': 67,
+    'DT_DP_DIV': 68,
     
 }
 
-def binary(code_str):
+def varint(value):
+    out = bytearray()
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+    return out
+
+# compact=True writes the compact format (src/compactcode.hpp): one byte per
+# opcode and LEB128 operands after a "THDC" magic.
+def binary(code_str, compact=False):
     items = code_str.split(',')
     items = [s.strip() for s in items]
-    byte_stream = bytearray()
+    byte_stream = bytearray(b'THDC') if compact else bytearray()
     
     for item in items:
         if item in instruction_dict:
-            byte_stream.extend(struct.pack('I', instruction_dict[item]))
+            if compact:
+                byte_stream.append(instruction_dict[item])
+            else:
+                byte_stream.extend(struct.pack('I', instruction_dict[item]))
         elif "float_to_uint32" in item:
             match = re.search(r"\((\d+\.\d+)\)", item)
-            byte_stream.extend(struct.pack('f', float(match.group(1))))
+            word = struct.pack('f', float(match.group(1)))
+            byte_stream.extend(varint(struct.unpack('I', word)[0]) if compact else word)
         else:
-            byte_stream.extend(struct.pack('I', int(item)))
-    with open('program.bin', 'wb') as file:
+            value = int(item)
+            byte_stream.extend(varint(value) if compact else struct.pack('I', value))
+    with open('program.thdc' if compact else 'program.bin', 'wb') as file:
         file.write(byte_stream)
 
 
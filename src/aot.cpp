@@ -0,0 +1,90 @@
+// Ahead-of-time compiler: translates a .bin program (as written by
+// compiler.py) to C++ with aotcode.hpp and builds it into a standalone
+// native executable with the system compiler.
+//
+//   thd_aot [-o <output>] [--emit-cpp] <program.bin>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "readfile.hpp"
+#include "aotcode.hpp"
+
+#ifndef THD_AOT_CXX
+#define THD_AOT_CXX "c++"
+#endif
+#ifndef THD_AOT_INCLUDE_DIR
+#define THD_AOT_INCLUDE_DIR "."
+#endif
+
+namespace {
+
+std::string stem(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+std::string quote(const std::string& arg) {
+    std::string quoted = "'";
+    for (char c : arg) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string input;
+    std::string output;
+    bool emitOnly = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (arg == "--emit-cpp") {
+            emitOnly = true;
+        } else if (input.empty()) {
+            input = arg;
+        } else {
+            input.clear();
+            break;
+        }
+    }
+    if (input.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [-o <output>] [--emit-cpp] <program.bin>" << std::endl;
+        return 1;
+    }
+    if (output.empty()) {
+        output = stem(input);
+    }
+
+    try {
+        MappedProgram program(input);
+        std::string source = translateToCpp(program.code(), input);
+        std::string sourcePath = emitOnly ? output : output + ".cpp";
+        std::ofstream out(sourcePath);
+        out << source;
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Can't write " + sourcePath);
+        }
+        if (emitOnly) {
+            return 0;
+        }
+        const char* cxx = std::getenv("CXX");
+        std::string command = std::string(cxx && *cxx ? cxx : THD_AOT_CXX) + " -std=c++20 -O2 -I" +
+                              quote(THD_AOT_INCLUDE_DIR) + " " + quote(sourcePath) + " -o " + quote(output);
+        if (std::system(command.c_str()) != 0) {
+            throw std::runtime_error("Compiler failed: " + command);
+        }
+        std::remove(sourcePath.c_str());
+    } catch (const std::exception& e) {
+        std::cerr << "thd_aot: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
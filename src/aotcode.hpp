@@ -0,0 +1,124 @@
+#ifndef AOTCODE_HPP
+#define AOTCODE_HPP
+
+#include <vector>
+#include <span>
+#include <string>
+#include <sstream>
+#include <cstdint>
+#include <stdexcept>
+#include "symbol.hpp"
+#include "verifier.hpp"
+#include "semantics.hpp"
+
+// Ahead-of-time translation of bytecode to C++ for thd_aot. Every instruction
+// becomes one statement running its semantics.hpp body on an AotVM
+// (aotruntime.hpp), and every jump target becomes a label. DT_CALL records
+// its call site and jumps to the callee; DT_RET leaves through one shared
+// switch over the call sites. The body runs under VMMemory::trapFaults() and
+// traps are printed like the interpreters print them.
+inline const char* opcodeName(uint32_t opcode) {
+    switch (opcode) {
+#define OPCODE_NAME(op) case op: return #op;
+        FOR_EACH_OPCODE(OPCODE_NAME)
+#undef OPCODE_NAME
+    }
+    return nullptr;
+}
+
+inline std::string translateToCpp(std::span<const uint32_t> code, const std::string& sourceName = "program") {
+    const InstructionBoundaries boundaries = decodeBoundaries(code);
+    const std::vector<uint32_t>& starts = boundaries.starts;
+
+    // Only jump targets get labels; a jump past the end halts.
+    std::vector<bool> isTarget(code.size() + 1, false);
+    for (uint32_t start : starts) {
+        uint32_t mask = jumpOperandMask(code[start]);
+        for (uint32_t k = 0; mask; ++k, mask >>= 1) {
+            if (!(mask & 1)) continue;
+            uint32_t target = code[start + 1 + k];
+            boundaries.target(target);
+            isTarget[std::min<size_t>(target, code.size())] = true;
+        }
+    }
+    auto label = [&](uint32_t target) {
+        return target < code.size() ? std::string("L").append(std::to_string(target)) : std::string("done");
+    };
+
+    std::ostringstream out;
+    std::vector<uint32_t> callSites;
+    bool hasReturn = false;
+    out << "// Generated by thd_aot from " << sourceName << ". Do not edit.\n"
+        << "#include \"aotruntime.hpp\"\n\n"
+        << "int main() {\n"
+        << "    AotVM vm;\n"
+        << "    try {\n"
+        << "        vm.memory.trapFaults([&] {\n";
+    for (uint32_t start : starts) {
+        const uint32_t opcode = code[start];
+        const uint32_t* operand = code.data() + start + 1;
+        if (isTarget[start]) {
+            out << "L" << start << ":\n";
+        }
+        out << "            ";
+        switch (opcode) {
+            case DT_END:
+                out << "goto done;";
+                break;
+            case DT_JMP:
+                out << "goto " << label(operand[0]) << ";";
+                break;
+            case DT_JZ:
+                out << "if (vm.pop() == 0) goto " << label(operand[0]) << ";";
+                break;
+            case DT_JUMP_IF:
+                out << "if (vm.pop() != 0) goto " << label(operand[0]) << ";";
+                break;
+            case DT_IF_ELSE:
+                out << "if (vm.pop() != 0) goto " << label(operand[0]) << "; else goto " << label(operand[1]) << ";";
+                break;
+            case DT_IMMI_GT_JZ:
+                out << "if (!(vm.pop() > " << operand[0] << "u)) goto " << label(operand[1]) << ";";
+                break;
+            case DT_CALL:
+                out << "vm.enter(" << callSites.size() << ", " << operand[1] << "); goto " << label(operand[0])
+                    << "; R" << callSites.size() << ":;";
+                callSites.push_back(start);
+                break;
+            case DT_RET:
+                out << "if (vm.leave()) goto returns;";
+                hasReturn = true;
+                break;
+            default:
+                if (const char* name = opcodeName(opcode)) {
+                    out << "AotSemantics::execute<" << name << ">(vm, AotOperands{{";
+                    for (uint32_t k = 0; k < 3 || k < operandCount(opcode); ++k) {
+                        out << (k ? ", " : "") << (k < operandCount(opcode) ? operand[k] : 0);
+                    }
+                    out << "}});";
+                } else {
+                    out << "AotSemantics::illegal(vm);";
+                }
+        }
+        out << "\n";
+    }
+    out << "            goto done;\n";
+    if (hasReturn) {
+        out << "returns:\n"
+            << "            switch (vm.returnSite()) {\n";
+        for (uint32_t site = 0; site < callSites.size(); ++site) {
+            out << "                case " << site << ": goto R" << site << ";\n";
+        }
+        out << "            }\n";
+    }
+    out << "done:;\n"
+        << "        });\n"
+        << "    } catch (const std::exception& e) {\n"
+        << "        std::cerr << \"Error: \" << e.what() << std::endl;\n"
+        << "    }\n"
+        << "    return 0;\n"
+        << "}\n";
+    return out.str();
+}
+
+#endif // AOTCODE_HPP
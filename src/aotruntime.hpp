@@ -0,0 +1,78 @@
+#ifndef AOTRUNTIME_HPP
+#define AOTRUNTIME_HPP
+
+#include <vector>
+#include <iostream>
+#include <cstdint>
+#include <stdexcept>
+#include "semantics.hpp"
+#include "operandstack.hpp"
+#include "vmmemory.hpp"
+
+// Runtime for programs compiled by thd_aot (aotcode.hpp). Opcode bodies come
+// from semantics.hpp and the stack policy is the one DirectThreadingVM uses,
+// so a compiled program behaves exactly like the direct-threaded
+// interpreter. Control flow is not here: jumps, calls and returns are
+// emitted as gotos by the translator.
+struct AotVM {
+    struct Frame {
+        uint32_t site;         // Call site to return to
+        uint32_t* callerBase;  // Caller's frame base in st
+    };
+    OperandStack st;
+    std::vector<Frame> frames;
+    VMMemory memory;
+    char* buffer; // memory.data()
+    uint32_t debug_num;
+
+    AotVM() : buffer(memory.data()), debug_num(0xFFFFFFFF) {
+        frames.reserve(1 << 10);
+    }
+
+    void push(uint32_t value) {
+        st.push(value);
+    }
+
+    uint32_t pop() {
+        return st.pop();
+    }
+
+    uint32_t top() {
+        return st.top();
+    }
+
+    bool empty() {
+        return st.empty();
+    }
+
+    // DT_CALL without the jump
+    void enter(uint32_t site, uint32_t num_params) {
+        frames.push_back(Frame{site, st.enter(num_params)});
+    }
+
+    // DT_RET without the jump; false when there is no frame to return to.
+    bool leave() {
+        if (frames.empty()) {
+            std::cerr << "Error: Call stack underflow" << std::endl;
+            return false;
+        }
+        st.leave(frames.back().callerBase);
+        return true;
+    }
+
+    uint32_t returnSite() {
+        uint32_t site = frames.back().site;
+        frames.pop_back();
+        return site;
+    }
+};
+
+// Operands of one instruction, as constants the compiler can fold.
+struct AotOperands {
+    uint32_t value[4];
+    constexpr uint32_t operator[](size_t i) const { return value[i]; }
+};
+
+typedef OpcodeSemantics<AotVM> AotSemantics;
+
+#endif // AOTRUNTIME_HPP
@@ -0,0 +1,126 @@
+#ifndef COMPACTCODE_HPP
+#define COMPACTCODE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <span>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include "symbol.hpp"
+
+// Compact program files: the magic "THDC", then every instruction as a
+// one-byte opcode followed by its operands (operandCount() of them) as
+// unsigned LEB128. Operand values are the word-format ones, jump targets
+// included, so expanding a compact program gives back the .bin words
+// exactly and engines load it like any other. Small operands take one byte,
+// so typical programs shrink three- to four-fold.
+namespace compactcode {
+
+constexpr uint8_t magic[4] = {'T', 'H', 'D', 'C'};
+constexpr size_t maxVarintBytes = 5;
+
+constexpr uint32_t maxOperands = [] {
+    uint32_t most = 0;
+    for (const OpcodeInfo& info : opcodeTable) {
+        most = std::max<uint32_t>(most, info.operands);
+    }
+    return most;
+}();
+
+inline bool isCompact(std::span<const uint8_t> bytes) {
+    return bytes.size() >= sizeof(magic) && bytes[0] == magic[0] && bytes[1] == magic[1] && bytes[2] == magic[2] &&
+           bytes[3] == magic[3];
+}
+
+inline void appendVarint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Checked reads every byte against end; the unchecked form is for callers
+// that know a whole instruction's worth of bytes is left.
+template <bool Checked>
+inline uint32_t readVarint(const uint8_t*& p, const uint8_t* end) {
+    if (Checked && p == end) {
+        throw std::runtime_error("Truncated instruction");
+    }
+    uint32_t value = *p++;
+    if (value < 0x80) [[likely]] {
+        return value;
+    }
+    value &= 0x7F;
+    for (uint32_t shift = 7;; shift += 7) {
+        if (Checked && p == end) {
+            throw std::runtime_error("Truncated instruction");
+        }
+        uint32_t byte = *p++;
+        if (shift == 28 && byte > 0x0F) {
+            throw std::runtime_error("Operand does not fit in 32 bits");
+        }
+        value |= (byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}
+
+} // namespace compactcode
+
+inline std::vector<uint8_t> encodeCompact(std::span<const uint32_t> code) {
+    std::vector<uint8_t> out(std::begin(compactcode::magic), std::end(compactcode::magic));
+    out.reserve(sizeof(compactcode::magic) + code.size() * 2);
+    for (size_t pointer = 0; pointer < code.size();) {
+        const uint32_t opcode = code[pointer];
+        if (opcode > 0xFF) {
+            throw std::runtime_error("Opcode " + std::to_string(opcode) + " at " + std::to_string(pointer) +
+                                     " does not fit in a byte");
+        }
+        const uint32_t operands = operandCount(opcode);
+        if (pointer + operands >= code.size()) {
+            throw std::runtime_error("Truncated instruction at " + std::to_string(pointer));
+        }
+        out.push_back(static_cast<uint8_t>(opcode));
+        for (uint32_t k = 1; k <= operands; ++k) {
+            compactcode::appendVarint(out, code[pointer + k]);
+        }
+        pointer += operands + 1;
+    }
+    return out;
+}
+
+// Expands a compact program (magic included) into word format.
+inline std::vector<uint32_t> decodeCompact(std::span<const uint8_t> bytes) {
+    if (!compactcode::isCompact(bytes)) {
+        throw std::runtime_error("Not a compact program");
+    }
+    const uint8_t* p = bytes.data() + sizeof(compactcode::magic);
+    const uint8_t* const end = bytes.data() + bytes.size();
+    // Every word takes at least one byte
+    std::vector<uint32_t> code(end - p);
+    uint32_t* out = code.data();
+    // Room for the longest instruction: no bounds checks needed
+    constexpr size_t longest = 1 + compactcode::maxOperands * compactcode::maxVarintBytes;
+    while (end - p >= static_cast<ptrdiff_t>(longest)) {
+        const uint32_t opcode = *p++;
+        *out++ = opcode;
+        for (uint32_t k = operandCount(opcode); k; --k) {
+            *out++ = compactcode::readVarint<false>(p, end);
+        }
+    }
+    while (p != end) {
+        const uint32_t opcode = *p++;
+        *out++ = opcode;
+        for (uint32_t k = operandCount(opcode); k; --k) {
+            *out++ = compactcode::readVarint<true>(p, end);
+        }
+    }
+    code.resize(out - code.data());
+    return code;
+}
+
+#endif // COMPACTCODE_HPP
@@ -0,0 +1,103 @@
+#ifndef COPYPATCH_HPP
+#define COPYPATCH_HPP
+
+#include <cstdint>
+
+// Shared between the stencil source (compiled at build time and cut into
+// byte templates by stencilgen) and the copy-and-patch engine that glues
+// those templates together at load time.
+
+struct CPState;
+
+// Everything a stencil needs from the host goes through this table, so the
+// stencils themselves only carry relocations against the HOLE_* symbols.
+struct CPRuntime {
+    void (*print)(CPState*, uint32_t);
+    void (*print_fp)(CPState*, uint32_t);
+    uint32_t (*read_int)(CPState*);
+    uint32_t (*read_fp)(CPState*);
+    void (*tik)(CPState*);
+    void (*memcpy)(char*, const char*, uint32_t);
+    void (*memset)(char*, uint32_t, uint32_t);
+    void (*error)(CPState*, uint32_t);
+    // Runs an opcode without a stencil on the shared semantics; nullptr on a trap
+    uint32_t* (*shared)(CPState*, uint32_t* sp, char* mem, uint32_t index);
+};
+
+struct CPFrame {
+    uint32_t* fp;         // Caller's frame base
+    uint32_t returnIndex; // Instruction index to resume at
+};
+
+enum CPStatus : uint32_t {
+    CP_OK,
+    CP_STACK_OVERFLOW,
+    CP_STACK_UNDERFLOW,
+    CP_FRAME_OVERFLOW,
+    CP_ILLEGAL_INSTRUCTION,
+    CP_DIVIDE_BY_ZERO,
+    CP_TRAP,     // Raised by CPRuntime::shared
+};
+
+enum CPError : uint32_t {
+    CP_ERR_EMPTY_STACK,
+    CP_ERR_CALL_UNDERFLOW,
+};
+
+struct CPState {
+    const CPRuntime* rt;
+    uint32_t* stackBase;
+    uint32_t* stackLimit;   // One past the last usable slot
+    uint32_t* fp;           // Base of the current frame
+    CPFrame* frames;
+    CPFrame* frameTop;
+    CPFrame* frameLimit;
+    void* const* entries;   // Native address of every instruction, for DT_RET
+    uint32_t* sp;           // Operand stack pointer when the program stopped
+    uint32_t debug_num;
+    uint32_t status;
+    void* host;             // The engine, for runtime calls that need it
+};
+
+typedef void (*CPStencilFn)(CPState*, uint32_t*, char*);
+
+// Stencil ids that are not VM opcodes.
+enum CPSpecialStencil : uint32_t {
+    CP_SHARED = 252,  // Calls CPRuntime::shared
+    CP_HALT = 254,    // Falls off the end of the program
+    CP_ILLEGAL = 255, // Unknown opcode
+};
+
+// Holes a stencil can contain; the generator maps HOLE_<name> symbols here.
+enum CPHole : uint8_t {
+    CP_HOLE_OP0,
+    CP_HOLE_OP1,
+    CP_HOLE_OP2,
+    CP_HOLE_NEXT_INDEX, // Index of the following instruction (DT_CALL)
+    CP_HOLE_CONTINUE,   // Next instruction in program order
+    CP_HOLE_TARGET,     // First branch target
+    CP_HOLE_TARGET2,    // Second branch target (DT_IF_ELSE)
+};
+
+enum CPPatch : uint8_t {
+    CP_PATCH_ABS32, // Write value + addend
+    CP_PATCH_REL32, // Write target + addend - field address
+};
+
+struct CPStencilHole {
+    uint32_t offset;
+    CPHole hole;
+    CPPatch patch;
+    int32_t addend;
+};
+
+struct CPStencil {
+    uint32_t id;
+    const uint8_t* code;
+    uint32_t size;
+    const CPStencilHole* holes;
+    uint32_t holeCount;
+    uint32_t tailJump; // Size of a trailing `jmp CONTINUE` that can be dropped, 0 if none
+};
+
+#endif // COPYPATCH_HPP
@@ -0,0 +1,280 @@
+#ifndef COPYPATCHTHREADING_H
+#define COPYPATCHTHREADING_H
+#include <vector>
+#include <span>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "symbol.hpp"
+#include "verifier.hpp"
+#include "slotstack.hpp"
+#include "readfile.hpp"
+#include "interface.hpp"
+#include "vmmemory.hpp"
+#include "nativecode.hpp"
+#include "copypatch.hpp"
+#include "stencils.h" // Generated from stencils.cpp by stencilgen
+
+// Copy-and-patch JIT: the machine code for every opcode is produced by the
+// C++ compiler at build time (stencils.cpp). Loading a program copies one
+// stencil per instruction into an executable buffer in program order and
+// patches operands and branch targets into the holes, so the result runs
+// without any dispatch. Opcodes without a stencil of their own call back into
+// the host, which runs them on the shared semantics.
+class CopyPatchVM : public Interface {
+    struct SharedInstruction {
+        uint32_t opcode;
+        uint32_t operand[4];
+    };
+
+    std::vector<uint32_t> stack; // Operand stack shared by all frames
+    std::vector<CPFrame> frames;
+    std::vector<void*> entries; // Native address of every instruction
+    ExecutableBuffer code;
+    VMMemory memory;
+    char* buffer; // memory.data()
+    CPState state;
+    const CPStencil* stencilTable[256];
+    std::vector<SharedInstruction> shared; // Run by the CP_SHARED stencils, by OP0
+    std::string trap; // Why rt_shared stopped the program
+
+    static constexpr size_t frameSlots = 1 << 14;
+
+    static void rt_print(CPState*, uint32_t value) {
+        std::cout << (int)value << std::endl;
+    }
+
+    static void rt_print_fp(CPState*, uint32_t value) {
+        float f;
+        memcpy(&f, &value, 4);
+        std::cout << f << std::endl;
+    }
+
+    static uint32_t rt_read_int(CPState*) {
+        int val;
+        std::cin >> val;
+        return val;
+    }
+
+    static uint32_t rt_read_fp(CPState*) {
+        float val;
+        std::cin >> val;
+        uint32_t u;
+        memcpy(&u, &val, 4);
+        return u;
+    }
+
+    static void rt_tik(CPState*) {
+        std::cout << "tik" << std::endl;
+    }
+
+    static void rt_memcpy(char* dest, const char* src, uint32_t len) {
+        memcpy(dest, src, len);
+    }
+
+    static void rt_memset(char* dest, uint32_t val, uint32_t len) {
+        memset(dest, val, len);
+    }
+
+    static void rt_error(CPState*, uint32_t error) {
+        switch (error) {
+            case CP_ERR_EMPTY_STACK:
+                std::cerr << "Stack is empty." << std::endl;
+                break;
+            case CP_ERR_CALL_UNDERFLOW:
+                std::cerr << "Error: Call stack underflow" << std::endl;
+                break;
+        }
+    }
+
+    static uint32_t* rt_shared(CPState* s, uint32_t* sp, char* mem, uint32_t index) {
+        CopyPatchVM* vm = static_cast<CopyPatchVM*>(s->host);
+        const SharedInstruction& ins = vm->shared[index];
+        try {
+            return SlotStack::execute(ins.opcode, ins.operand, s->fp, sp, s->stackLimit, mem, s->debug_num);
+        } catch (const std::runtime_error& e) {
+            vm->trap = e.what();
+            return nullptr;
+        }
+    }
+
+    static const CPRuntime* runtime() {
+        static const CPRuntime rt = {
+            rt_print, rt_print_fp, rt_read_int, rt_read_fp, rt_tik, rt_memcpy, rt_memset, rt_error, rt_shared,
+        };
+        return &rt;
+    }
+
+    void init_stencil_table() {
+        const CPStencil* illegal = nullptr;
+        for (const CPStencil& s : cpStencils) {
+            if (s.id == CP_ILLEGAL) illegal = &s;
+        }
+        for (auto& entry : stencilTable) {
+            entry = illegal;
+        }
+        for (const CPStencil& s : cpStencils) {
+            stencilTable[s.id] = &s;
+        }
+        for (uint32_t opcode = DT_MEMCMP; opcode <= DT_DP_DIV; ++opcode) {
+            stencilTable[opcode] = stencilTable[CP_SHARED];
+        }
+    }
+
+    // Copies stencil `s` to `at` and fills its holes; `value` maps a hole to
+    // the absolute value it stands for.
+    template <typename HoleValue>
+    static void emit(uint8_t* at, const CPStencil* s, uint32_t length, HoleValue value) {
+        memcpy(at, s->code, length);
+        for (uint32_t h = 0; h < s->holeCount; ++h) {
+            const CPStencilHole& hole = s->holes[h];
+            if (hole.offset + 4 > length) {
+                continue; // Part of the dropped tail jump
+            }
+            int64_t patched = static_cast<int64_t>(value(hole.hole)) + hole.addend;
+            if (hole.patch == CP_PATCH_REL32) {
+                patched -= reinterpret_cast<int64_t>(at + hole.offset);
+            }
+            uint32_t field = static_cast<uint32_t>(patched);
+            memcpy(at + hole.offset, &field, 4);
+        }
+    }
+
+    void compile(std::span<const uint32_t> program) {
+        const InstructionBoundaries boundaries = decodeBoundaries(program);
+        const std::vector<uint32_t>& starts = boundaries.starts;
+        const uint32_t count = boundaries.count();
+
+        std::vector<const CPStencil*> selected(count + 1);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t opcode = program[starts[i]];
+            selected[i] = stencilTable[opcode < 256 ? opcode : CP_ILLEGAL];
+        }
+        selected[count] = stencilTable[CP_HALT];
+
+        // Every instruction is followed by its successor in program order.
+        std::vector<size_t> offsets(count + 1);
+        size_t size = 0;
+        for (uint32_t i = 0; i <= count; ++i) {
+            offsets[i] = size;
+            size += selected[i]->size - selected[i]->tailJump;
+        }
+
+        if (!code.allocate(size)) {
+            throw std::runtime_error("Can't map executable memory");
+        }
+        uint8_t* base = code.data();
+        entries.assign(count + 1, nullptr);
+        for (uint32_t i = 0; i <= count; ++i) {
+            entries[i] = base + offsets[i];
+        }
+
+        auto target = [&](uint32_t address) -> uint64_t {
+            uint32_t index = boundaries.target(address);
+            return reinterpret_cast<uint64_t>(base + offsets[index]);
+        };
+
+        shared.clear();
+        for (uint32_t i = 0; i <= count; ++i) {
+            const CPStencil* s = selected[i];
+            uint32_t length = s->size - s->tailJump;
+            const uint32_t* operands = i < count ? &program[starts[i] + 1] : nullptr;
+            if (s->id == CP_SHARED) {
+                SharedInstruction ins = {program[starts[i]], {}};
+                for (uint32_t k = 0; k < operandCount(ins.opcode); ++k) ins.operand[k] = operands[k];
+                shared.push_back(ins);
+            }
+            emit(base + offsets[i], s, length, [&](CPHole hole) -> uint64_t {
+                switch (hole) {
+                    case CP_HOLE_OP0: return s->id == CP_SHARED ? shared.size() - 1 : operands[0];
+                    case CP_HOLE_OP1: return operands[1];
+                    case CP_HOLE_OP2: return operands[2];
+                    case CP_HOLE_NEXT_INDEX: return i + 1;
+                    case CP_HOLE_CONTINUE: return reinterpret_cast<uint64_t>(base + offsets[i] + length);
+                    case CP_HOLE_TARGET: return target(operands[0]);
+                    case CP_HOLE_TARGET2: return target(operands[1]);
+                }
+                return 0;
+            });
+        }
+        if (!code.seal()) {
+            throw std::runtime_error("Can't make JIT code executable");
+        }
+    }
+
+    void execute() {
+        state.rt = runtime();
+        state.stackBase = stack.data();
+        state.stackLimit = stack.data() + stack.size();
+        state.fp = stack.data();
+        state.frames = frames.data();
+        state.frameTop = frames.data();
+        state.frameLimit = frames.data() + frames.size();
+        state.entries = entries.data();
+        state.sp = stack.data();
+        state.debug_num = debug_num;
+        state.host = this;
+        bool inBounds = memory.guarded([&] {
+            state.status = CP_OK;
+            reinterpret_cast<CPStencilFn>(code.data())(&state, stack.data(), buffer);
+        });
+        debug_num = state.debug_num;
+        if (!inBounds) {
+            throw std::runtime_error("Memory access out of bounds");
+        }
+        switch (state.status) {
+            case CP_STACK_OVERFLOW:
+                throw std::runtime_error("Operand stack overflow");
+            case CP_STACK_UNDERFLOW:
+                throw std::runtime_error("Operand stack underflow");
+            case CP_FRAME_OVERFLOW:
+                throw std::runtime_error("Call stack overflow");
+            case CP_ILLEGAL_INSTRUCTION:
+                throw std::runtime_error("Unknown instruction");
+            case CP_DIVIDE_BY_ZERO:
+                throw std::runtime_error("Division by zero");
+            case CP_TRAP:
+                throw std::runtime_error(trap);
+        }
+    }
+
+public:
+    // Operand stack slots, shared by all frames
+    static constexpr size_t defaultDepth = 1 << 16;
+
+    uint32_t debug_num;
+    explicit CopyPatchVM(size_t stackDepth = defaultDepth, const VMMemory::Options& memoryOptions = VMMemory::Options()) : stack(stackDepth), frames(frameSlots), memory(memoryOptions), buffer(memory.data()) {
+        init_stencil_table();
+        debug_num = 0xFFFFFFFF;
+    }
+
+
+    void run_vm(std::string filename, bool benchmarkMode) {
+        try {
+            MappedProgram program(filename);
+            compile(program.code());
+            if (benchmarkMode) {
+                std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
+            }
+            execute();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    void run_vm(const std::vector<uint32_t>& program) {
+        try {
+            compile(program);
+            execute();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    char* getBuffer() {
+        return buffer;
+    }
+};
+#endif // COPYPATCHTHREADING_H
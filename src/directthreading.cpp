@@ -1,8 +1,9 @@
 #ifndef TOKENTHREADING_H
 #define TOKENTHREADING_H
 #include <vector>
-#include <stack>
+#include <span>
 #include <iostream>
+#include <cstring>
 #include <unistd.h>   
 #include <fcntl.h>
 #include <fstream>    
@@ -10,371 +11,220 @@
 #include <sys/stat.h>
 #include "symbol.hpp"
 #include "readfile.hpp"
+#include "superinstructions.hpp"
+#include "semantics.hpp"
+#include "operandstack.hpp"
+#include "verifier.hpp"
 #include "interface.hpp"
+#include "vmmemory.hpp"
 #ifdef _WIN32
 #include <windows.h> // Windows-specific headers for file operations
 #endif
 
 class DirectThreadingVM : public Interface {
     uint32_t ip; // Instruction pointer
-    std::vector<std::stack<uint32_t>> sts; // Stack for operations
-    std::stack<uint32_t> st;
+    OperandStack st;
     std::vector<uint32_t> instructions; // Instruction set
-    char* buffer; // Memory buffer
+    VMMemory memory;
+    char* buffer; // memory.data()
     void (DirectThreadingVM::*instructionTable[256])(void); // Function pointer table for instructions
-    std::stack<uint32_t> callStack; // Call stack for function calls
-    inline float to_float(uint32_t val) {
-        return *reinterpret_cast<float*>(&val);
-    }
-
-    inline uint32_t from_float(float val) {
-        return *reinterpret_cast<uint32_t*>(&val);
-    }
-
-    inline void write_memory(char* buffer,uint32_t* src, uint32_t offset, uint32_t size) {
-        memcpy(buffer + offset, src, size);
-    }
-
-    inline void write_mem32(char* buffer, uint32_t val, uint32_t offset) {
-        uint32_t buf[1];
-        buf[0] = val;
-        write_memory(buffer, (uint32_t *)buf, offset, 4);
-    }
-
-    inline void read_memory(char* buffer, uint8_t* dst, uint32_t offset, uint32_t size) {
-        memcpy(dst, buffer + offset, size);
-    }
+    void (DirectThreadingVM::*uncheckedTable[256])(void); // The same without stack checks, for verified programs
+    static constexpr uint32_t illegalOpcode = 255; // Stands in for opcodes past the tables
+    bool verifiedProgram;
+    struct Frame {
+        uint32_t returnIp;     // The DT_CALL to continue after
+        uint32_t* callerBase;  // Caller's frame base in st
+    };
+    std::vector<Frame> frames; // Call stack for function calls
+    struct Snapshot {
+        uint32_t ip;
+        OperandStack::Saved stack;
+        std::vector<Frame> frames;
+        uint32_t debug_num;
+    };
+    Snapshot saved;
+    friend struct OpcodeSemantics<DirectThreadingVM>;
+    friend struct UncheckedPolicy<DirectThreadingVM>;
+    typedef OpcodeSemantics<DirectThreadingVM> Semantics;
+    typedef OpcodeSemantics<UncheckedPolicy<DirectThreadingVM>> UncheckedSemantics;
 
-    inline uint32_t read_mem32(char* buffer, uint32_t offset) {
-        uint32_t buf[1];
-        read_memory(buffer, (uint8_t *)buf, offset, 4);
-        return buf[0];
-    }
-    // Define operations for each instruction
-    inline void do_add() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(a + b);
-    }
 
-    inline void do_sub() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b - a);
+    // Stack and control-flow policy for semantics.hpp
+    inline void push(uint32_t value) {
+        st.push(value);
     }
 
-    inline void do_mul() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(a * b);
+    inline uint32_t pop() {
+        return st.pop();
     }
 
-    inline void do_div() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        if (b == 0) {
-            std::cerr << "Error: Divided by zero error" << std::endl;
-            return;
-        }
-        st.push(b / a);
-    }
-
-    inline void do_fp_add() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        float result = a + b;
-        st.push(from_float(result));
-    }
-
-    inline void do_fp_sub() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        float result = b - a;
-        st.push(from_float(result));
-    }
-
-    inline void do_fp_mul() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        float result = a * b;
-        st.push(from_float(result));
-    }
-
-    inline void do_fp_div() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        if (b == 0.0f) {
-            std::cerr << "Division by zero error" << std::endl;
-            return;
-        }
-        float result = b / a;
-        st.push(from_float(result));
+    inline uint32_t top() {
+        return st.top();
     }
 
-    inline void do_inc() {
-        uint32_t a = st.top(); st.pop();
-        st.push(++a);
+    inline bool empty() {
+        return st.empty();
     }
 
-    inline void do_dec() {
-        uint32_t a = st.top(); st.pop();
-        st.push(--a);
-    }
-
-    inline void do_shl() {
-        uint32_t shift = st.top(); st.pop();
-        uint32_t value = st.top(); st.pop();
-        st.push(value << shift);
-    }
-
-    inline void do_shr() {
-        uint32_t shift = st.top(); st.pop();
-        uint32_t value = st.top(); st.pop();
-        st.push(value >> shift);
-    }
-
-    inline void do_end() {
-        st = std::stack<uint32_t>();
-        instructions = std::vector<uint32_t>();
-        ip = 0;
-    }
-
-    inline void do_lod() {
-        uint32_t offset = instructions[++ip];
-        uint32_t a = read_mem32(buffer,offset);
-        st.push(a);
-    }
-
-    inline void do_sto() {
-        uint32_t offset = instructions[++ip];
-        uint32_t a = st.top(); st.pop();
-        write_mem32(buffer,a,offset);
-    }
-
-    inline void do_immi() {
-        uint32_t a = instructions[++ip];
-        st.push(a);
-    }
-
-    inline void do_memcpy() {
-        uint32_t dest = instructions[++ip];
-        uint32_t src = instructions[++ip];
-        uint32_t len = instructions[++ip];
-        memcpy(buffer + dest, buffer + src, len);
-    }
-
-    inline void do_memset() {
-        uint32_t dest = instructions[++ip];
-        uint32_t val = instructions[++ip];
-        uint32_t len = instructions[++ip];
-        memset(buffer + dest, val, len);
-    }
-    inline void do_sto_immi() {
-        uint32_t offset = instructions[++ip];
-        uint32_t number = instructions[++ip];
-        write_mem32(buffer,number,offset);
-    }
-
-    inline void do_jmp() {
-        uint32_t target = instructions[++ip];
+    inline void jump(uint32_t target) {
         ip = target - 1;
     }
 
-    inline void do_jz() {
-        uint32_t target = instructions[++ip];
-        if (st.top() == 0) {
-            ip = target - 1;
-        }
-        st.pop();
+    inline void call(uint32_t target, uint32_t num_params) {
+        frames.push_back(Frame{ip, st.enter(num_params)});
+        jump(target);
     }
 
-    inline void do_jump_if() {
-        uint32_t condition = st.top(); st.pop();
-        uint32_t target = instructions[++ip];
-        if (condition) {
-            ip = target - 1;
-        }
-    }
-
-    inline void do_if_else() {
-        uint32_t condition = st.top(); st.pop();
-        uint32_t trueBranch = instructions[++ip];
-        uint32_t falseBranch = instructions[++ip];
-        ip = condition ? trueBranch - 1 : falseBranch - 1;
-    }
-
-    inline void do_gt() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b > a ? 1 : 0);
-    }
-
-    inline void do_lt() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b < a ? 1 : 0);
-    }
-
-    inline void do_eq() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b == a ? 1 : 0);
-    }
-
-    inline void do_gt_eq() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b >= a ? 1 : 0);
-    }
-
-    inline void do_lt_eq() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b <= a ? 1 : 0);
-    }
-
-    inline void do_call() {
-        uint32_t target = instructions[++ip]; 
-        uint32_t num_params = instructions[++ip]; 
-        std::stack<uint32_t> newStack;
-         for (uint32_t i = 0; i < num_params; ++i) {
-            newStack.push(st.top());
-            st.pop();
-        }
-        sts.push_back(newStack);
-        st=sts.back();//st always refer to the top of stacks.
-        callStack.push(ip); 
-        ip = target - 1; 
-    }
-
-    inline void do_ret() {
-        if (callStack.empty()) {
+    inline void ret() {
+        if (frames.empty()) {
             std::cerr << "Error: Call stack underflow" << std::endl;
             return;
         }
-        uint32_t return_value = st.top();
-        ip = callStack.top(); callStack.pop(); 
-        sts.pop_back();
-        st = sts.back();
-        st.push(return_value);
+        st.leave(frames.back().callerBase);
+        ip = frames.back().returnIp;
+        frames.pop_back();
     }
 
-    inline void do_seek() {
-        debug_num = st.top();
+    // Leaves the dispatch loop; the program stays loaded for restore().
+    inline void end() {
+        st.clear();
+        ip = instructions.size() - 1;
     }
 
-    inline void do_print() {
-        if (!st.empty()) {
-            std::cout <<(int)st.top() << std::endl;
-        } else {
-            std::cerr << "Stack is empty." << std::endl;
-        }
+    // One handler per opcode; the operands follow the opcode in the bytecode
+    // and ip is left on the last of them.
+    template <uint32_t Op>
+    void handler() {
+        const uint32_t* operands = instructions.data() + ip + 1;
+        ip += operandCount(Op);
+        Semantics::execute<Op>(*this, operands);
     }
 
-    inline void do_print_fp() {
-        if (!st.empty()) {
-            uint32_t num = st.top();
-            float* floatPtr = (float*)&num;
-            std::cout <<*floatPtr << std::endl;
-        } else {
-            std::cerr << "Stack is empty." << std::endl;
-        }
+    template <uint32_t Op>
+    void unchecked_handler() {
+        const uint32_t* operands = instructions.data() + ip + 1;
+        ip += operandCount(Op);
+        UncheckedPolicy<DirectThreadingVM> policy(*this);
+        UncheckedSemantics::execute<Op>(policy, operands);
     }
 
-    inline void do_read_fp() {
-        uint32_t offset = instructions[++ip];
-        float val;
-        std::cin >> val; 
-        write_mem32(buffer,from_float(val), offset);
+    void illegal() {
+        Semantics::illegal(*this);
     }
 
-    inline void do_read_int() {
-        uint32_t offset = instructions[++ip];
-        int val;
-        std::cin >> val;
-        write_mem32(buffer, val, offset);
-    }
-
-    inline void tik(){
-        std::cout<<"tik"<<std::endl;
+    void init_instruction_table() {
+        for (uint32_t opcode = 0; opcode < 256; ++opcode) {
+            instructionTable[opcode] = uncheckedTable[opcode] = &DirectThreadingVM::illegal;
+        }
+#define TABLE_ENTRY(op) \
+        instructionTable[op] = &DirectThreadingVM::handler<op>; \
+        uncheckedTable[op] = &DirectThreadingVM::unchecked_handler<op>;
+        FOR_EACH_OPCODE(TABLE_ENTRY)
+#undef TABLE_ENTRY
+    }
+
+    void dispatch() {
+        auto& table = verifiedProgram ? uncheckedTable : instructionTable;
+        const uint32_t* code = instructions.data();
+        for (; ip < instructions.size(); ip++) {
+            (this->*table[code[ip]])();
+        }
     }
 
-    void init_instruction_table() {
-        instructionTable[DT_ADD] = &DirectThreadingVM::do_add;
-        instructionTable[DT_SUB] = &DirectThreadingVM::do_sub;
-        instructionTable[DT_MUL] = &DirectThreadingVM::do_mul;
-        instructionTable[DT_DIV] = &DirectThreadingVM::do_div;
-        instructionTable[DT_SHL] = &DirectThreadingVM::do_shl;
-        instructionTable[DT_SHR] = &DirectThreadingVM::do_shr;
-        instructionTable[DT_FP_ADD] = &DirectThreadingVM::do_fp_add;
-        instructionTable[DT_FP_SUB] = &DirectThreadingVM::do_fp_sub;
-        instructionTable[DT_FP_MUL] = &DirectThreadingVM::do_fp_mul;
-        instructionTable[DT_FP_DIV] = &DirectThreadingVM::do_fp_div;
-        instructionTable[DT_END] = &DirectThreadingVM::do_end;
-        instructionTable[DT_LOD] = &DirectThreadingVM::do_lod;
-        instructionTable[DT_STO] = &DirectThreadingVM::do_sto;
-        instructionTable[DT_IMMI] = &DirectThreadingVM::do_immi;
-        instructionTable[DT_STO_IMMI] = &DirectThreadingVM::do_sto_immi;
-        instructionTable[DT_MEMCPY] = &DirectThreadingVM::do_memcpy;
-        instructionTable[DT_MEMSET] = &DirectThreadingVM::do_memset;
-        instructionTable[DT_INC] = &DirectThreadingVM::do_inc;
-        instructionTable[DT_DEC] = &DirectThreadingVM::do_dec;
-        instructionTable[DT_JMP] = &DirectThreadingVM::do_jmp;
-        instructionTable[DT_JZ] = &DirectThreadingVM::do_jz;
-        instructionTable[DT_IF_ELSE] = &DirectThreadingVM::do_if_else;
-        instructionTable[DT_JUMP_IF] = &DirectThreadingVM::do_jump_if;
-        instructionTable[DT_GT] = &DirectThreadingVM::do_gt;
-        instructionTable[DT_LT] = &DirectThreadingVM::do_lt;
-        instructionTable[DT_EQ] = &DirectThreadingVM::do_eq;
-        instructionTable[DT_GT_EQ] = &DirectThreadingVM::do_gt_eq;
-        instructionTable[DT_LT_EQ] = &DirectThreadingVM::do_lt_eq;
-        instructionTable[DT_CALL] = &DirectThreadingVM::do_call;
-        instructionTable[DT_RET] = &DirectThreadingVM::do_ret;
-        instructionTable[DT_SEEK] = &DirectThreadingVM::do_seek;
-        instructionTable[DT_PRINT] = &DirectThreadingVM::do_print;
-        instructionTable[DT_READ_INT] = &DirectThreadingVM::do_read_int;
-        instructionTable[DT_FP_PRINT] = &DirectThreadingVM::do_print_fp;
-        instructionTable[DT_FP_READ] = &DirectThreadingVM::do_read_fp;
-        instructionTable[DT_Tik] = &DirectThreadingVM::tik;
+    // Programs that verify with a stack bound that fits run on the unchecked
+    // handlers; anything else keeps the checked ones.
+    void prepare() {
+        Verification verification = verifyBytecode(instructions, memory.size());
+        verifiedProgram = verification.ok && verification.stackBound <= st.capacity();
+        ip = 0;
+        st.clear();
+        frames.clear();
     }
 
 public:
     uint32_t debug_num;
-    DirectThreadingVM() : ip(0), buffer(new char[4 * 1024 * 1024]) { 
+    explicit DirectThreadingVM(size_t stackDepth = OperandStack::defaultDepth, const VMMemory::Options& memoryOptions = VMMemory::Options())
+        : ip(0), st(stackDepth), memory(memoryOptions), buffer(memory.data()), verifiedProgram(false) { 
         init_instruction_table();
         debug_num = 0xFFFFFFFF;
-        sts.push_back(std::stack<uint32_t>());
-        st = sts.back();
+        frames.reserve(1 << 10);
     }
 
-    ~DirectThreadingVM() {
-        delete[] buffer;
-    }
 
     void run_vm(std::string filename, bool benchmarkMode) {
         try {
-            instructions = readFileToUint32Array(filename);
+            MappedProgram program(filename);
+            load(program.code());
             if (benchmarkMode) {
                 std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
             }
-            for (ip = 0; ip < instructions.size(); ip++) {
-                (this->*instructionTable[instructions[ip]])();
-            }
+            resume();
         } catch (const std::exception& e) {
             std::cerr << "Error: " << e.what() << std::endl;
         }
     }
 
     void run_vm(std::vector<uint32_t>& code) {
-        this->instructions = code;
         try {
-            for (ip = 0; ip < instructions.size(); ip++) {
-                (this->*instructionTable[instructions[ip]])();
-            }
+            load(code);
+            resume();
         } catch (const std::exception& e) {
             std::cerr << "Error: " << e.what() << std::endl;
         }
     }
+
+    // Loads a program without running it; resume() starts it. Opcodes past
+    // the dispatch tables become illegalOpcode and jumps must land on an
+    // instruction, so dispatch() only ever indexes the tables with an opcode.
+    void load(std::span<const uint32_t> code) {
+        instructions = fuseSuperinstructions(code);
+        const InstructionBoundaries boundaries = decodeBoundaries(instructions);
+        for (uint32_t start : boundaries.starts) {
+            if (instructions[start] > illegalOpcode) {
+                instructions[start] = illegalOpcode;
+            }
+            uint32_t mask = jumpOperandMask(instructions[start]);
+            for (uint32_t k = 0; mask; ++k, mask >>= 1) {
+                if (mask & 1) boundaries.target(instructions[start + 1 + k]);
+            }
+        }
+        prepare();
+    }
+
+    // Runs the loaded program from ip until it ends. Traps are thrown.
+    void resume() {
+        memory.trapFaults([this] { dispatch(); });
+    }
+
+    // Fuzzing support: snapshot() records ip, the operand and call stacks,
+    // debug_num and memory, and restore() rewinds to them, copying back only
+    // the memory pages written in between (VMMemory::snapshot()). A typical
+    // loop loads a program, sets up memory, snapshots, and then restores,
+    // writes a test case to getBuffer() and resumes for every input.
+    void snapshot() {
+        saved.ip = ip;
+        st.save(saved.stack);
+        saved.frames = frames;
+        saved.debug_num = debug_num;
+        memory.snapshot();
+    }
+
+    void restore() {
+        ip = saved.ip;
+        st.restore(saved.stack);
+        frames = saved.frames;
+        debug_num = saved.debug_num;
+        memory.restore();
+    }
+
+    char* getBuffer() {
+        return buffer;
+    }
+
+    // Whether the last program ran on the unchecked handlers.
+    bool verified() const {
+        return verifiedProgram;
+    }
 };
 #endif // TOKENTHREADING_H
                                     
\ No newline at end of file
@@ -0,0 +1,181 @@
+#ifndef GOTOTHREADING_H
+#define GOTOTHREADING_H
+#include <vector>
+#include <span>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include "symbol.hpp"
+#include "verifier.hpp"
+#include "readfile.hpp"
+#include "interface.hpp"
+#include "vmmemory.hpp"
+#include "operandstack.hpp"
+#include "semantics.hpp"
+
+#if !defined(__GNUC__)
+#error "GotoThreadingVM needs the labels-as-values extension (GCC or Clang)"
+#endif
+
+// True direct threading: at load time every opcode word is replaced by the
+// address of its handler label and every jump operand by the address of the
+// target cell, so each handler ends in its own `goto *pc`. The handlers are
+// instantiated from semantics.hpp, one label per opcode.
+class GotoThreadingVM : public Interface {
+    OperandStack st;
+    std::vector<uintptr_t> thread; // Handler addresses interleaved with operands
+    VMMemory memory;
+    char* buffer; // memory.data()
+    struct Frame {
+        const uintptr_t* returnPc; // Return address into the thread
+        uint32_t* callerBase;      // Caller's frame base in st
+    };
+    std::vector<Frame> frames; // Call stack for function calls
+
+    // Stack and control-flow policy for semantics.hpp. Jump operands are
+    // thread cells, and pc points past the current instruction when a
+    // control-flow opcode runs.
+    struct Policy {
+        GotoThreadingVM& vm;
+        const uintptr_t* pc;
+        char* buffer;
+        uint32_t& debug_num;
+
+        Policy(GotoThreadingVM& engine, const uintptr_t* next)
+            : vm(engine), pc(next), buffer(engine.buffer), debug_num(engine.debug_num) {}
+
+        void push(uint32_t value) { vm.st.push(value); }
+        uint32_t pop() { return vm.st.pop(); }
+        uint32_t top() { return vm.st.top(); }
+        bool empty() { return vm.st.empty(); }
+
+        void jump(uintptr_t cell) {
+            pc = reinterpret_cast<const uintptr_t*>(cell);
+        }
+
+        void call(uintptr_t cell, uint32_t num_params) {
+            vm.frames.push_back(Frame{pc, vm.st.enter(num_params)});
+            jump(cell);
+        }
+
+        void ret() {
+            if (vm.frames.empty()) {
+                std::cerr << "Error: Call stack underflow" << std::endl;
+                return;
+            }
+            vm.st.leave(vm.frames.back().callerBase);
+            pc = vm.frames.back().returnPc;
+            vm.frames.pop_back();
+        }
+
+        // Continues at the halt cell after the program.
+        void end() {
+            vm.st.clear();
+            pc = vm.thread.data() + vm.thread.size() - 1;
+        }
+    };
+    typedef OpcodeSemantics<Policy> Semantics;
+
+    // Builds the thread when `code` is given, otherwise runs the current one.
+    // Both live in one function because label addresses are only visible here.
+    void execute(const std::span<const uint32_t>* code) {
+        if (code) {
+            void* labels[256];
+            for (void*& label : labels) {
+                label = &&op_illegal;
+            }
+#define OPCODE_LABEL(op) labels[op] = &&op_##op;
+            FOR_EACH_OPCODE(OPCODE_LABEL)
+#undef OPCODE_LABEL
+
+            std::span<const uint32_t> ins = *code;
+            const InstructionBoundaries boundaries = decodeBoundaries(ins);
+            thread.assign(ins.size() + 1, 0);
+            // Targets past the end land on the halt cell.
+            auto cell = [&](uint32_t target) {
+                boundaries.target(target);
+                return reinterpret_cast<uintptr_t>(&thread[std::min<size_t>(target, ins.size())]);
+            };
+            for (uint32_t pointer : boundaries.starts) {
+                uint32_t opcode = ins[pointer];
+                thread[pointer] = reinterpret_cast<uintptr_t>(opcode < 256 ? labels[opcode] : &&op_illegal);
+                uint32_t mask = jumpOperandMask(opcode);
+                for (uint32_t i = 0; i < operandCount(opcode); ++i, mask >>= 1) {
+                    uint32_t operand = ins[pointer + 1 + i];
+                    thread[pointer + 1 + i] = mask & 1 ? cell(operand) : operand;
+                }
+            }
+            // Running off the end of the program behaves like DT_END.
+            thread[ins.size()] = reinterpret_cast<uintptr_t>(&&op_halt);
+            return;
+        }
+
+        const uintptr_t* pc = thread.data();
+#define DISPATCH() goto *reinterpret_cast<void*>(*pc)
+        DISPATCH();
+
+        // Every handler gets its own policy, so pc never has its address
+        // taken and stays in a register across the whole run. The asm
+        // comment makes each handler's tail distinct, which keeps GCC from
+        // merging the dispatch jumps of handlers that end alike.
+#define OPCODE_HANDLER(op) \
+    op_##op: { \
+        const uintptr_t* operands = pc + 1; \
+        Policy policy(*this, pc + operandCount(op) + 1); \
+        Semantics::execute<op>(policy, operands); \
+        pc = policy.pc; \
+        asm("# " #op); \
+        DISPATCH(); \
+    }
+        FOR_EACH_OPCODE(OPCODE_HANDLER)
+#undef OPCODE_HANDLER
+
+    op_illegal: {
+        Policy policy(*this, pc);
+        Semantics::illegal(policy);
+        return;
+    }
+    op_halt:
+        return;
+#undef DISPATCH
+    }
+
+public:
+    uint32_t debug_num;
+    explicit GotoThreadingVM(size_t stackDepth = OperandStack::defaultDepth, const VMMemory::Options& memoryOptions = VMMemory::Options()) : st(stackDepth), memory(memoryOptions), buffer(memory.data()) {
+        debug_num = 0xFFFFFFFF;
+        frames.reserve(1 << 10);
+    }
+
+
+    void run_vm(std::string filename, bool benchmarkMode) {
+        try {
+            MappedProgram program(filename);
+            std::span<const uint32_t> code = program.code();
+            execute(&code);
+            if (benchmarkMode) {
+                std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
+            }
+            memory.trapFaults([&] { execute(nullptr); });
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    void run_vm(const std::vector<uint32_t>& code) {
+        try {
+            std::span<const uint32_t> view(code);
+            execute(&view);
+            memory.trapFaults([&] { execute(nullptr); });
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    char* getBuffer() {
+        return buffer;
+    }
+};
+#endif // GOTOTHREADING_H
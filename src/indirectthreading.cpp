@@ -1,490 +1,217 @@
 #ifndef INDIRECTTHREADING_H
 #define INDIRECTTHREADING_H
 #include <vector>
-#include <stack>
+#include <span>
+#include <array>
 #include <iostream>
+#include <cstring>
 #include <unistd.h>
 #include <fstream>
-#include <map>
-#include <unordered_set>   
 #include <fcntl.h>    
 #include <sys/types.h> 
 #include <sys/stat.h>  
 #include "readfile.hpp"
+#include "superinstructions.hpp"
+#include "semantics.hpp"
+#include "operandstack.hpp"
+#include "verifier.hpp"
 #ifdef _WIN32
 #include <windows.h> // Windows-specific headers for file operations
 #endif
 #include "symbol.hpp"
 #include "interface.hpp"
+#include "vmmemory.hpp"
 class IndirectThreadingVM : public Interface{
 private:
-    uint32_t ip; // Instruction pointer
-    std::vector<std::stack<uint32_t>> sts; // Stack for operations
-    std::stack<uint32_t> st;
-    std::vector<uint32_t> instructions; // Instruction set
-    std::vector<uint32_t> thread;
-    char* buffer; // Memory buffer
-    void (IndirectThreadingVM::*instructionTable[256])(void); // Function pointer table for instructions
-    std::stack<uint32_t> callStack; // Call stack for function calls
-    uint32_t length;
-    float to_float(uint32_t val) {
-        return *reinterpret_cast<float*>(&val);
-    }
-
-    uint32_t from_float(float val) {
-        return *reinterpret_cast<uint32_t*>(&val);
-    }
+    typedef void (*Handler)(IndirectThreadingVM&, const uint32_t*);
 
-    void write_memory(char* buffer,uint32_t* src, uint32_t offset, uint32_t size) {
-        memcpy(buffer + offset, src, size);
-    }
+    // One pre-decoded instruction: its handler and its operands inline, with
+    // jump operands already resolved to record indices. A dispatch touches a
+    // single record, and records never straddle a cache line.
+    struct alignas(32) Record {
+        Handler handler;
+        uint32_t operand[4];
+    };
 
-    void write_mem32(char* buffer, uint32_t val, uint32_t offset) {
-        uint32_t buf[1];
-        buf[0] = val;
-        write_memory(buffer, (uint32_t *)buf, offset, 4);
-    }
+    uint32_t ip; // Instruction pointer
+    OperandStack st;
+    std::vector<Record> records; // The thread
+    VMMemory memory;
+    char* buffer; // memory.data()
+    struct Frame {
+        uint32_t returnIp;     // The DT_CALL to continue after
+        uint32_t* callerBase;  // Caller's frame base in st
+    };
+    std::vector<Frame> frames; // Call stack for function calls
+    bool verifiedProgram;
+    friend struct OpcodeSemantics<IndirectThreadingVM>;
+    friend struct UncheckedPolicy<IndirectThreadingVM>;
+    typedef OpcodeSemantics<IndirectThreadingVM> Semantics;
+    typedef OpcodeSemantics<UncheckedPolicy<IndirectThreadingVM>> UncheckedSemantics;
 
-    void read_memory(char* buffer, uint8_t* dst, uint32_t offset, uint32_t size) {
-        memcpy(dst, buffer + offset, size);
-    }
 
-    uint32_t read_mem32(char* buffer, uint32_t offset) {
-        uint32_t buf[1];
-        read_memory(buffer, (uint8_t *)buf, offset, 4);
-        return buf[0];
-    }
-    // Define operations for each instruction
-    inline void do_add() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(a + b);
+    // Stack and control-flow policy for semantics.hpp. Jump operands are
+    // record indices.
+    inline void push(uint32_t value) {
+        st.push(value);
     }
 
-    inline void do_sub() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b - a);
+    inline uint32_t pop() {
+        return st.pop();
     }
 
-    inline void do_mul() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(a * b);
+    inline uint32_t top() {
+        return st.top();
     }
 
-    inline void do_div() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        if (b == 0) {
-            std::cerr << "Error: Divided by zero error" << std::endl;
-            return;
-        }
-        st.push(b / a);
+    inline bool empty() {
+        return st.empty();
     }
 
-    inline void do_fp_add() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        float result = a + b;
-        st.push(from_float(result));
-    }
-
-    inline void do_fp_sub() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        float result = b - a;
-        st.push(from_float(result));
+    inline void jump(uint32_t target) {
+        ip = target - 1;
     }
 
-    inline void do_fp_mul() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        float result = a * b;
-        st.push(from_float(result));
+    inline void call(uint32_t target, uint32_t num_params) {
+        frames.push_back(Frame{ip, st.enter(num_params)});
+        jump(target);
     }
 
-    inline void do_fp_div() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        if (b == 0.0f) {
-            std::cerr << "Division by zero error" << std::endl;
+    inline void ret() {
+        if (frames.empty()) {
+            std::cerr << "Error: Call stack underflow" << std::endl;
             return;
         }
-        float result = b / a;
-        st.push(from_float(result));
-    }
-
-    inline void do_inc() {
-        uint32_t a = st.top(); st.pop();
-        st.push(++a);
-    }
-
-    inline void do_dec() {
-        uint32_t a = st.top(); st.pop();
-        st.push(--a);
-    }
-
-    inline void do_shl() {
-        uint32_t shift = st.top(); st.pop();
-        uint32_t value = st.top(); st.pop();
-        st.push(value << shift);
+        st.leave(frames.back().callerBase);
+        ip = frames.back().returnIp;
+        frames.pop_back();
     }
 
-    inline void do_shr() {
-        uint32_t shift = st.top(); st.pop();
-        uint32_t value = st.top(); st.pop();
-        st.push(value >> shift);
-    }
-
-    inline void do_end() {
-        st = std::stack<uint32_t>();
-        instructions = std::vector<uint32_t>();
-        thread = std::vector<uint32_t>();
+    inline void end() {
+        st.clear();
+        records = std::vector<Record>();
         ip =0;
     }
 
-    inline void do_lod() {
-        uint32_t offset = instructions[thread[ip]+1];
-        uint32_t a = read_mem32(buffer,offset);
-        st.push(a);
-    } 
-
-    inline void do_sto() {
-        uint32_t offset = instructions[thread[ip]+1];
-        uint32_t a = st.top(); st.pop();
-        write_mem32(buffer,a,offset);
-    }
-
-    inline void do_immi() {
-        uint32_t a = instructions[thread[ip]+1];
-        st.push(a);
+    template <uint32_t Op>
+    static void handler(IndirectThreadingVM& vm, const uint32_t* operand) {
+        Semantics::execute<Op>(vm, operand);
     }
 
-    inline void do_memcpy() {
-        uint32_t dest = instructions[thread[ip]+1];
-        uint32_t src = instructions[thread[ip]+2];
-        uint32_t len = instructions[thread[ip]+3];
-        memcpy(buffer + dest, buffer + src, len);
+    template <uint32_t Op>
+    static void unchecked_handler(IndirectThreadingVM& vm, const uint32_t* operand) {
+        UncheckedPolicy<IndirectThreadingVM> policy(vm);
+        UncheckedSemantics::execute<Op>(policy, operand);
     }
 
-    inline void do_memset() {
-        uint32_t dest = instructions[thread[ip]+1];
-        uint32_t val = instructions[thread[ip]+2];
-        uint32_t len = instructions[thread[ip]+3];
-        memset(buffer + dest, val, len);
-    }
-    inline void do_sto_immi() {
-        uint32_t offset = instructions[thread[ip]+1];
-        uint32_t number = instructions[thread[ip]+2];
-        write_mem32(buffer,number,offset);
+    static void illegal(IndirectThreadingVM& vm, const uint32_t*) {
+        Semantics::illegal(vm);
     }
 
-    inline void do_jmp() {
-        uint32_t target = instructions[thread[ip]+1];
-        ip = target - 1;
+    // Handlers without stack checks are only for verified programs.
+    static Handler instruction_handler(uint32_t opcode, bool unchecked) {
+        static const auto instructionTable = [] {
+            std::array<std::array<Handler, 256>, 2> handlers;
+            handlers[0].fill(&IndirectThreadingVM::illegal);
+            handlers[1].fill(&IndirectThreadingVM::illegal);
+#define TABLE_ENTRY(op) \
+            handlers[0][op] = &IndirectThreadingVM::handler<op>; \
+            handlers[1][op] = &IndirectThreadingVM::unchecked_handler<op>;
+            FOR_EACH_OPCODE(TABLE_ENTRY)
+#undef TABLE_ENTRY
+            return handlers;
+        }();
+        return opcode < 256 ? instructionTable[unchecked][opcode] : &IndirectThreadingVM::illegal;
     }
 
-    inline void do_jz() {
-        uint32_t target = instructions[thread[ip]+1];
-        if (st.top() == 0) {
-            ip = target - 1;
+    // The record for the instruction at code[start]; operands missing at the
+    // end of the code read as 0.
+    static Record decode(std::span<const uint32_t> code, uint32_t start, bool unchecked = false) {
+        Record record = {};
+        if (start >= code.size()) {
+            record.handler = &IndirectThreadingVM::illegal;
+            return record;
         }
-        st.pop();
-    }
-
-    inline void do_jump_if() {
-        uint32_t condition = st.top(); st.pop();
-        uint32_t target = instructions[thread[ip]+1];
-        if (condition) {
-            ip = target - 1;
+        record.handler = instruction_handler(code[start], unchecked);
+        for (uint32_t k = 0; k < operandCount(code[start]) && start + 1 + k < code.size(); ++k) {
+            record.operand[k] = code[start + 1 + k];
         }
-    }
-
-    inline void do_if_else() {
-        uint32_t condition = st.top(); st.pop();
-        uint32_t trueBranch = instructions[thread[ip]+1];
-        uint32_t falseBranch = instructions[thread[ip]+2];
-        ip = condition ? trueBranch - 1 : falseBranch - 1;
-    }
-
-    inline void do_gt() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b > a ? 1 : 0);
-    }
-
-    inline void do_lt() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b < a ? 1 : 0);
-    }
-
-    inline void do_eq() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b == a ? 1 : 0);
-    }
-
-    inline void do_gt_eq() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b >= a ? 1 : 0);
-    }
-
-    inline void do_lt_eq() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b <= a ? 1 : 0);
-    }
-
-    inline void do_call() {
-        uint32_t target = instructions[thread[ip]+1]; 
-        uint32_t num_params = instructions[thread[ip]+2]; 
-        std::stack<uint32_t> newStack;
-         for (uint32_t i = 0; i < num_params; ++i) {
-            newStack.push(st.top());
-            st.pop();
-        }
-        sts.push_back(newStack);
-        st=sts.back();//st always refer to the top of stacks.
-        callStack.push(ip); 
-        ip = target - 1; 
-    }
-
-    inline void do_ret() {
-        if (callStack.empty()) {
-            std::cerr << "Error: Call stack underflow" << std::endl;
-            return;
-        }
-        uint32_t return_value = st.top();
-        ip = callStack.top(); callStack.pop(); 
-        sts.pop_back();
-        st = sts.back();
-        st.push(return_value);
-    }
-
-    inline void do_seek() {
-        debug_num = st.top();
-    }
-
-    inline void do_print() {
-        if (!st.empty()) {
-            std::cout <<(int)st.top() << std::endl;
-        } else {
-            std::cerr << "Stack is empty." << std::endl;
-        }
-    }
-
-    inline void do_print_fp() {
-        if (!st.empty()) {
-            uint32_t num = st.top();
-            float* floatPtr = (float*)&num;
-            std::cout <<*floatPtr << std::endl;
-        } else {
-            std::cerr << "Stack is empty." << std::endl;
+        return record;
+    }
+
+    // Builds the thread: one record per instruction, with every jump operand
+    // rewritten to the record index of its target. Programs that verify with
+    // a stack bound that fits get the unchecked handlers.
+    void preprocess(std::span<const uint32_t> source) {
+        std::vector<uint32_t> code = fuseSuperinstructions(source);
+        Verification verification = verifyBytecode(code, memory.size());
+        verifiedProgram = verification.ok && verification.stackBound <= st.capacity();
+        const InstructionBoundaries boundaries = decodeBoundaries(code);
+
+        records.clear();
+        records.reserve(boundaries.count());
+        for (uint32_t start : boundaries.starts) {
+            Record record = decode(code, start, verifiedProgram);
+            uint32_t mask = jumpOperandMask(code[start]);
+            for (uint32_t k = 0; mask; ++k, mask >>= 1) {
+                if (mask & 1) record.operand[k] = boundaries.target(record.operand[k]);
+            }
+            records.push_back(record);
         }
     }
 
-    inline void do_read_fp() {
-        uint32_t offset = instructions[thread[ip]+1];
-        float val;
-        std::cin >> val; 
-        write_mem32(buffer,from_float(val), offset);
-    }
-
-    inline void do_read_int() {
-        uint32_t offset = instructions[thread[ip]+1];
-        int val;
-        std::cin >> val;
-        write_mem32(buffer, val, offset);
-    }
-
-    inline void tik(){
-        std::cout<<"tik"<<std::endl;
-    }
-
-    void init_instruction_table() {
-        instructionTable[DT_ADD] = &IndirectThreadingVM::do_add;
-        instructionTable[DT_SUB] = &IndirectThreadingVM::do_sub;
-        instructionTable[DT_MUL] = &IndirectThreadingVM::do_mul;
-        instructionTable[DT_DIV] = &IndirectThreadingVM::do_div;
-        instructionTable[DT_SHL] = &IndirectThreadingVM::do_shl;
-        instructionTable[DT_SHR] = &IndirectThreadingVM::do_shr;
-        instructionTable[DT_FP_ADD] = &IndirectThreadingVM::do_fp_add;
-        instructionTable[DT_FP_SUB] = &IndirectThreadingVM::do_fp_sub;
-        instructionTable[DT_FP_MUL] = &IndirectThreadingVM::do_fp_mul;
-        instructionTable[DT_FP_DIV] = &IndirectThreadingVM::do_fp_div;
-        instructionTable[DT_END] = &IndirectThreadingVM::do_end;
-        instructionTable[DT_LOD] = &IndirectThreadingVM::do_lod;
-        instructionTable[DT_STO] = &IndirectThreadingVM::do_sto;
-        instructionTable[DT_IMMI] = &IndirectThreadingVM::do_immi;
-        instructionTable[DT_STO_IMMI] = &IndirectThreadingVM::do_sto_immi;
-        instructionTable[DT_MEMCPY] = &IndirectThreadingVM::do_memcpy;
-        instructionTable[DT_MEMSET] = &IndirectThreadingVM::do_memset;
-        instructionTable[DT_INC] = &IndirectThreadingVM::do_inc;
-        instructionTable[DT_DEC] = &IndirectThreadingVM::do_dec;
-        instructionTable[DT_JMP] = &IndirectThreadingVM::do_jmp;
-        instructionTable[DT_JZ] = &IndirectThreadingVM::do_jz;
-        instructionTable[DT_IF_ELSE] = &IndirectThreadingVM::do_if_else;
-        instructionTable[DT_JUMP_IF] = &IndirectThreadingVM::do_jump_if;
-        instructionTable[DT_GT] = &IndirectThreadingVM::do_gt;
-        instructionTable[DT_LT] = &IndirectThreadingVM::do_lt;
-        instructionTable[DT_EQ] = &IndirectThreadingVM::do_eq;
-        instructionTable[DT_GT_EQ] = &IndirectThreadingVM::do_gt_eq;
-        instructionTable[DT_LT_EQ] = &IndirectThreadingVM::do_lt_eq;
-        instructionTable[DT_CALL] = &IndirectThreadingVM::do_call;
-        instructionTable[DT_RET] = &IndirectThreadingVM::do_ret;
-        instructionTable[DT_SEEK] = &IndirectThreadingVM::do_seek;
-        instructionTable[DT_PRINT] = &IndirectThreadingVM::do_print;
-        instructionTable[DT_READ_INT] = &IndirectThreadingVM::do_read_int;
-        instructionTable[DT_FP_PRINT] = &IndirectThreadingVM::do_print_fp;
-        instructionTable[DT_FP_READ] = &IndirectThreadingVM::do_read_fp;
-        instructionTable[DT_Tik] = &IndirectThreadingVM::tik;
-    }
-
 public:
     uint32_t debug_num;
-    IndirectThreadingVM() : ip(0), buffer(new char[4 * 1024 * 1024]) { 
-        init_instruction_table();
+    explicit IndirectThreadingVM(size_t stackDepth = OperandStack::defaultDepth, const VMMemory::Options& memoryOptions = VMMemory::Options())
+        : ip(0), st(stackDepth), memory(memoryOptions), buffer(memory.data()), verifiedProgram(false) { 
         debug_num = 0xFFFFFFFF;
-        sts.push_back(std::stack<uint32_t>());
-        st = sts.back();
+        frames.reserve(1 << 10);
     }
 
-    ~IndirectThreadingVM() {
-        delete[] buffer;
-    }
 
+    // Runs an already threaded program: thd lists the offset of every
+    // instruction in ins, and jump operands are indices into thd.
     void run_vm(const std::vector<uint32_t>& ins,const std::vector<uint32_t>& thd) {
-        instructions = ins;
-        thread = thd;
-        for (ip = 0; ip < thread.size(); ip++) {
-            (this->*instructionTable[instructions[thread[ip]]])();
+        records.clear();
+        records.reserve(thd.size());
+        verifiedProgram = false;
+        for (uint32_t start : thd) {
+            records.push_back(decode(ins, start));
         }
+        run_vm();
     } 
     
     void run_vm() {
-        for (ip = 0; ip < thread.size(); ip++) {
-            (this->*instructionTable[instructions[thread[ip]]])();
-        }
+        memory.trapFaults([&] {
+            for (ip = 0; ip < records.size(); ip++) {
+                const Record& record = records[ip];
+                record.handler(*this, record.operand);
+            }
+        });
     }
 
     void run_vm(std::string filename,bool benchmarkMode){
-        std::vector<uint32_t> code = readFileToUint32Array(filename);
-        std::map<int,int> dic;
-        std::unordered_set<uint32_t> st;
-        uint32_t thread_count = 0;
-        uint32_t pointer_thd = 0;
-        while(pointer_thd<code.size()){
-            switch (code[pointer_thd])
-            {
-            case DT_LOD:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                break;
-            case DT_STO:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                break;
-            case DT_IMMI:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                break;
-            case DT_MEMCPY:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                break;
-            case DT_MEMSET:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                break;
-            case DT_STO_IMMI:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                break;
-            case DT_JMP:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                st.insert(pointer_thd+1);
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]);
-                break;
-            case DT_JZ:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                st.insert(pointer_thd+1);
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]); 
-                break;
-            case DT_IF_ELSE:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                st.insert(pointer_thd+1);
-                st.insert(pointer_thd+2);
-                instructions.push_back(code[pointer_thd++]); 
-                instructions.push_back(code[pointer_thd++]); 
-                instructions.push_back(code[pointer_thd++]); 
-                break;
-            case DT_JUMP_IF:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                st.insert(pointer_thd+1);
-                instructions.push_back(code[pointer_thd++]); 
-                instructions.push_back(code[pointer_thd++]); 
-            case DT_CALL:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                st.insert(pointer_thd+1);
-                instructions.push_back(code[pointer_thd++]); 
-                instructions.push_back(code[pointer_thd++]);
-                instructions.push_back(code[pointer_thd++]); 
-                break;
-            case DT_READ_INT:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                instructions.push_back(code[pointer_thd++]); 
-                instructions.push_back(code[pointer_thd++]); 
-                break;
-            case DT_FP_READ:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                instructions.push_back(code[pointer_thd++]); 
-                instructions.push_back(code[pointer_thd++]); 
-                break;
-            default:
-                thread.push_back(pointer_thd);
-                dic[pointer_thd] = thread_count++;
-                instructions.push_back(code[pointer_thd++]);
-                break;
+        try {
+            MappedProgram program(filename);
+            preprocess(program.code());
+            if (benchmarkMode) {
+                std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
             }
+            run_vm();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
         }
+    }
 
-        for (auto it = st.begin(); it != st.end(); ++it){
-            instructions[*it] = dic[instructions[*it]];
-        }
-        if (benchmarkMode) {
-            std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
+    void run_vm(const std::vector<uint32_t>& code) {
+        try {
+            preprocess(code);
+            run_vm();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
         }
-        run_vm();
-    } 
+    }
+
     std::vector<uint32_t> convertToVMFormat(const std::string& input) {
         std::vector<uint32_t> output;
         for (char c : input) {
@@ -497,7 +224,10 @@ public:
     char* getBuffer() {
         return buffer;
     }
+
+    // Whether the last program runs on the unchecked handlers.
+    bool verified() const {
+        return verifiedProgram;
+    }
 };
 #endif // INDIRECTTHREADING_H
-
-
@@ -1,38 +1,99 @@
 #include "interface.hpp"
-#ifdef direct
+#ifdef directthreading
 #include "directthreading.cpp"
 #endif
-#ifdef indirect
+#ifdef indirectthreading
 #include "indirectthreading.cpp"
 #endif
-#ifdef routine
+#ifdef routinethreading
 #include "routinethreading.cpp"
 #endif
+#ifdef gotothreading
+#include "gotothreading.cpp"
+#endif
+#ifdef tosthreading
+#include "tosthreading.cpp"
+#endif
+#ifdef registerthreading
+#include "registerthreading.cpp"
+#endif
+#ifdef tailcallthreading
+#include "tailcallthreading.cpp"
+#endif
+#ifdef tracethreading
+#include "tracethreading.cpp"
+#endif
+#ifdef copypatchthreading
+#include "copypatchthreading.cpp"
+#endif
 #include <memory>
+#include <optional>
+#include <string>
 #include <iostream>
 int main(int argc, char* argv[]){
     bool isBenchmark = false;
+    #if defined(routinethreading)
+    bool blockDispatch = false;
+    #endif
+    #if defined(tracethreading)
+    bool traceStats = false;
+    #endif
+    VMMemory::Options memory;
+    std::optional<size_t> stackDepth; // Each engine's own default when unset
     std::string filename;
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "--benchmark" && i + 1 < argc) {
             isBenchmark = true;
             filename = argv[++i];
+        } else if (arg == "--block-dispatch") {
+            // Only the routine engine's interpreter dispatches per block
+            #if defined(routinethreading)
+            blockDispatch = true;
+            #endif
+        } else if (arg == "--trace-stats") {
+            #if defined(tracethreading)
+            traceStats = true;
+            #endif
+        } else if (arg == "--memory" && i + 1 < argc) {
+            memory.size = std::stoull(argv[++i]);
+        } else if (arg == "--stack" && i + 1 < argc) {
+            stackDepth = std::stoull(argv[++i]);
+        } else if (arg == "--reserve" && i + 1 < argc) {
+            memory.reservation = std::stoull(argv[++i]);
+        } else if (arg == "--huge-pages") {
+            memory.hugePages = true;
         } else if (filename.empty()) {
             filename = arg;
         }
     }
     if (filename.empty()) {
-        std::cerr << "Usage: " << argv[0] << " [--benchmark] <filename>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--benchmark] [--block-dispatch] [--trace-stats] [--memory <bytes>] [--reserve <bytes>] [--stack <slots>] [--huge-pages] <filename>" << std::endl;
         return 1;
     }
     std::unique_ptr<Interface> vm;
-    #ifdef direct
-    vm = std::make_unique<DirectThreadingVM>();
-    #elif indirect
-    vm = std::make_unique<IndirectThreadingVM>(); 
-    #elif routine
-    vm = std::make_unique<RoutineThreadingVM>();
+    #if defined(directthreading)
+    vm = std::make_unique<DirectThreadingVM>(stackDepth.value_or(OperandStack::defaultDepth), memory);
+    #elif defined(indirectthreading)
+    vm = std::make_unique<IndirectThreadingVM>(stackDepth.value_or(OperandStack::defaultDepth), memory); 
+    #elif defined(routinethreading)
+    auto routine = std::make_unique<RoutineThreadingVM>(stackDepth.value_or(OperandStack::defaultDepth), memory);
+    routine->setNativeMode(!blockDispatch); // The interpreter dispatches per basic block
+    vm = std::move(routine);
+    #elif defined(gotothreading)
+    vm = std::make_unique<GotoThreadingVM>(stackDepth.value_or(OperandStack::defaultDepth), memory);
+    #elif defined(tosthreading)
+    vm = std::make_unique<TosThreadingVM>(stackDepth.value_or(TosThreadingVM::defaultDepth), memory);
+    #elif defined(registerthreading)
+    vm = std::make_unique<RegisterVM>(stackDepth.value_or(RegisterVM::defaultDepth), memory);
+    #elif defined(tailcallthreading)
+    vm = std::make_unique<TailCallVM>(stackDepth.value_or(TailCallVM::defaultDepth), memory);
+    #elif defined(tracethreading)
+    auto trace = std::make_unique<TraceVM>(stackDepth.value_or(TraceVM::defaultDepth), memory);
+    trace->setTraceStats(traceStats);
+    vm = std::move(trace);
+    #elif defined(copypatchthreading)
+    vm = std::make_unique<CopyPatchVM>(stackDepth.value_or(CopyPatchVM::defaultDepth), memory);
     #endif
     if (!vm) {
         std::cerr << "Virtual machine implementation not initialized." << std::endl;
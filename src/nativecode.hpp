@@ -0,0 +1,171 @@
+#ifndef NATIVECODE_HPP
+#define NATIVECODE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <initializer_list>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define THD_NATIVE_X64 1
+#endif
+
+// An anonymous mapping that is written while read/write and then sealed
+// read/execute, so it is never writable and executable at the same time.
+class ExecutableBuffer {
+    uint8_t* base;
+    size_t capacity;
+    bool sealed;
+
+public:
+    ExecutableBuffer() : base(nullptr), capacity(0), sealed(false) {}
+    ExecutableBuffer(const ExecutableBuffer&) = delete;
+    ExecutableBuffer& operator=(const ExecutableBuffer&) = delete;
+    ExecutableBuffer(ExecutableBuffer&& other) noexcept
+        : base(std::exchange(other.base, nullptr)), capacity(std::exchange(other.capacity, 0)),
+          sealed(std::exchange(other.sealed, false)) {}
+    ExecutableBuffer& operator=(ExecutableBuffer&& other) noexcept {
+        if (this != &other) {
+            release();
+            base = std::exchange(other.base, nullptr);
+            capacity = std::exchange(other.capacity, 0);
+            sealed = std::exchange(other.sealed, false);
+        }
+        return *this;
+    }
+    ~ExecutableBuffer() {
+        release();
+    }
+
+    // `near` is only a placement hint so that rel32 calls into the host
+    // binary stay in range; callers must cope with any address.
+    bool allocate(size_t size, const void* near = nullptr) {
+        release();
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size = (size + page - 1) & ~(page - 1);
+        void* hint = nullptr;
+        if (near) {
+            uintptr_t h = reinterpret_cast<uintptr_t>(near) & ~(uintptr_t)(page - 1);
+            hint = reinterpret_cast<void*>(h > (64u << 20) ? h - (64u << 20) : h + (64u << 20));
+        }
+        void* p = mmap(hint, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        base = static_cast<uint8_t*>(p);
+        capacity = size;
+        sealed = false;
+        return true;
+    }
+
+    bool seal() {
+        if (!base || mprotect(base, capacity, PROT_READ | PROT_EXEC) != 0) {
+            return false;
+        }
+        sealed = true;
+        return true;
+    }
+
+    void release() {
+        if (base) {
+            munmap(base, capacity);
+        }
+        base = nullptr;
+        capacity = 0;
+        sealed = false;
+    }
+
+    uint8_t* data() const { return base; }
+    size_t size() const { return capacity; }
+    bool executable() const { return sealed; }
+};
+
+// Minimal x86-64 encoder for the handful of instructions the native
+// backends emit. Bytes go straight into an ExecutableBuffer so that rel32
+// displacements can be computed against final addresses.
+class X64Assembler {
+    uint8_t* base;
+    size_t capacity;
+    size_t pos;
+    bool overflow;
+    struct Fixup {
+        size_t at;       // offset of the rel32 field
+        uint32_t label;  // label index it refers to
+    };
+    std::vector<Fixup> fixups;
+
+public:
+    X64Assembler(uint8_t* base, size_t capacity) : base(base), capacity(capacity), pos(0), overflow(false) {}
+
+    size_t offset() const { return pos; }
+    uint8_t* address(size_t at) const { return base + at; }
+    bool overflowed() const { return overflow; }
+
+    void emit8(uint8_t b) {
+        if (pos < capacity) {
+            base[pos] = b;
+        } else {
+            overflow = true;
+        }
+        pos++;
+    }
+
+    void emit32(uint32_t v) {
+        for (int i = 0; i < 4; ++i) emit8(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void emit64(uint64_t v) {
+        for (int i = 0; i < 8; ++i) emit8(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void bytes(std::initializer_list<uint8_t> list) {
+        for (uint8_t b : list) emit8(b);
+    }
+
+    // Direct call when the target is within rel32 reach, otherwise through rax.
+    void call(const void* target) {
+        intptr_t rel = reinterpret_cast<intptr_t>(target) - reinterpret_cast<intptr_t>(base + pos + 5);
+        if (rel >= INT32_MIN && rel <= INT32_MAX) {
+            emit8(0xE8);
+            emit32(static_cast<uint32_t>(rel));
+        } else {
+            bytes({0x48, 0xB8});                       // movabs rax, imm64
+            emit64(reinterpret_cast<uint64_t>(target));
+            bytes({0xFF, 0xD0});                       // call rax
+        }
+    }
+
+    void mov_esi(uint32_t imm) { emit8(0xBE); emit32(imm); }
+    void mov_edx(uint32_t imm) { emit8(0xBA); emit32(imm); }
+    void mov_ecx(uint32_t imm) { emit8(0xB9); emit32(imm); }
+    void mov_r8d(uint32_t imm) { emit8(0x41); emit8(0xB8); emit32(imm); }
+    void mov_eax(uint32_t imm) { emit8(0xB8); emit32(imm); }
+    void test_eax() { bytes({0x85, 0xC0}); }
+    void ret() { emit8(0xC3); }
+
+    // Branches to a VM label; the rel32 is patched by resolve().
+    void jmp_label(uint32_t label) { emit8(0xE9); fixup(label); }
+    void jz_label(uint32_t label) { bytes({0x0F, 0x84}); fixup(label); }
+    void jnz_label(uint32_t label) { bytes({0x0F, 0x85}); fixup(label); }
+    void call_label(uint32_t label) { emit8(0xE8); fixup(label); }
+
+    void fixup(uint32_t label) {
+        fixups.push_back({pos, label});
+        emit32(0);
+    }
+
+    // Patches every rel32 field against `labels`, which holds buffer offsets.
+    void resolve(const std::vector<size_t>& labels) {
+        for (const Fixup& f : fixups) {
+            if (f.at + 4 > capacity) continue;
+            int32_t rel = static_cast<int32_t>(static_cast<int64_t>(labels[f.label]) - static_cast<int64_t>(f.at + 4));
+            memcpy(base + f.at, &rel, 4);
+        }
+    }
+};
+
+#endif // NATIVECODE_HPP
@@ -0,0 +1,157 @@
+#ifndef OPERANDSTACK_HPP
+#define OPERANDSTACK_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Operand stack for the engines that keep it out of line: one buffer
+// allocated up front and a raw stack pointer into it. Call frames are windows
+// into the same buffer starting at a frame base, so DT_CALL and DT_RET move
+// pointers instead of values. Running past the end of the buffer or below the
+// frame base is a VM trap, reported the same way the contiguous-stack engines
+// do.
+class OperandStack {
+public:
+    static constexpr size_t defaultDepth = 1 << 16;
+
+    // Contents and frame base, for snapshots.
+    struct Saved {
+        std::vector<uint32_t> values;
+        size_t base = 0;
+    };
+
+    explicit OperandStack(size_t depth = defaultDepth)
+        : slots(new uint32_t[depth]), base(slots.get()), sp(slots.get()), limit(slots.get() + depth) {}
+
+    OperandStack(const OperandStack&) = delete;
+    OperandStack& operator=(const OperandStack&) = delete;
+
+    void push(uint32_t value) {
+        if (sp == limit) [[unlikely]] {
+            overflow();
+        }
+        *sp++ = value;
+    }
+
+    uint32_t pop() {
+        if (sp == base) [[unlikely]] {
+            underflow();
+        }
+        return *--sp;
+    }
+
+    uint32_t top() const {
+        if (sp == base) [[unlikely]] {
+            underflow();
+        }
+        return sp[-1];
+    }
+
+    // For programs the verifier has proven never to underflow and never to
+    // need more than capacity() slots.
+    void pushUnchecked(uint32_t value) {
+        *sp++ = value;
+    }
+
+    uint32_t popUnchecked() {
+        return *--sp;
+    }
+
+    uint32_t topUnchecked() const {
+        return sp[-1];
+    }
+
+    // Both relative to the current frame.
+    bool empty() const {
+        return sp == base;
+    }
+
+    size_t size() const {
+        return sp - base;
+    }
+
+    size_t capacity() const {
+        return limit - slots.get();
+    }
+
+    void clear() {
+        base = sp = slots.get();
+    }
+
+    void save(Saved& saved) const {
+        saved.values.assign(slots.get(), sp);
+        saved.base = base - slots.get();
+    }
+
+    // Frame bases saved alongside (see enter()) stay valid: the buffer never
+    // moves.
+    void restore(const Saved& saved) {
+        std::copy(saved.values.begin(), saved.values.end(), slots.get());
+        sp = slots.get() + saved.values.size();
+        base = slots.get() + saved.base;
+    }
+
+    // DT_CALL: the top num_params values become the bottom of a new frame,
+    // reversed in place as the callee expects them. Returns the caller's
+    // frame base for leave().
+    uint32_t* enter(uint32_t num_params) {
+        if (num_params > size()) {
+            underflow();
+        }
+        uint32_t* callerBase = base;
+        base = sp - num_params;
+        std::reverse(base, sp);
+        return callerBase;
+    }
+
+    // DT_RET: drops the callee's frame and leaves its top value on the
+    // caller's stack.
+    void leave(uint32_t* callerBase) {
+        uint32_t return_value = top();
+        sp = base;
+        base = callerBase;
+        *sp++ = return_value;
+    }
+
+private:
+    [[noreturn]] static void overflow() {
+        throw std::runtime_error("Operand stack overflow");
+    }
+
+    [[noreturn]] static void underflow() {
+        throw std::runtime_error("Operand stack underflow");
+    }
+
+    std::unique_ptr<uint32_t[]> slots;
+    uint32_t* base; // Bottom of the current frame
+    uint32_t* sp;
+    uint32_t* limit;
+};
+
+// Stack policy for semantics.hpp that runs an engine's opcodes on its
+// OperandStack st without bounds checks, forwarding control flow to the
+// engine. Engines instantiate their handlers over it for verified programs
+// (verifier.hpp) and befriend it.
+template <typename Engine>
+struct UncheckedPolicy {
+    Engine& vm;
+    char* buffer;
+    uint32_t& debug_num;
+
+    explicit UncheckedPolicy(Engine& engine) : vm(engine), buffer(engine.buffer), debug_num(engine.debug_num) {}
+
+    void push(uint32_t value) { vm.st.pushUnchecked(value); }
+    uint32_t pop() { return vm.st.popUnchecked(); }
+    uint32_t top() { return vm.st.topUnchecked(); }
+    bool empty() { return vm.st.empty(); }
+    void jump(uint32_t target) { vm.jump(target); }
+    void call(uint32_t target, uint32_t num_params) { vm.call(target, num_params); }
+    void ret() { vm.ret(); }
+    void end() { vm.end(); }
+};
+
+#endif // OPERANDSTACK_HPP
@@ -1,19 +1,63 @@
 #include  "readfile.hpp"
-#include <fstream>    
-std::vector<uint32_t> readFileToUint32Array(const std::string& fileName) {
-    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
-    if (!file) {
+#include "compactcode.hpp"
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedProgram::MappedProgram(const std::string& fileName) : base(nullptr), length(0) {
+    int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         throw std::runtime_error("Can't open file");
     }
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    if (size % sizeof(uint32_t) != 0) {
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Can't read file");
+    }
+    length = static_cast<size_t>(info.st_size);
+    if (length != 0) {
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Can't read file");
+        }
+        base = p;
+        // Engines decode front to back, once
+        madvise(base, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    std::span<const uint8_t> bytes(static_cast<const uint8_t*>(base), length);
+    if (compactcode::isCompact(bytes)) {
+        try {
+            expanded = decodeCompact(bytes);
+        } catch (...) {
+            munmap(base, length);
+            throw;
+        }
+        munmap(base, length);
+        base = nullptr;
+        words = expanded;
+        return;
+    }
+    if (length % sizeof(uint32_t) != 0) {
+        if (base) {
+            munmap(base, length);
+        }
         throw std::runtime_error("The size of file is not a multiple of 4");
     }
-    std::vector<uint8_t> buffer(size);
-    if (!file.read(reinterpret_cast<char*>(buffer.data()), size)) {
-        throw std::runtime_error("Can't read file");
+    words = std::span<const uint32_t>(static_cast<const uint32_t*>(base), length / sizeof(uint32_t));
+}
+
+MappedProgram::~MappedProgram() {
+    if (base) {
+        munmap(base, length);
     }
-    return std::vector<uint32_t>(reinterpret_cast<uint32_t*>(buffer.data()), 
-                                reinterpret_cast<uint32_t*>(buffer.data() + size));
+}
+
+std::vector<uint32_t> readFileToUint32Array(const std::string& fileName) {
+    MappedProgram program(fileName);
+    std::span<const uint32_t> code = program.code();
+    return std::vector<uint32_t>(code.begin(), code.end());
 }
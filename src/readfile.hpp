@@ -2,6 +2,37 @@
 #define READFILE_HPP
 
 #include <vector>
+#include <span>
+#include <string>
+#include <cstddef>
+#include <cstdint>
 
+// A program file mapped read-only. Engines decode straight from the mapping,
+// so loading copies nothing, the kernel only reads the pages that are
+// touched, and processes running the same file share its page cache.
+//
+// Compact programs (compactcode.hpp) are recognised by their magic and
+// expanded to words once; the file is unmapped after that.
+class MappedProgram {
+public:
+    explicit MappedProgram(const std::string& fileName);
+    ~MappedProgram();
+
+    MappedProgram(const MappedProgram&) = delete;
+    MappedProgram& operator=(const MappedProgram&) = delete;
+
+    // Valid while the MappedProgram lives.
+    std::span<const uint32_t> code() const {
+        return words;
+    }
+
+private:
+    void* base;
+    size_t length;
+    std::vector<uint32_t> expanded; // Compact programs only
+    std::span<const uint32_t> words;
+};
+
+// Copying loader, for callers that keep the program after the file is gone.
 std::vector<uint32_t> readFileToUint32Array(const std::string& fileName);
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,501 @@
+#ifndef REGISTERCODE_HPP
+#define REGISTERCODE_HPP
+
+#include <vector>
+#include <span>
+#include <set>
+#include <unordered_map>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "symbol.hpp"
+#include "verifier.hpp"
+
+// Three-address register form of the stack bytecode, produced at load time
+// by translateToRegisters() and run by RegisterVM.
+//
+// Every frame is a window of frameSize registers laid out as
+//
+//   [0, slots)                 memory slots promoted to registers
+//   [slots, slots + constants) constants, one register per distinct value
+//   [slots + constants, ...)   operand stack: depth d lives in register base + d
+//
+// Slots and constants are copied into a callee's window by R_CALL and the
+// slots are copied back by R_RET, so every operand is a plain frame index.
+// Stack opcodes without a register form run on the shared semantics
+// (slotstack.hpp) over the stack registers, through R_SHARED.
+enum RegisterOpcode : uint32_t {
+    R_MOV,                                  // a = b
+    R_ADD, R_SUB, R_MUL, R_DIV, R_SHL, R_SHR, // a = b OP c
+    R_FP_ADD, R_FP_SUB, R_FP_MUL, R_FP_DIV,
+    R_GT, R_LT, R_EQ, R_GT_EQ, R_LT_EQ,
+    R_LOAD,                                 // a = mem[b]
+    R_STORE,                                // mem[a] = b
+    R_MEMCPY, R_MEMSET,                     // As DT_MEMCPY/DT_MEMSET
+    R_JMP,                                  // goto a
+    R_JZ, R_JNZ,                            // if (a ==/!= 0) goto b
+    R_JGT, R_JLT, R_JEQ, R_JNE, R_JGT_EQ, R_JLT_EQ, // if (a OP b) goto c
+    R_IF_ELSE,                              // goto a ? b : c
+    R_CALL,                                 // call a with b params starting at register c
+    R_RET,                                  // return register a
+    R_SEEK, R_PRINT, R_FP_PRINT,            // Register a
+    R_EMPTY,                                // Print on an empty stack
+    R_READ_INT, R_FP_READ,                  // mem[a] = input
+    R_TIK,
+    R_SHARED,                               // shared[a] on the stack registers [b, c)
+    R_END,
+    R_OPCODE_COUNT
+};
+
+struct RegisterInstruction {
+    uint32_t op, a, b, c;
+};
+
+// A stack instruction run by R_SHARED.
+struct SharedInstruction {
+    uint32_t opcode;
+    uint32_t operand[4];
+};
+
+struct RegisterProgram {
+    std::vector<RegisterInstruction> code;
+    std::vector<SharedInstruction> shared;
+    std::vector<uint32_t> slotOffsets; // Register i caches mem[slotOffsets[i]]
+    std::vector<uint32_t> constants;   // Register slots + i holds constants[i]
+    uint32_t frameSize = 0;
+};
+
+namespace registercode {
+
+// Stack effect of everything but DT_CALL/DT_RET.
+inline void stackEffect(uint32_t opcode, uint32_t& pops, uint32_t& pushes) {
+    int32_t delta;
+    verifier::stackEffect(opcode, pops, delta);
+    pushes = pops + delta;
+}
+
+// Opcodes run through R_SHARED.
+inline bool isShared(uint32_t opcode) {
+    return opcode >= DT_MEMCMP && opcode <= DT_DP_DIV;
+}
+
+inline uint32_t binaryOpcode(uint32_t opcode) {
+    switch (opcode) {
+        case DT_ADD: return R_ADD;
+        case DT_SUB: return R_SUB;
+        case DT_MUL: return R_MUL;
+        case DT_DIV: return R_DIV;
+        case DT_SHL: return R_SHL;
+        case DT_SHR: return R_SHR;
+        case DT_FP_ADD: return R_FP_ADD;
+        case DT_FP_SUB: return R_FP_SUB;
+        case DT_FP_MUL: return R_FP_MUL;
+        case DT_FP_DIV: return R_FP_DIV;
+        case DT_GT: return R_GT;
+        case DT_LT: return R_LT;
+        case DT_EQ: return R_EQ;
+        case DT_GT_EQ: return R_GT_EQ;
+        case DT_LT_EQ: return R_LT_EQ;
+    }
+    return R_OPCODE_COUNT;
+}
+
+// Compare-and-branch taken when the comparison `op` holds, or fails.
+inline uint32_t compareBranch(uint32_t op, bool whenTrue) {
+    switch (op) {
+        case R_GT: return whenTrue ? R_JGT : R_JLT_EQ;
+        case R_LT: return whenTrue ? R_JLT : R_JGT_EQ;
+        case R_EQ: return whenTrue ? R_JEQ : R_JNE;
+        case R_GT_EQ: return whenTrue ? R_JGT_EQ : R_JLT;
+        case R_LT_EQ: return whenTrue ? R_JLT_EQ : R_JGT;
+    }
+    return R_OPCODE_COUNT;
+}
+
+} // namespace registercode
+
+// Translates stack bytecode into register form. The operand stack depth has
+// to be the same on every path into an instruction (it always is for code
+// from compiler.py); anything else is rejected with std::runtime_error.
+//
+// Stack entries are tracked symbolically inside a basic block: DT_LOD of a
+// promoted slot and DT_IMMI push the slot or constant register itself, and
+// an arithmetic result that is stored straight back to a slot is computed
+// into the slot. At block boundaries every entry sits in its stack register.
+inline RegisterProgram translateToRegisters(std::span<const uint32_t> code, uint64_t memorySize,
+                                            uint32_t maxSlots = 256) {
+    using namespace registercode;
+    RegisterProgram out;
+
+    // Decode
+    const InstructionBoundaries boundaries = decodeBoundaries(code);
+    const std::vector<uint32_t>& starts = boundaries.starts;
+    const uint32_t count = boundaries.count();
+    for (uint32_t start : starts) {
+        if (code[start] > DT_Tik && !isShared(code[start])) {
+            throw std::runtime_error("Unknown instruction " + std::to_string(code[start]));
+        }
+    }
+
+    // Memory slots accessed through DT_LOD/DT_STO/DT_STO_IMMI become registers
+    // unless some other access overlaps them partially or they are touched by
+    // DT_MEMCPY/DT_MEMSET/DT_READ_INT/DT_FP_READ or a shared opcode.
+    std::set<uint32_t> candidates;
+    std::vector<std::pair<uint64_t, uint64_t>> pinned;
+    for (uint32_t start : starts) {
+        const uint32_t* op = code.data() + start + 1;
+        switch (code[start]) {
+            case DT_LOD: case DT_STO: case DT_STO_IMMI:
+                candidates.insert(op[0]);
+                break;
+            case DT_READ_INT: case DT_FP_READ:
+                pinned.push_back({op[0], uint64_t(op[0]) + 4});
+                break;
+            case DT_MEMCPY:
+                pinned.push_back({op[0], uint64_t(op[0]) + op[2]});
+                pinned.push_back({op[1], uint64_t(op[1]) + op[2]});
+                break;
+            case DT_MEMSET: case DT_MEMCHR:
+                pinned.push_back({op[0], uint64_t(op[0]) + op[2]});
+                break;
+            case DT_MEMCMP: case DT_MEMMOVE:
+                pinned.push_back({op[0], uint64_t(op[0]) + op[2]});
+                pinned.push_back({op[1], uint64_t(op[1]) + op[2]});
+                break;
+            case DT_STRLEN: // Up to the terminator, wherever that is
+                pinned.push_back({op[0], memorySize});
+                break;
+            case DT_LOD8: case DT_LOD8S: case DT_STO8:
+                pinned.push_back({op[0], uint64_t(op[0]) + 1});
+                break;
+            case DT_LOD16: case DT_LOD16S: case DT_STO16:
+                pinned.push_back({op[0], uint64_t(op[0]) + 2});
+                break;
+            case DT_LOD64: case DT_STO64:
+                pinned.push_back({op[0], uint64_t(op[0]) + 8});
+                break;
+            case DT_VADD: case DT_VMUL: case DT_VFP_ADD: case DT_VFP_MUL: case DT_VDOT:
+                for (uint32_t k = 0; k < 3; ++k) {
+                    pinned.push_back({op[k], op[k] + 4 * uint64_t(op[3])});
+                }
+                break;
+        }
+    }
+    std::unordered_map<uint32_t, uint32_t> slotRegister;
+    for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+        uint64_t lo = *it, hi = lo + 4;
+        bool ok = hi <= memorySize && out.slotOffsets.size() < maxSlots;
+        auto next = std::next(it);
+        ok = ok && (next == candidates.end() || *next >= hi);
+        ok = ok && (it == candidates.begin() || uint64_t(*std::prev(it)) + 4 <= lo);
+        for (const auto& range : pinned) {
+            ok = ok && (range.second <= lo || range.first >= hi);
+        }
+        if (ok) {
+            slotRegister[*it] = out.slotOffsets.size();
+            out.slotOffsets.push_back(*it);
+        }
+    }
+    const uint32_t slots = out.slotOffsets.size();
+
+    std::unordered_map<uint32_t, uint32_t> constantRegister;
+    auto addConstant = [&](uint32_t value) {
+        if (constantRegister.emplace(value, slots + out.constants.size()).second) {
+            out.constants.push_back(value);
+        }
+    };
+    for (uint32_t start : starts) {
+        switch (code[start]) {
+            case DT_IMMI: addConstant(code[start + 1]); break;
+            case DT_STO_IMMI: addConstant(code[start + 2]); break;
+            case DT_INC: case DT_DEC: addConstant(1); break;
+        }
+    }
+    const uint32_t stackBase = slots + out.constants.size();
+
+    // Stack depth of every reachable instruction
+    std::vector<int64_t> depth(count + 1, -1);
+    std::vector<bool> leader(count + 1, false);
+    std::vector<uint32_t> work = {0};
+    uint32_t maxDepth = 0;
+    depth[0] = 0;
+    leader[0] = true;
+    auto reach = [&](uint32_t index, int64_t d, bool isLeader) {
+        leader[index] = leader[index] || isLeader;
+        if (index == count) return;
+        if (depth[index] == -1) {
+            depth[index] = d;
+            work.push_back(index);
+        } else if (depth[index] != d) {
+            throw std::runtime_error("Operand stack depth differs between paths into instruction at " +
+                                     std::to_string(starts[index]));
+        }
+    };
+    while (!work.empty()) {
+        uint32_t i = work.back();
+        work.pop_back();
+        if (i == count) continue;
+        const uint32_t opcode = code[starts[i]];
+        const uint32_t* op = code.data() + starts[i] + 1;
+        const int64_t d = depth[i];
+        auto need = [&](int64_t n) {
+            if (d < n) {
+                throw std::runtime_error("Operand stack underflow at " + std::to_string(starts[i]));
+            }
+        };
+        switch (opcode) {
+            case DT_JMP:
+                reach(boundaries.target(op[0]), d, true);
+                break;
+            case DT_JZ: case DT_JUMP_IF:
+                need(1);
+                reach(boundaries.target(op[0]), d - 1, true);
+                reach(i + 1, d - 1, true);
+                break;
+            case DT_IF_ELSE:
+                need(1);
+                reach(boundaries.target(op[0]), d - 1, true);
+                reach(boundaries.target(op[1]), d - 1, true);
+                break;
+            case DT_CALL:
+                need(op[1]);
+                reach(boundaries.target(op[0]), op[1], true);
+                reach(i + 1, d - op[1] + 1, true);
+                maxDepth = std::max<uint32_t>(maxDepth, d - op[1] + 1);
+                break;
+            case DT_RET:
+                need(1);
+                break;
+            case DT_END:
+                break;
+            default: {
+                uint32_t pops, pushes;
+                stackEffect(opcode, pops, pushes);
+                need(pops);
+                maxDepth = std::max<uint32_t>(maxDepth, d - pops + pushes);
+                reach(i + 1, d - pops + pushes, false);
+            }
+        }
+        maxDepth = std::max<uint32_t>(maxDepth, d);
+    }
+    out.frameSize = stackBase + std::max<uint32_t>(maxDepth, 1);
+
+    // Translation
+    std::vector<uint32_t> address(count + 1, 0);
+    std::vector<std::pair<size_t, int>> fixupFields; // (instruction, operand 0..2) holding a target index
+    std::vector<uint32_t> stack;
+    size_t lastValue = SIZE_MAX; // Instruction that produced the top stack register, if still last
+    bool fallsThrough = false;   // The previous instruction can continue into the next one
+    auto S = [&](uint32_t d) { return stackBase + d; };
+    auto emit = [&](uint32_t op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+        out.code.push_back({op, a, b, c});
+        return out.code.size() - 1;
+    };
+    auto branchTo = [&](size_t instruction, int field, uint32_t target) {
+        uint32_t* f[] = {&out.code[instruction].a, &out.code[instruction].b, &out.code[instruction].c};
+        *f[field] = boundaries.target(target);
+        fixupFields.push_back({instruction, field});
+    };
+    auto materialize = [&] {
+        for (uint32_t d = 0; d < stack.size(); ++d) {
+            if (stack[d] != S(d)) {
+                emit(R_MOV, S(d), stack[d]);
+                stack[d] = S(d);
+            }
+        }
+    };
+    auto materializeSlot = [&](uint32_t reg) {
+        for (uint32_t d = 0; d < stack.size(); ++d) {
+            if (stack[d] == reg) {
+                emit(R_MOV, S(d), reg);
+                stack[d] = S(d);
+            }
+        }
+    };
+    auto justProduced = [&](uint32_t reg) {
+        return lastValue != SIZE_MAX && lastValue == out.code.size() - 1 && reg == S(stack.size());
+    };
+    auto pop = [&] {
+        uint32_t reg = stack.back();
+        stack.pop_back();
+        return reg;
+    };
+    // Pops the condition; when it is the result of the comparison emitted
+    // just before, that comparison is turned into a compare-and-branch.
+    auto conditionalBranch = [&](uint32_t target, bool whenTrue) {
+        uint32_t cond = pop();
+        bool fuse = justProduced(cond) && compareBranch(out.code[lastValue].op, whenTrue) != R_OPCODE_COUNT;
+        RegisterInstruction compare = {};
+        if (fuse) {
+            compare = out.code.back();
+            out.code.pop_back();
+        }
+        materialize();
+        if (fuse) {
+            branchTo(emit(compareBranch(compare.op, whenTrue), compare.b, compare.c), 2, target);
+        } else {
+            branchTo(emit(whenTrue ? R_JNZ : R_JZ, cond), 1, target);
+        }
+    };
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (depth[i] == -1) {
+            continue; // Unreachable
+        }
+        if (leader[i]) {
+            if (fallsThrough) materialize();
+            stack.clear();
+            for (int64_t d = 0; d < depth[i]; ++d) stack.push_back(S(d));
+            lastValue = SIZE_MAX;
+        }
+        address[i] = out.code.size();
+        const uint32_t opcode = code[starts[i]];
+        const uint32_t* op = code.data() + starts[i] + 1;
+        size_t produced = SIZE_MAX;
+        switch (opcode) {
+            case DT_ADD: case DT_SUB: case DT_MUL: case DT_DIV: case DT_SHL: case DT_SHR:
+            case DT_FP_ADD: case DT_FP_SUB: case DT_FP_MUL: case DT_FP_DIV:
+            case DT_GT: case DT_LT: case DT_EQ: case DT_GT_EQ: case DT_LT_EQ: {
+                uint32_t a = pop();
+                uint32_t b = pop();
+                uint32_t dst = S(stack.size());
+                produced = emit(binaryOpcode(opcode), dst, b, a);
+                stack.push_back(dst);
+                break;
+            }
+            case DT_INC: case DT_DEC: {
+                uint32_t v = pop();
+                uint32_t dst = S(stack.size());
+                produced = emit(opcode == DT_INC ? R_ADD : R_SUB, dst, v, constantRegister[1]);
+                stack.push_back(dst);
+                break;
+            }
+            case DT_LOD: {
+                auto slot = slotRegister.find(op[0]);
+                if (slot != slotRegister.end()) {
+                    stack.push_back(slot->second);
+                } else {
+                    uint32_t dst = S(stack.size());
+                    produced = emit(R_LOAD, dst, op[0]);
+                    stack.push_back(dst);
+                }
+                break;
+            }
+            case DT_IMMI:
+                stack.push_back(constantRegister[op[0]]);
+                break;
+            case DT_STO: {
+                uint32_t v = pop();
+                auto slot = slotRegister.find(op[0]);
+                if (slot == slotRegister.end()) {
+                    emit(R_STORE, op[0], v);
+                    break;
+                }
+                // Compute straight into the slot when the value was just produced
+                bool retarget = justProduced(v);
+                RegisterInstruction last = {};
+                if (retarget) {
+                    last = out.code.back();
+                    out.code.pop_back();
+                }
+                materializeSlot(slot->second);
+                if (retarget) {
+                    last.a = slot->second;
+                    out.code.push_back(last);
+                } else {
+                    emit(R_MOV, slot->second, v);
+                }
+                break;
+            }
+            case DT_STO_IMMI: {
+                auto slot = slotRegister.find(op[0]);
+                if (slot == slotRegister.end()) {
+                    emit(R_STORE, op[0], constantRegister[op[1]]);
+                } else {
+                    materializeSlot(slot->second);
+                    emit(R_MOV, slot->second, constantRegister[op[1]]);
+                }
+                break;
+            }
+            case DT_MEMCPY:
+                emit(R_MEMCPY, op[0], op[1], op[2]);
+                break;
+            case DT_MEMSET:
+                emit(R_MEMSET, op[0], op[1], op[2]);
+                break;
+            case DT_JMP:
+                materialize();
+                branchTo(emit(R_JMP), 0, op[0]);
+                break;
+            case DT_JZ:
+                conditionalBranch(op[0], false);
+                break;
+            case DT_JUMP_IF:
+                conditionalBranch(op[0], true);
+                break;
+            case DT_IF_ELSE: {
+                uint32_t cond = pop();
+                materialize();
+                size_t at = emit(R_IF_ELSE, cond);
+                branchTo(at, 1, op[0]);
+                branchTo(at, 2, op[1]);
+                break;
+            }
+            case DT_CALL:
+                materialize();
+                branchTo(emit(R_CALL, 0, op[1], S(stack.size() - op[1])), 0, op[0]);
+                break;
+            case DT_RET:
+                emit(R_RET, pop());
+                break;
+            case DT_SEEK:
+                emit(R_SEEK, stack.back());
+                break;
+            case DT_PRINT:
+            case DT_FP_PRINT:
+                if (stack.empty()) {
+                    emit(R_EMPTY);
+                } else {
+                    emit(opcode == DT_PRINT ? R_PRINT : R_FP_PRINT, stack.back());
+                }
+                break;
+            case DT_READ_INT:
+                emit(R_READ_INT, op[0]);
+                break;
+            case DT_FP_READ:
+                emit(R_FP_READ, op[0]);
+                break;
+            case DT_Tik:
+                emit(R_TIK);
+                break;
+            case DT_END:
+                emit(R_END);
+                break;
+            default: {
+                uint32_t pops, pushes;
+                stackEffect(opcode, pops, pushes);
+                materialize();
+                SharedInstruction ins = {opcode, {}};
+                for (uint32_t k = 0; k < operandCount(opcode); ++k) ins.operand[k] = op[k];
+                emit(R_SHARED, out.shared.size(), S(0), S(stack.size()));
+                out.shared.push_back(ins);
+                stack.resize(stack.size() - pops + pushes);
+                for (uint32_t d = 0; d < stack.size(); ++d) stack[d] = S(d);
+            }
+        }
+        lastValue = produced;
+        fallsThrough = opcode != DT_JMP && opcode != DT_IF_ELSE && opcode != DT_RET && opcode != DT_END;
+    }
+    if (fallsThrough) materialize();
+    address[count] = out.code.size();
+    emit(R_END);
+
+    for (const auto& f : fixupFields) {
+        RegisterInstruction& ins = out.code[f.first];
+        uint32_t* field = f.second == 0 ? &ins.a : f.second == 1 ? &ins.b : &ins.c;
+        *field = address[*field];
+    }
+    return out;
+}
+
+#endif // REGISTERCODE_HPP
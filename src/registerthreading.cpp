@@ -0,0 +1,255 @@
+#ifndef REGISTERTHREADING_H
+#define REGISTERTHREADING_H
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "symbol.hpp"
+#include "readfile.hpp"
+#include "interface.hpp"
+#include "vmmemory.hpp"
+#include "registercode.hpp"
+#include "slotstack.hpp"
+
+#if !defined(__GNUC__)
+#error "RegisterVM needs the labels-as-values extension (GCC or Clang)"
+#endif
+
+// Register VM: the stack bytecode is translated to three-address register
+// code at load time (registercode.hpp) and run by a computed-goto
+// interpreter. Each DT_CALL opens a fresh register window holding the
+// parameters, so call semantics match the stack engines.
+class RegisterVM : public Interface {
+    struct Frame {
+        uint32_t* registers;            // Caller's window
+        const RegisterInstruction* returnIp;
+        uint32_t result;                // Caller register that receives the return value
+    };
+
+    static constexpr size_t frameSlots = 1 << 14;
+
+    RegisterProgram program;
+    std::vector<uint32_t> registers; // All register windows, one after another
+    std::vector<Frame> frames;
+    VMMemory memory;
+    char* buffer; // memory.data()
+
+    inline float to_float(uint32_t val) {
+        float f;
+        memcpy(&f, &val, 4);
+        return f;
+    }
+
+    inline uint32_t from_float(float val) {
+        uint32_t u;
+        memcpy(&u, &val, 4);
+        return u;
+    }
+
+    inline void write_mem32(char* buffer, uint32_t val, uint32_t offset) {
+        memcpy(buffer + offset, &val, 4);
+    }
+
+    inline uint32_t read_mem32(char* buffer, uint32_t offset) {
+        uint32_t val;
+        memcpy(&val, buffer + offset, 4);
+        return val;
+    }
+
+    void execute() {
+        static void* const labels[] = {
+            &&r_mov,
+            &&r_add, &&r_sub, &&r_mul, &&r_div, &&r_shl, &&r_shr,
+            &&r_fp_add, &&r_fp_sub, &&r_fp_mul, &&r_fp_div,
+            &&r_gt, &&r_lt, &&r_eq, &&r_gt_eq, &&r_lt_eq,
+            &&r_load, &&r_store, &&r_memcpy, &&r_memset,
+            &&r_jmp, &&r_jz, &&r_jnz,
+            &&r_jgt, &&r_jlt, &&r_jeq, &&r_jne, &&r_jgt_eq, &&r_jlt_eq,
+            &&r_if_else, &&r_call, &&r_ret,
+            &&r_seek, &&r_print, &&r_fp_print, &&r_empty,
+            &&r_read_int, &&r_fp_read, &&r_tik, &&r_shared, &&r_end,
+        };
+        static_assert(sizeof(labels) / sizeof(labels[0]) == R_OPCODE_COUNT);
+
+        const uint32_t slots = program.slotOffsets.size();
+        const uint32_t shared = slots + program.constants.size(); // Copied into every window
+        const RegisterInstruction* const code = program.code.data();
+        uint32_t* const registerLimit = registers.data() + registers.size();
+        Frame* const frameLimit = frames.data() + frames.size();
+        Frame* frameTop = frames.data();
+        uint32_t* r = registers.data();
+        const RegisterInstruction* ip = code;
+        if (program.frameSize > registers.size()) {
+            throw std::runtime_error("Register window too large");
+        }
+
+        for (uint32_t i = 0; i < slots; ++i) {
+            r[i] = read_mem32(buffer, program.slotOffsets[i]);
+        }
+        for (uint32_t i = 0; i < program.constants.size(); ++i) {
+            r[slots + i] = program.constants[i];
+        }
+
+#define DISPATCH() goto *labels[ip->op]
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+#define JUMP(target) do { ip = code + (target); DISPATCH(); } while (0)
+#define BINARY(name, expr) \
+    name: { uint32_t b = r[ip->b]; uint32_t a = r[ip->c]; r[ip->a] = (expr); NEXT(); }
+#define FP_BINARY(name, expr) \
+    name: { float b = to_float(r[ip->b]); float a = to_float(r[ip->c]); r[ip->a] = from_float(expr); NEXT(); }
+#define BRANCH(name, cond) \
+    name: { uint32_t b = r[ip->a]; uint32_t a = r[ip->b]; if (cond) JUMP(ip->c); NEXT(); }
+
+        DISPATCH();
+
+    r_mov: { r[ip->a] = r[ip->b]; NEXT(); }
+    BINARY(r_add, b + a)
+    BINARY(r_sub, b - a)
+    BINARY(r_mul, b * a)
+    BINARY(r_shl, b << a)
+    BINARY(r_shr, b >> a)
+    BINARY(r_gt, b > a ? 1 : 0)
+    BINARY(r_lt, b < a ? 1 : 0)
+    BINARY(r_eq, b == a ? 1 : 0)
+    BINARY(r_gt_eq, b >= a ? 1 : 0)
+    BINARY(r_lt_eq, b <= a ? 1 : 0)
+    FP_BINARY(r_fp_add, b + a)
+    FP_BINARY(r_fp_sub, b - a)
+    FP_BINARY(r_fp_mul, b * a)
+    FP_BINARY(r_fp_div, b / a)
+
+    r_div: {
+        uint32_t b = r[ip->b];
+        uint32_t a = r[ip->c];
+        if (a == 0) {
+            throw std::runtime_error("Division by zero");
+        }
+        r[ip->a] = b / a;
+        NEXT();
+    }
+
+    r_load: { r[ip->a] = read_mem32(buffer, ip->b); NEXT(); }
+    r_store: { write_mem32(buffer, r[ip->b], ip->a); NEXT(); }
+    r_memcpy: { memcpy(buffer + ip->a, buffer + ip->b, ip->c); NEXT(); }
+    r_memset: { memset(buffer + ip->a, ip->b, ip->c); NEXT(); }
+
+    r_jmp: { JUMP(ip->a); }
+    r_jz: { if (r[ip->a] == 0) JUMP(ip->b); NEXT(); }
+    r_jnz: { if (r[ip->a] != 0) JUMP(ip->b); NEXT(); }
+    BRANCH(r_jgt, b > a)
+    BRANCH(r_jlt, b < a)
+    BRANCH(r_jeq, b == a)
+    BRANCH(r_jne, b != a)
+    BRANCH(r_jgt_eq, b >= a)
+    BRANCH(r_jlt_eq, b <= a)
+    r_if_else: { JUMP(r[ip->a] ? ip->b : ip->c); }
+
+    // The new window gets the shared registers, then the parameters.
+    r_call: {
+        uint32_t num_params = ip->b;
+        uint32_t* callee = r + program.frameSize;
+        if (frameTop == frameLimit || callee + program.frameSize > registerLimit) {
+            throw std::runtime_error("Call stack overflow");
+        }
+        *frameTop++ = {r, ip + 1, ip->c};
+        memcpy(callee, r, shared * sizeof(uint32_t));
+        for (uint32_t i = 0; i < num_params; ++i) {
+            callee[shared + i] = r[ip->c + num_params - 1 - i];
+        }
+        r = callee;
+        JUMP(ip->a);
+    }
+    r_ret: {
+        if (frameTop == frames.data()) {
+            std::cerr << "Error: Call stack underflow" << std::endl;
+            goto r_end;
+        }
+        uint32_t return_value = r[ip->a];
+        --frameTop;
+        memcpy(frameTop->registers, r, slots * sizeof(uint32_t));
+        r = frameTop->registers;
+        r[frameTop->result] = return_value;
+        ip = frameTop->returnIp;
+        DISPATCH();
+    }
+
+    r_seek: { debug_num = r[ip->a]; NEXT(); }
+    r_print: { std::cout << (int)r[ip->a] << std::endl; NEXT(); }
+    r_fp_print: { std::cout << to_float(r[ip->a]) << std::endl; NEXT(); }
+    r_empty: { std::cerr << "Stack is empty." << std::endl; NEXT(); }
+    r_read_int: {
+        int val;
+        std::cin >> val;
+        write_mem32(buffer, val, ip->a);
+        NEXT();
+    }
+    r_fp_read: {
+        float val;
+        std::cin >> val;
+        write_mem32(buffer, from_float(val), ip->a);
+        NEXT();
+    }
+    r_tik: { std::cout << "tik" << std::endl; NEXT(); }
+    r_shared: {
+        const SharedInstruction& ins = program.shared[ip->a];
+        SlotStack::execute(ins.opcode, ins.operand, r + ip->b, r + ip->c, r + program.frameSize, buffer, debug_num);
+        NEXT();
+    }
+
+    // Promoted slots are written back so the memory buffer is up to date.
+    r_end:
+        for (uint32_t i = 0; i < slots; ++i) {
+            write_mem32(buffer, r[i], program.slotOffsets[i]);
+        }
+        return;
+#undef BRANCH
+#undef FP_BINARY
+#undef BINARY
+#undef JUMP
+#undef NEXT
+#undef DISPATCH
+    }
+
+public:
+    // Register file slots, shared by all call windows
+    static constexpr size_t defaultDepth = 1 << 20;
+
+    uint32_t debug_num;
+    explicit RegisterVM(size_t stackDepth = defaultDepth, const VMMemory::Options& memoryOptions = VMMemory::Options()) : registers(stackDepth), frames(frameSlots), memory(memoryOptions), buffer(memory.data()) {
+        debug_num = 0xFFFFFFFF;
+    }
+
+
+    void run_vm(std::string filename, bool benchmarkMode) {
+        try {
+            MappedProgram file(filename);
+            program = translateToRegisters(file.code(), memory.size());
+            if (benchmarkMode) {
+                std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
+            }
+            memory.trapFaults([&] { execute(); });
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    void run_vm(const std::vector<uint32_t>& code) {
+        try {
+            program = translateToRegisters(code, memory.size());
+            memory.trapFaults([&] { execute(); });
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    // Number of register instructions the last program translated to.
+    size_t translatedSize() const {
+        return program.code.size();
+    }
+
+    char* getBuffer() {
+        return buffer;
+    }
+};
+#endif // REGISTERTHREADING_H
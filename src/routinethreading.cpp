@@ -2,17 +2,27 @@
 #define ROUTINETHREADING_H
 
 #include <vector>
-#include <stack>
+#include <span>
+#include <array>
 #include <iostream>
 #include <cstring>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <csetjmp>
+#include <string>
 #include <map>
 #include <unordered_set>   
 #include "readfile.hpp"
 #include "interface.hpp"
+#include "vmmemory.hpp"
+#include "nativecode.hpp"
+#include "superinstructions.hpp"
+#include "semantics.hpp"
+#include "operandstack.hpp"
+#include "verifier.hpp"
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -26,458 +36,503 @@ struct pair_hash {
     }
 };
 
-class RoutineThreadingVM :public Interface{
-private:
-    uint32_t ip; // Instruction pointer
-    std::vector<std::stack<uint32_t> > sts; // Stacks for operations
-    std::stack<uint32_t> st;
-    std::vector<std::vector<uint32_t> > instructions; // Instruction set
-    char* buffer; // Memory buffer
-    std::stack<uint32_t> callStack; // Call stack for function calls
-    float to_float(uint32_t val) {
-        return *reinterpret_cast<float*>(&val);
-    }
+// Non-owning view of a decoded program. Instruction i has opcode opcodes[i]
+// and its operands at operands + operandOffsets[i]; jump operands are
+// instruction indices.
+struct RoutineProgramView {
+    const uint32_t* opcodes = nullptr;
+    const uint32_t* operandOffsets = nullptr;
+    const uint32_t* operands = nullptr;
+    size_t count = 0;
 
-    uint32_t from_float(float val) {
-        return *reinterpret_cast<uint32_t*>(&val);
+    size_t size() const {
+        return count;
     }
 
-    void write_memory(char* buffer, uint32_t* src, uint32_t offset, uint32_t size) {
-        memcpy(buffer + offset, src, size);
+    uint32_t opcode(size_t i) const {
+        return opcodes[i];
     }
 
-    void write_mem32(char* buffer, uint32_t val, uint32_t offset) {
-        uint32_t buf[1] = { val };
-        write_memory(buffer, buf, offset, 4);
+    const uint32_t* operandsOf(size_t i) const {
+        return operands + operandOffsets[i];
     }
+};
 
-    void read_memory(char* buffer, uint8_t* dst, uint32_t offset, uint32_t size) {
-        memcpy(dst, buffer + offset, size);
+// A decoded program in one arena: parallel arrays of opcodes and operand
+// offsets over a packed operand pool. Every instruction gets the full
+// operand count of its opcode, zero-filled when the code is truncated.
+struct RoutineProgram {
+    std::vector<uint32_t> opcodes;
+    std::vector<uint32_t> operandOffsets;
+    std::vector<uint32_t> operands;
+
+    void append(uint32_t opcode, const uint32_t* ops, size_t available) {
+        opcodes.push_back(opcode);
+        operandOffsets.push_back(static_cast<uint32_t>(operands.size()));
+        for (uint32_t k = 0; k < operandCount(opcode); ++k) {
+            operands.push_back(k < available ? ops[k] : 0);
+        }
     }
 
-    uint32_t read_mem32(char* buffer, uint32_t offset) {
-        uint32_t buf[1];
-        read_memory(buffer, (uint8_t *)buf, offset, 4);
-        return buf[0];
+    size_t size() const {
+        return opcodes.size();
     }
 
-        // Define operations for each instruction
-    void do_add() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(a + b);
+    RoutineProgramView view() const {
+        return RoutineProgramView{opcodes.data(), operandOffsets.data(), operands.data(), opcodes.size()};
     }
+};
 
-    void do_sub() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b - a);
+class RoutineThreadingVM :public Interface{
+private:
+    uint32_t ip; // Instruction pointer
+    OperandStack st;
+    RoutineProgramView code; // Program being run
+    RoutineProgram loaded;   // Arena behind code when the VM decoded it itself
+    VMMemory memory;
+    char* buffer; // memory.data()
+    struct Frame {
+        uint32_t returnIp;     // The DT_CALL to continue after
+        uint32_t* callerBase;  // Caller's frame base in st
+    };
+    std::vector<Frame> frames; // Call stack for function calls
+    bool nativeMode; // Emit native call sequences instead of interpreting
+    bool ranNativeCode;
+    ExecutableBuffer nativeCode;
+
+    // Basic blocks for the interpreter. A block is a run of instructions
+    // that is entered only at its first one and leaves only through its
+    // last; its steps are the instructions with their handlers resolved up
+    // front, run back to back with one dispatch per block.
+    typedef void (*BlockHandler)(RoutineThreadingVM*, const uint32_t*);
+    struct BlockStep {
+        BlockHandler run;
+        const uint32_t* operands;
+    };
+    struct Block {
+        uint32_t firstStep;
+        uint32_t stepCount;
+        uint32_t last; // Index of the instruction that ends the block
+        bool halts;    // Ends in DT_END
+    };
+    std::vector<BlockStep> blockSteps;
+    std::vector<Block> blocks;
+    std::vector<uint32_t> blockAt; // Instruction index -> block, for leaders
+    friend struct OpcodeSemantics<RoutineThreadingVM>;
+    typedef OpcodeSemantics<RoutineThreadingVM> Semantics;
+
+    // Stack and control-flow policy for semantics.hpp. Jump operands are
+    // instruction indices.
+    void push(uint32_t value) {
+        st.push(value);
+    }
+
+    uint32_t pop() {
+        return st.pop();
+    }
+
+    uint32_t top() {
+        return st.top();
+    }
+
+    bool empty() {
+        return st.empty();
+    }
+
+    void jump(uint32_t target) {
+        ip = target - 1;
     }
 
-    void do_mul() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(a * b);
+    void call(uint32_t target, uint32_t num_params) {
+        frames.push_back(Frame{ip, st.enter(num_params)});
+        jump(target);
     }
 
-    void do_div() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        if (b == 0) {
-            std::cerr << "Error: Divided by zero error" << std::endl;
+    void ret() {
+        if (frames.empty()) {
+            std::cerr << "Error: Call stack underflow" << std::endl;
             return;
         }
-        st.push(b / a);
+        st.leave(frames.back().callerBase);
+        ip = frames.back().returnIp;
+        frames.pop_back();
     }
 
-    void do_fp_add() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        float result = a + b;
-        st.push(from_float(result));
-    }
-
-    void do_fp_sub() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        float result = b - a;
-        st.push(from_float(result));
-    }
-
-    void do_fp_mul() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        float result = a * b;
-        st.push(from_float(result));
+    void end() {
+        st.clear();
+        code = RoutineProgramView();
+        ip = 0;
     }
 
-    void do_fp_div() {
-        float a = to_float(st.top()); st.pop();
-        float b = to_float(st.top()); st.pop();
-        if (b == 0.0f) {
-            std::cerr << "Division by zero error" << std::endl;
-            return;
+#ifdef THD_NATIVE_X64
+    // Subroutine threading proper: every VM instruction becomes a native
+    // `call` to its handler with the operands loaded as immediates, and VM
+    // control flow becomes native jumps, calls and returns. rbx holds the VM
+    // pointer, r12 the stack pointer to unwind to on DT_END.
+    typedef void (*NativeEntry)(RoutineThreadingVM*);
+    typedef void (*NativeHandler)(RoutineThreadingVM*, uint32_t, uint32_t, uint32_t, uint32_t);
+
+    // A trap can't unwind through the emitted code, which has no unwind
+    // info, so the handlers catch it and longjmp back into run_vm's guarded
+    // body, and run_vm rethrows it once the fault scope is gone.
+    std::jmp_buf nativeTrap;
+    std::string nativeTrapMessage;
+
+    template <typename F>
+    static auto trapping(RoutineThreadingVM* vm, F&& f) -> decltype(f()) {
+        try {
+            return f();
+        } catch (const std::runtime_error& e) {
+            vm->nativeTrapMessage = e.what();
         }
-        float result = b / a;
-        st.push(from_float(result));
-    }
-
-    void do_inc() {
-        uint32_t a = st.top(); st.pop();
-        st.push(++a);
-    }
-
-    void do_dec() {
-        uint32_t a = st.top(); st.pop();
-        st.push(--a);
-    }
-
-    void do_shl() {
-        uint32_t shift = st.top(); st.pop();
-        uint32_t value = st.top(); st.pop();
-        st.push(value << shift);
+        std::longjmp(vm->nativeTrap, 1);
     }
 
-    void do_shr() {
-        uint32_t shift = st.top(); st.pop();
-        uint32_t value = st.top(); st.pop();
-        st.push(value >> shift);
+    // Operands arrive in esi/edx/ecx/r8d; the ones an opcode doesn't have
+    // are left unread.
+    template <uint32_t Op>
+    static void native_op(RoutineThreadingVM* vm, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+        const uint32_t operands[4] = {a, b, c, d};
+        trapping(vm, [&] { Semantics::execute<Op>(*vm, operands); });
     }
 
-    void do_end() {
-        st = std::stack<uint32_t>();
-        instructions = std::vector<std::vector<uint32_t> >();
-        ip = 0;
+    static void native_illegal(RoutineThreadingVM* vm, uint32_t, uint32_t, uint32_t, uint32_t) {
+        Semantics::illegal(*vm);
     }
 
-    void do_lod(uint32_t offset) {
-        uint32_t a = read_mem32(buffer,offset);
-        st.push(a);
+    static NativeHandler native_handler(uint32_t opcode) {
+        static const auto table = [] {
+            std::array<NativeHandler, 256> handlers;
+            handlers.fill(&native_illegal);
+#define NATIVE_ENTRY(op) handlers[op] = &native_op<op>;
+            FOR_EACH_OPCODE(NATIVE_ENTRY)
+#undef NATIVE_ENTRY
+            return handlers;
+        }();
+        return opcode < table.size() ? table[opcode] : &native_illegal;
     }
 
-    void do_sto(uint32_t offset) {
-        uint32_t a = st.top(); st.pop();
-        write_mem32(buffer,a,offset);
+    static uint32_t native_pop(RoutineThreadingVM* vm) {
+        return trapping(vm, [&] { return vm->pop(); });
     }
 
-    void do_immi(uint32_t a) {
-        st.push(a);
+    static uint32_t native_gt_pop(RoutineThreadingVM* vm, uint32_t k) {
+        return trapping(vm, [&] { return static_cast<uint32_t>(vm->pop() > k); });
     }
 
-    void do_memcpy(uint32_t dest,uint32_t src,uint32_t len) {
+    // Emitted DT_CALLs are host calls, so the call depth is bounded by the
+    // host stack; deep recursion traps instead of overflowing it.
+    static constexpr size_t nativeFrameLimit = 1 << 14;
 
-        memcpy(buffer + dest, buffer + src, len);
+    static void native_call(RoutineThreadingVM* vm, uint32_t num_params) {
+        trapping(vm, [&] {
+            if (vm->frames.size() == nativeFrameLimit) {
+                throw std::runtime_error("Call stack overflow");
+            }
+            vm->call(0, num_params);
+        });
     }
 
-    void do_memset(uint32_t dest,uint32_t val,uint32_t len) {
-        memset(buffer + dest, val, len);
-    }
-    void do_sto_immi(uint32_t offset,uint32_t number) {
-        write_mem32(buffer,number,offset);
+    // Returns 0 when there is no frame to return to, so the emitted code
+    // falls through exactly like the interpreter does after the error.
+    static uint32_t native_ret(RoutineThreadingVM* vm) {
+        bool hasFrame = !vm->frames.empty();
+        trapping(vm, [&] { vm->ret(); });
+        return hasFrame;
     }
 
-    void do_jmp(uint32_t target) {
-        ip = target - 1;
-    }
+    static const void* fn(void (*f)(RoutineThreadingVM*, uint32_t)) { return reinterpret_cast<const void*>(f); }
+    static const void* fn(void (*f)(RoutineThreadingVM*, uint32_t, uint32_t, uint32_t, uint32_t)) { return reinterpret_cast<const void*>(f); }
+    static const void* fn(uint32_t (*f)(RoutineThreadingVM*)) { return reinterpret_cast<const void*>(f); }
+    static const void* fn(uint32_t (*f)(RoutineThreadingVM*, uint32_t)) { return reinterpret_cast<const void*>(f); }
 
-    void do_jz(uint32_t target) {
-        if (st.top() == 0) {
-            ip = target - 1;
+    bool compile_native() {
+        const size_t count = code.size();
+        if (!nativeCode.allocate(64 + count * 64, fn(&native_pop))) {
+            return false;
         }
-        st.pop();
-    }
-
-    void do_jump_if(uint32_t target) {
-        uint32_t condition = st.top(); st.pop();
-        if (condition) {
-            ip = target - 1;
+        X64Assembler a(nativeCode.data(), nativeCode.size());
+        std::vector<size_t> labels(count + 1);
+        const uint32_t exit = static_cast<uint32_t>(count);
+        auto label = [&](uint32_t target) { return target < count ? target : exit; };
+
+        a.bytes({0x53});                   // push rbx
+        a.bytes({0x41, 0x54});             // push r12
+        a.bytes({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8   (keeps rsp 16-byte aligned)
+        a.bytes({0x48, 0x89, 0xFB});       // mov rbx, rdi
+        a.bytes({0x49, 0x89, 0xE4});       // mov r12, rsp
+
+        for (size_t i = 0; i < count; ++i) {
+            labels[i] = a.offset();
+            const uint32_t opcode = code.opcode(i);
+            const uint32_t* operands = code.operandsOf(i);
+            auto arg = [&](size_t k) { return operands[k - 1]; };
+            if (opcode != DT_JMP) {
+                a.bytes({0x48, 0x89, 0xDF}); // mov rdi, rbx
+            }
+            switch (opcode) {
+                case DT_END:
+                    a.call(fn(&native_op<DT_END>));
+                    a.jmp_label(exit);
+                    break;
+                case DT_JMP:
+                    a.jmp_label(label(arg(1)));
+                    break;
+                case DT_JZ:
+                    a.call(fn(&native_pop));
+                    a.test_eax();
+                    a.jz_label(label(arg(1)));
+                    break;
+                case DT_JUMP_IF:
+                    a.call(fn(&native_pop));
+                    a.test_eax();
+                    a.jnz_label(label(arg(1)));
+                    break;
+                case DT_IF_ELSE:
+                    a.call(fn(&native_pop));
+                    a.test_eax();
+                    a.jnz_label(label(arg(1)));
+                    a.jmp_label(label(arg(2)));
+                    break;
+                case DT_IMMI_GT_JZ:
+                    a.mov_esi(arg(1));
+                    a.call(fn(&native_gt_pop));
+                    a.test_eax();
+                    a.jz_label(label(arg(2)));
+                    break;
+                case DT_CALL:
+                    a.mov_esi(arg(2));
+                    a.call(fn(&native_call));
+                    a.bytes({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8
+                    a.call_label(label(arg(1)));
+                    a.bytes({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+                    break;
+                case DT_RET: {
+                    a.call(fn(&native_ret));
+                    a.test_eax();
+                    a.bytes({0x74, 0x01});             // jz over the ret
+                    a.ret();
+                    break;
+                }
+                default: {
+                    // Straight-line opcodes: operands as immediates, then
+                    // a call to the shared semantics.
+                    uint32_t n = operandCount(opcode);
+                    if (n > 0) a.mov_esi(arg(1));
+                    if (n > 1) a.mov_edx(arg(2));
+                    if (n > 2) a.mov_ecx(arg(3));
+                    if (n > 3) a.mov_r8d(arg(4));
+                    a.call(fn(native_handler(opcode)));
+                    break;
+                }
+            }
         }
-    }
 
-    void do_if_else(uint32_t trueBranch, uint32_t falseBranch) {
-        uint32_t condition = st.top(); st.pop();
-        ip = condition ? trueBranch - 1 : falseBranch - 1;
-    }
-    void do_gt() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b > a ? 1 : 0);
-    }
+        labels[exit] = a.offset();
+        a.bytes({0x4C, 0x89, 0xE4});       // mov rsp, r12
+        a.bytes({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+        a.bytes({0x41, 0x5C});             // pop r12
+        a.bytes({0x5B});                   // pop rbx
+        a.ret();
 
-    void do_lt() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b < a ? 1 : 0);
-    }
-
-    void do_eq() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b == a ? 1 : 0);
-    }
-
-    void do_gt_eq() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b >= a ? 1 : 0);
-    }
-
-    void do_lt_eq() {
-        uint32_t a = st.top(); st.pop();
-        uint32_t b = st.top(); st.pop();
-        st.push(b <= a ? 1 : 0);
-    }
-
-    void do_call(uint32_t target, uint32_t num_params) {
-        std::stack<uint32_t> newStack;
-         for (uint32_t i = 0; i < num_params; ++i) {
-            newStack.push(st.top());
-            st.pop();
+        if (a.overflowed()) {
+            nativeCode.release();
+            return false;
         }
-        sts.push_back(newStack);
-        st=sts.back();//st always refer to the top of stacks.
-        callStack.push(ip); 
-        ip = target - 1; 
-    }
-
-    void do_ret() {
-        if (callStack.empty()) {
-            std::cerr << "Error: Call stack underflow" << std::endl;
-            return;
+        a.resolve(labels);
+        if (!nativeCode.seal()) {
+            nativeCode.release();
+            return false;
         }
-        uint32_t return_value = st.top();
-        ip = callStack.top(); callStack.pop(); 
-        sts.pop_back();
-        st = sts.back();
-        st.push(return_value);
+        return true;
     }
-
-    void do_seek() {
-        debug_num = st.top();
+#else
+    bool compile_native() {
+        return false;
     }
+#endif
 
-    void do_print() {
-        if (!st.empty()) {
-            std::cout <<(int)st.top() << std::endl;
-        } else {
-            std::cerr << "Stack is empty." << std::endl;
+    template <uint32_t Op>
+    static void block_op(RoutineThreadingVM* vm, const uint32_t* operands) {
+        Semantics::execute<Op>(*vm, operands);
+    }
+
+    static void block_illegal(RoutineThreadingVM* vm, const uint32_t*) {
+        Semantics::illegal(*vm);
+    }
+
+    static BlockHandler block_handler(uint32_t opcode) {
+        static const auto table = [] {
+            std::array<BlockHandler, 256> handlers;
+            handlers.fill(&block_illegal);
+#define BLOCK_ENTRY(op) handlers[op] = &block_op<op>;
+            FOR_EACH_OPCODE(BLOCK_ENTRY)
+#undef BLOCK_ENTRY
+            return handlers;
+        }();
+        return opcode < table.size() ? table[opcode] : &block_illegal;
+    }
+
+    // Leaders are the first instruction, every jump target and every
+    // instruction following one that can transfer control.
+    void buildBlocks() {
+        const size_t count = code.size();
+        std::vector<bool> leader(count + 1, false);
+        leader[0] = true;
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t* operands = code.operandsOf(i);
+            uint32_t mask = jumpOperandMask(code.opcode(i));
+            for (uint32_t k = 0; mask; ++k, mask >>= 1) {
+                if ((mask & 1) && operands[k] < count) {
+                    leader[operands[k]] = true;
+                }
+            }
+            if (endsBlock(code.opcode(i))) {
+                leader[i + 1] = true;
+            }
         }
-    }
 
-    void do_print_fp() {
-        if (!st.empty()) {
-            uint32_t num = st.top();
-            float* floatPtr = (float*)&num;
-            std::cout <<*floatPtr << std::endl;
-        } else {
-            std::cerr << "Stack is empty." << std::endl;
+        blockSteps.clear();
+        blocks.clear();
+        blockAt.assign(count, 0);
+        for (size_t i = 0; i < count; ++i) {
+            if (leader[i]) {
+                blockAt[i] = static_cast<uint32_t>(blocks.size());
+                blocks.push_back(Block{static_cast<uint32_t>(blockSteps.size()), 0, 0, false});
+            }
+            Block& block = blocks.back();
+            blockSteps.push_back(BlockStep{block_handler(code.opcode(i)), code.operandsOf(i)});
+            block.stepCount++;
+            block.last = static_cast<uint32_t>(i);
+            block.halts = code.opcode(i) == DT_END;
         }
     }
 
-    void do_read_fp(uint32_t offset) {
-        float val;
-        std::cin >> val; 
-        write_mem32(buffer,from_float(val), offset);
-    }
-
-    void do_read_int(uint32_t offset) {
-        int val;
-        std::cin >> val;
-        write_mem32(buffer, val, offset);
-    }
-
-    void tik(){
-        std::cout<<"tik"<<std::endl;
+    // Control flow happens only in the last step of a block, so ip is set to
+    // that instruction once on entry and the jump/call/ret policy above works
+    // unchanged: the next block is the one at ip + 1.
+    void interpret() {
+        uint32_t next = 0;
+        while (next < blockAt.size()) {
+            const Block& block = blocks[blockAt[next]];
+            ip = block.last;
+            const BlockStep* step = blockSteps.data() + block.firstStep;
+            for (const BlockStep* stop = step + block.stepCount; step != stop; ++step) {
+                step->run(this, step->operands);
+            }
+            if (block.halts) {
+                break;
+            }
+            next = ip + 1;
+        }
     }
 
 public:
     uint32_t debug_num;
-    RoutineThreadingVM() : ip(0), buffer(new char[4 * 1024 * 1024]) {
+    explicit RoutineThreadingVM(size_t stackDepth = OperandStack::defaultDepth, const VMMemory::Options& memoryOptions = VMMemory::Options())
+        : ip(0), st(stackDepth), memory(memoryOptions), buffer(memory.data()), nativeMode(true), ranNativeCode(false) {
         debug_num = 0xFFFFFFFF;
-        sts.push_back(std::stack<uint32_t>());
-        st = sts.back();
+        frames.reserve(1 << 10);
     }
 
-    ~RoutineThreadingVM() {
-        delete[] buffer;
-    }
     
-    void run_vm(std::string filename,bool benchmarkMode){
-        std::vector<uint32_t> code = readFileToUint32Array(filename);
-        std::map<int, int> addressMap;  
-        std::vector<std::vector<uint32_t>> instructions;
-        uint32_t pointer = 0;  
-        uint32_t instructionIndex = 0;  
-        while(pointer < code.size()){
-            uint32_t instructionStart = pointer;
-            std::vector<uint32_t> instruction;  
-            instruction.push_back(code[pointer++]);
-            switch (instruction[0]) {
-                case DT_LOD:
-                case DT_STO:
-                case DT_IMMI:
-                case DT_READ_INT:
-                case DT_FP_READ:
-                case DT_JMP:
-                case DT_JZ:
-                case DT_JUMP_IF:
-                    instruction.push_back(code[pointer++]);
-                    break;
-                case DT_MEMCPY:
-                case DT_MEMSET:
-                case DT_STO_IMMI:
-                case DT_IF_ELSE:
-                case DT_CALL:
-                    instruction.push_back(code[pointer++]);
-                    instruction.push_back(code[pointer++]);
-                    break;
-            }
+    static bool endsBlock(uint32_t opcode) {
+        switch (opcode) {
+            case DT_JMP: case DT_JZ: case DT_IF_ELSE: case DT_JUMP_IF:
+            case DT_IMMI_GT_JZ: case DT_CALL: case DT_RET: case DT_END:
+                return true;
+            default:
+                return false;
+        }
+    }
 
-            instructions.push_back(instruction);
-            addressMap[instructionStart] = instructionIndex++;
+    // Decodes bytecode into a program arena, rewriting jump operands from
+    // word offsets to instruction indices. Truncated code and jumps into an
+    // operand are rejected with std::runtime_error.
+    static RoutineProgram decode(std::span<const uint32_t> bytecode) {
+        const InstructionBoundaries boundaries = decodeBoundaries(bytecode);
+        RoutineProgram program;
+        program.opcodes.reserve(boundaries.count());
+        program.operandOffsets.reserve(boundaries.count());
+        program.operands.reserve(bytecode.size());
+        for (uint32_t start : boundaries.starts) {
+            program.append(bytecode[start], bytecode.data() + start + 1, operandCount(bytecode[start]));
         }
-        for (auto &instruction : instructions) {
-            switch (instruction[0]) {
-                case DT_JMP:
-                case DT_JZ:
-                case DT_JUMP_IF:
-                case DT_CALL:
-                    if (instruction.size() > 1) {
-                        instruction[1] = addressMap[instruction[1]];
-                    }
-                    break;
-                case DT_IF_ELSE:
-                    if (instruction.size() > 2) {
-                        instruction[1] = addressMap[instruction[1]];
-                        instruction[2] = addressMap[instruction[2]];
-                    }
-                    break;
+        for (size_t i = 0; i < program.size(); ++i) {
+            uint32_t* operands = program.operands.data() + program.operandOffsets[i];
+            uint32_t mask = jumpOperandMask(program.opcodes[i]);
+            for (uint32_t k = 0; mask; ++k, mask >>= 1) {
+                if (mask & 1) {
+                    operands[k] = boundaries.target(operands[k]);
+                }
             }
         }
-        if (benchmarkMode) {
-            std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
+        return program;
+    }
+
+    void run_vm(std::string filename,bool benchmarkMode){
+        try {
+            MappedProgram program(filename);
+            loaded = decode(fuseSuperinstructions(program.code()));
+            if (benchmarkMode) {
+                std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
+            }
+            run_vm(loaded.view());
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
         }
-        run_vm(instructions);
     }
 
+    // One vector per instruction, jump operands already instruction indices.
     void run_vm(const std::vector<std::vector<uint32_t>>& ins) {
-        instructions = ins;
-        for (ip = 0; ip < instructions.size(); ip++) {
-            switch (instructions[ip][0]) {
-                case DT_ADD:
-                    do_add();
-                    break;
-                case DT_SUB:
-                    do_sub();
-                    break;
-                case DT_MUL:
-                    do_mul();
-                    break;
-                case DT_DIV:
-                    do_div();
-                    break;
-                case DT_SHL:
-                    do_shl();
-                    break;
-                case DT_SHR:
-                    do_shr();
-                    break;
-                case DT_FP_ADD:
-                    do_fp_add();
-                    break;
-                case DT_FP_SUB:
-                    do_fp_sub();
-                    break;
-                case DT_FP_MUL:
-                    do_fp_mul();
-                    break;
-                case DT_FP_DIV:
-                    do_fp_div();
-                    break;
-                case DT_END:
-                    do_end();
-                    break;
-                case DT_LOD:
-                    do_lod(instructions[ip][1]);
-                    break;
-                case DT_STO:
-                    do_sto(instructions[ip][1]);
-                    break;
-                case DT_IMMI:
-                    do_immi(instructions[ip][1]);
-                    break;
-                case DT_INC:
-                    do_inc();
-                    break;
-                case DT_DEC:
-                    do_dec();
-                    break;
-                case DT_STO_IMMI:
-                    do_sto_immi(instructions[ip][1],instructions[ip][2]);
-                    break;
-                case DT_MEMCPY:
-                    do_memcpy(instructions[ip][1],instructions[ip][2],instructions[ip][3]);
-                    break;
-                case DT_MEMSET:
-                    do_memset(instructions[ip][1],instructions[ip][2],instructions[ip][3]);
-                    break;
-                case DT_JMP:
-                    do_jmp(instructions[ip][1]);
-                    break;
-                case DT_JZ:
-                    do_jz(instructions[ip][1]);
-                    break;
-                case DT_JUMP_IF:
-                    do_jump_if(instructions[ip][1]);
-                    break;
-                case DT_IF_ELSE:
-                    do_if_else(instructions[ip][1], instructions[ip][2]);
-                    break;
-                case DT_GT:
-                    do_gt();
-                    break;
-                case DT_LT:
-                    do_lt();
-                    break;
-                case DT_EQ:
-                    do_eq();
-                    break;
-                case DT_GT_EQ:
-                    do_gt_eq();
-                    break;
-                case DT_LT_EQ:
-                    do_lt_eq();
-                    break;
-                case DT_CALL:
-                    do_call(instructions[ip][1], instructions[ip][2]);
-                    break;
-                case DT_RET:
-                    do_ret();
-                    break;
-                case DT_SEEK:
-                    do_seek();
-                    break;
-                case DT_PRINT:
-                    do_print();
-                    break;
-                case DT_READ_INT:
-                    do_read_int(instructions[ip][1]);
-                    break;
-                case DT_FP_PRINT:
-                    do_print_fp();
-                    break;
-                case DT_FP_READ:
-                    do_read_fp(instructions[ip][1]);
-                    break;
-                case DT_Tik:
-                    tik();
-                    break;
-                default:
-                    std::cerr << "Error: Unknown subroutine "<< std::endl;
+        loaded = RoutineProgram();
+        for (const std::vector<uint32_t>& instruction : ins) {
+            loaded.append(instruction[0], instruction.data() + 1, instruction.size() - 1);
+        }
+        run_vm(loaded.view());
+    }
+
+    // Runs natively when possible; falls back to the interpreter when the
+    // executable mapping cannot be created or native mode is switched off.
+    // The program is not copied and must outlive the call.
+    void run_vm(const RoutineProgramView& program) {
+        code = program;
+        ranNativeCode = nativeMode && compile_native();
+        if (ranNativeCode) {
+#ifdef THD_NATIVE_X64
+            // setjmp sits inside the guarded body so that the longjmp leaves
+            // through trapFaults() and its fault scope is unwound normally.
+            bool trapped = false;
+            memory.trapFaults([&] {
+                if (setjmp(nativeTrap)) {
+                    trapped = true;
+                    return;
+                }
+                reinterpret_cast<NativeEntry>(nativeCode.data())(this);
+            });
+            if (trapped) {
+                throw std::runtime_error(nativeTrapMessage);
             }
+#endif
+        } else {
+            buildBlocks();
+            memory.trapFaults([&] { interpret(); });
         }
     }
 
+    void setNativeMode(bool enabled) {
+        nativeMode = enabled;
+    }
+
+    bool ranNative() const {
+        return ranNativeCode;
+    }
+
+    // Blocks formed by the last interpreted run.
+    size_t blockCount() const {
+        return blocks.size();
+    }
+
     static std::vector<uint32_t> convertToVMFormat(const std::string& input) {
         std::vector<uint32_t> output;
         for (char c : input) {
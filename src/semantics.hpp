@@ -0,0 +1,367 @@
+#ifndef SEMANTICS_HPP
+#define SEMANTICS_HPP
+
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "symbol.hpp"
+#include "vectorops.hpp"
+
+// What every opcode does, written once for all stack engines. An engine
+// supplies the stack and control-flow policy as members, and befriends
+// OpcodeSemantics<Engine> so they can stay private:
+//
+//   push(v), pop(), top(), empty()   operand stack
+//   jump(target)                     continue at a (pre-resolved) jump operand
+//   call(target, params), ret()      DT_CALL / DT_RET
+//   end()                            DT_END
+//   buffer, debug_num                VM memory and the DT_SEEK result
+//
+// Operands are passed as anything indexable (a pointer into the bytecode, a
+// register-held array, ...). Everything is a template so the body of each
+// opcode is inlined straight into the engine's handler or dispatch loop.
+//
+// Engines with their own handlers (stencils, tos caching, tail calls, register
+// code, traces) follow the same conventions: every opcode has one stack effect
+// (verifier.hpp relies on it), so a zero integer divisor is a VM trap while
+// float division follows IEEE, and the DT_CALL callee frame starts at the
+// parameters, reversed in place as in OperandStack::enter().
+#define FOR_EACH_OPCODE(X) \
+    X(DT_ADD) X(DT_SUB) X(DT_MUL) X(DT_DIV) X(DT_SHL) X(DT_SHR) \
+    X(DT_FP_ADD) X(DT_FP_SUB) X(DT_FP_MUL) X(DT_FP_DIV) \
+    X(DT_END) X(DT_LOD) X(DT_STO) X(DT_IMMI) X(DT_INC) X(DT_DEC) \
+    X(DT_STO_IMMI) X(DT_MEMCPY) X(DT_MEMSET) \
+    X(DT_JMP) X(DT_JZ) X(DT_IF_ELSE) X(DT_JUMP_IF) \
+    X(DT_GT) X(DT_LT) X(DT_EQ) X(DT_GT_EQ) X(DT_LT_EQ) \
+    X(DT_CALL) X(DT_RET) \
+    X(DT_SEEK) X(DT_PRINT) X(DT_READ_INT) X(DT_FP_PRINT) X(DT_FP_READ) X(DT_Tik) \
+    X(DT_MEMCMP) X(DT_MEMCHR) X(DT_STRLEN) X(DT_MEMMOVE) \
+    X(DT_VADD) X(DT_VMUL) X(DT_VFP_ADD) X(DT_VFP_MUL) X(DT_VDOT) \
+    X(DT_LOD8) X(DT_LOD8S) X(DT_LOD16) X(DT_LOD16S) X(DT_LOD64) X(DT_STO8) X(DT_STO16) X(DT_STO64) \
+    X(DT_ADD64) X(DT_SUB64) X(DT_MUL64) X(DT_DIV64) X(DT_SHL64) X(DT_SHR64) \
+    X(DT_GT64) X(DT_LT64) X(DT_EQ64) X(DT_SEXT) X(DT_TRUNC) \
+    X(DT_DP_ADD) X(DT_DP_SUB) X(DT_DP_MUL) X(DT_DP_DIV) \
+    X(DT_LOD_INC_STO) X(DT_IMMI_GT_JZ) X(DT_LOD_LOD_ADD)
+
+template <typename Engine>
+struct OpcodeSemantics {
+    static float to_float(uint32_t val) {
+        float f;
+        memcpy(&f, &val, 4);
+        return f;
+    }
+
+    static uint32_t from_float(float val) {
+        uint32_t u;
+        memcpy(&u, &val, 4);
+        return u;
+    }
+
+    static uint32_t read_mem32(const char* buffer, uint32_t offset) {
+        uint32_t val;
+        memcpy(&val, buffer + offset, 4);
+        return val;
+    }
+
+    static void write_mem32(char* buffer, uint32_t val, uint32_t offset) {
+        memcpy(buffer + offset, &val, 4);
+    }
+
+    template <typename T>
+    static T read_mem(const char* buffer, uint32_t offset) {
+        T val;
+        memcpy(&val, buffer + offset, sizeof(val));
+        return val;
+    }
+
+    template <typename T>
+    static void write_mem(char* buffer, T val, uint32_t offset) {
+        memcpy(buffer + offset, &val, sizeof(val));
+    }
+
+    // A 64-bit value is two slots, low word first, so 32-bit programs keep
+    // their stack layout and cost.
+    static void push64(Engine& vm, uint64_t val) {
+        vm.push(static_cast<uint32_t>(val));
+        vm.push(static_cast<uint32_t>(val >> 32));
+    }
+
+    static uint64_t pop64(Engine& vm) {
+        uint64_t high = vm.pop();
+        return high << 32 | vm.pop();
+    }
+
+    static double to_double(uint64_t val) {
+        double d;
+        memcpy(&d, &val, 8);
+        return d;
+    }
+
+    static uint64_t from_double(double val) {
+        uint64_t u;
+        memcpy(&u, &val, 8);
+        return u;
+    }
+
+    template <uint32_t Op, typename Operands>
+    [[gnu::always_inline]] static inline void execute(Engine& vm, Operands operand) {
+        if constexpr (Op == DT_ADD) {
+            uint32_t a = vm.pop();
+            uint32_t b = vm.pop();
+            vm.push(a + b);
+        } else if constexpr (Op == DT_SUB) {
+            uint32_t a = vm.pop();
+            uint32_t b = vm.pop();
+            vm.push(b - a);
+        } else if constexpr (Op == DT_MUL) {
+            uint32_t a = vm.pop();
+            uint32_t b = vm.pop();
+            vm.push(a * b);
+        } else if constexpr (Op == DT_DIV) {
+            uint32_t a = vm.pop();
+            uint32_t b = vm.pop();
+            if (a == 0) {
+                divideByZero();
+            }
+            vm.push(b / a);
+        } else if constexpr (Op == DT_SHL) {
+            uint32_t shift = vm.pop();
+            uint32_t value = vm.pop();
+            vm.push(value << shift);
+        } else if constexpr (Op == DT_SHR) {
+            uint32_t shift = vm.pop();
+            uint32_t value = vm.pop();
+            vm.push(value >> shift);
+        } else if constexpr (Op == DT_FP_ADD) {
+            float a = to_float(vm.pop());
+            float b = to_float(vm.pop());
+            vm.push(from_float(a + b));
+        } else if constexpr (Op == DT_FP_SUB) {
+            float a = to_float(vm.pop());
+            float b = to_float(vm.pop());
+            vm.push(from_float(b - a));
+        } else if constexpr (Op == DT_FP_MUL) {
+            float a = to_float(vm.pop());
+            float b = to_float(vm.pop());
+            vm.push(from_float(a * b));
+        } else if constexpr (Op == DT_FP_DIV) {
+            // IEEE: division by zero gives an infinity or NaN
+            float a = to_float(vm.pop());
+            float b = to_float(vm.pop());
+            vm.push(from_float(b / a));
+        } else if constexpr (Op == DT_END) {
+            vm.end();
+        } else if constexpr (Op == DT_LOD) {
+            vm.push(read_mem32(vm.buffer, operand[0]));
+        } else if constexpr (Op == DT_STO) {
+            write_mem32(vm.buffer, vm.pop(), operand[0]);
+        } else if constexpr (Op == DT_IMMI) {
+            vm.push(operand[0]);
+        } else if constexpr (Op == DT_INC) {
+            vm.push(vm.pop() + 1);
+        } else if constexpr (Op == DT_DEC) {
+            vm.push(vm.pop() - 1);
+        } else if constexpr (Op == DT_STO_IMMI) {
+            write_mem32(vm.buffer, operand[1], operand[0]);
+        } else if constexpr (Op == DT_MEMCPY) {
+            memcpy(vm.buffer + operand[0], vm.buffer + operand[1], operand[2]);
+        } else if constexpr (Op == DT_MEMSET) {
+            memset(vm.buffer + operand[0], operand[1], operand[2]);
+        } else if constexpr (Op == DT_JMP) {
+            vm.jump(operand[0]);
+        } else if constexpr (Op == DT_JZ) {
+            if (vm.pop() == 0) {
+                vm.jump(operand[0]);
+            }
+        } else if constexpr (Op == DT_JUMP_IF) {
+            if (vm.pop()) {
+                vm.jump(operand[0]);
+            }
+        } else if constexpr (Op == DT_IF_ELSE) {
+            vm.jump(vm.pop() ? operand[0] : operand[1]);
+        } else if constexpr (Op == DT_GT) {
+            uint32_t a = vm.pop();
+            uint32_t b = vm.pop();
+            vm.push(b > a ? 1 : 0);
+        } else if constexpr (Op == DT_LT) {
+            uint32_t a = vm.pop();
+            uint32_t b = vm.pop();
+            vm.push(b < a ? 1 : 0);
+        } else if constexpr (Op == DT_EQ) {
+            uint32_t a = vm.pop();
+            uint32_t b = vm.pop();
+            vm.push(b == a ? 1 : 0);
+        } else if constexpr (Op == DT_GT_EQ) {
+            uint32_t a = vm.pop();
+            uint32_t b = vm.pop();
+            vm.push(b >= a ? 1 : 0);
+        } else if constexpr (Op == DT_LT_EQ) {
+            uint32_t a = vm.pop();
+            uint32_t b = vm.pop();
+            vm.push(b <= a ? 1 : 0);
+        } else if constexpr (Op == DT_CALL) {
+            vm.call(operand[0], operand[1]);
+        } else if constexpr (Op == DT_RET) {
+            vm.ret();
+        } else if constexpr (Op == DT_SEEK) {
+            vm.debug_num = vm.top();
+        } else if constexpr (Op == DT_PRINT) {
+            if (!vm.empty()) {
+                std::cout << (int)vm.top() << std::endl;
+            } else {
+                std::cerr << "Stack is empty." << std::endl;
+            }
+        } else if constexpr (Op == DT_FP_PRINT) {
+            if (!vm.empty()) {
+                std::cout << to_float(vm.top()) << std::endl;
+            } else {
+                std::cerr << "Stack is empty." << std::endl;
+            }
+        } else if constexpr (Op == DT_READ_INT) {
+            int val;
+            std::cin >> val;
+            write_mem32(vm.buffer, val, operand[0]);
+        } else if constexpr (Op == DT_FP_READ) {
+            float val;
+            std::cin >> val;
+            write_mem32(vm.buffer, from_float(val), operand[0]);
+        } else if constexpr (Op == DT_Tik) {
+            std::cout << "tik" << std::endl;
+        } else if constexpr (Op == DT_MEMCMP) {
+            // -1, 0 or 1. The bulk opcodes go to libc, whose kernels are
+            // already vectorised and picked for the CPU at load time.
+            int order = memcmp(vm.buffer + operand[0], vm.buffer + operand[1], operand[2]);
+            vm.push(order < 0 ? UINT32_MAX : order > 0 ? 1 : 0);
+        } else if constexpr (Op == DT_MEMCHR) {
+            // Address of the first match, or UINT32_MAX
+            const void* found = memchr(vm.buffer + operand[0], operand[1], operand[2]);
+            vm.push(found ? static_cast<uint32_t>(static_cast<const char*>(found) - vm.buffer) : UINT32_MAX);
+        } else if constexpr (Op == DT_STRLEN) {
+            // A string running off the end of memory faults into the guard zone.
+            vm.push(static_cast<uint32_t>(strlen(vm.buffer + operand[0])));
+        } else if constexpr (Op == DT_MEMMOVE) {
+            memmove(vm.buffer + operand[0], vm.buffer + operand[1], operand[2]);
+        } else if constexpr (Op == DT_VADD) {
+            // dst, src1, src2, element count (vectorops.hpp)
+            vectorops::add(vm.buffer + operand[0], vm.buffer + operand[1], vm.buffer + operand[2], operand[3]);
+        } else if constexpr (Op == DT_VMUL) {
+            vectorops::mul(vm.buffer + operand[0], vm.buffer + operand[1], vm.buffer + operand[2], operand[3]);
+        } else if constexpr (Op == DT_VFP_ADD) {
+            vectorops::fpAdd(vm.buffer + operand[0], vm.buffer + operand[1], vm.buffer + operand[2], operand[3]);
+        } else if constexpr (Op == DT_VFP_MUL) {
+            vectorops::fpMul(vm.buffer + operand[0], vm.buffer + operand[1], vm.buffer + operand[2], operand[3]);
+        } else if constexpr (Op == DT_VDOT) {
+            // The float sum goes to dst rather than the stack
+            float sum = vectorops::dot(vm.buffer + operand[1], vm.buffer + operand[2], operand[3]);
+            write_mem32(vm.buffer, from_float(sum), operand[0]);
+        } else if constexpr (Op == DT_LOD8) {
+            vm.push(read_mem<uint8_t>(vm.buffer, operand[0]));
+        } else if constexpr (Op == DT_LOD8S) {
+            vm.push(static_cast<uint32_t>(static_cast<int32_t>(read_mem<int8_t>(vm.buffer, operand[0]))));
+        } else if constexpr (Op == DT_LOD16) {
+            vm.push(read_mem<uint16_t>(vm.buffer, operand[0]));
+        } else if constexpr (Op == DT_LOD16S) {
+            vm.push(static_cast<uint32_t>(static_cast<int32_t>(read_mem<int16_t>(vm.buffer, operand[0]))));
+        } else if constexpr (Op == DT_LOD64) {
+            push64(vm, read_mem<uint64_t>(vm.buffer, operand[0]));
+        } else if constexpr (Op == DT_STO8) {
+            write_mem(vm.buffer, static_cast<uint8_t>(vm.pop()), operand[0]);
+        } else if constexpr (Op == DT_STO16) {
+            write_mem(vm.buffer, static_cast<uint16_t>(vm.pop()), operand[0]);
+        } else if constexpr (Op == DT_STO64) {
+            write_mem(vm.buffer, pop64(vm), operand[0]);
+        } else if constexpr (Op == DT_ADD64) {
+            uint64_t a = pop64(vm);
+            uint64_t b = pop64(vm);
+            push64(vm, a + b);
+        } else if constexpr (Op == DT_SUB64) {
+            uint64_t a = pop64(vm);
+            uint64_t b = pop64(vm);
+            push64(vm, b - a);
+        } else if constexpr (Op == DT_MUL64) {
+            uint64_t a = pop64(vm);
+            uint64_t b = pop64(vm);
+            push64(vm, a * b);
+        } else if constexpr (Op == DT_DIV64) {
+            uint64_t a = pop64(vm);
+            uint64_t b = pop64(vm);
+            if (a == 0) {
+                divideByZero();
+            }
+            push64(vm, b / a);
+        } else if constexpr (Op == DT_SHL64) {
+            // The shift count is a single slot
+            uint32_t shift = vm.pop() & 63;
+            push64(vm, pop64(vm) << shift);
+        } else if constexpr (Op == DT_SHR64) {
+            uint32_t shift = vm.pop() & 63;
+            push64(vm, pop64(vm) >> shift);
+        } else if constexpr (Op == DT_GT64) {
+            uint64_t a = pop64(vm);
+            uint64_t b = pop64(vm);
+            vm.push(b > a ? 1 : 0);
+        } else if constexpr (Op == DT_LT64) {
+            uint64_t a = pop64(vm);
+            uint64_t b = pop64(vm);
+            vm.push(b < a ? 1 : 0);
+        } else if constexpr (Op == DT_EQ64) {
+            uint64_t a = pop64(vm);
+            uint64_t b = pop64(vm);
+            vm.push(b == a ? 1 : 0);
+        } else if constexpr (Op == DT_SEXT) {
+            vm.push(static_cast<int32_t>(vm.top()) < 0 ? UINT32_MAX : 0);
+        } else if constexpr (Op == DT_TRUNC) {
+            vm.pop();
+        } else if constexpr (Op == DT_DP_ADD) {
+            double a = to_double(pop64(vm));
+            double b = to_double(pop64(vm));
+            push64(vm, from_double(a + b));
+        } else if constexpr (Op == DT_DP_SUB) {
+            double a = to_double(pop64(vm));
+            double b = to_double(pop64(vm));
+            push64(vm, from_double(b - a));
+        } else if constexpr (Op == DT_DP_MUL) {
+            double a = to_double(pop64(vm));
+            double b = to_double(pop64(vm));
+            push64(vm, from_double(a * b));
+        } else if constexpr (Op == DT_DP_DIV) {
+            // IEEE: division by zero gives an infinity or NaN
+            double a = to_double(pop64(vm));
+            double b = to_double(pop64(vm));
+            push64(vm, from_double(b / a));
+        } else if constexpr (Op == DT_LOD_INC_STO) {
+            write_mem32(vm.buffer, read_mem32(vm.buffer, operand[0]) + 1, operand[1]);
+        } else if constexpr (Op == DT_IMMI_GT_JZ) {
+            if (!(vm.pop() > operand[0])) {
+                vm.jump(operand[1]);
+            }
+        } else if constexpr (Op == DT_LOD_LOD_ADD) {
+            vm.push(read_mem32(vm.buffer, operand[0]) + read_mem32(vm.buffer, operand[1]));
+        } else {
+            illegal(vm);
+        }
+    }
+
+    [[noreturn]] static void divideByZero() {
+        throw std::runtime_error("Division by zero");
+    }
+
+    static void illegal(Engine&) {
+        std::cerr << "Error: Unknown instruction" << std::endl;
+    }
+
+    // Switch dispatch for engines that decode at run time.
+    template <typename Operands>
+    [[gnu::always_inline]] static inline void dispatch(Engine& vm, uint32_t opcode, Operands operand) {
+        switch (opcode) {
+#define SEMANTICS_CASE(op) case op: execute<op>(vm, operand); break;
+            FOR_EACH_OPCODE(SEMANTICS_CASE)
+#undef SEMANTICS_CASE
+            default:
+                illegal(vm);
+        }
+    }
+};
+
+#endif // SEMANTICS_HPP
@@ -0,0 +1,72 @@
+#ifndef SLOTSTACK_HPP
+#define SLOTSTACK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include "semantics.hpp"
+#include "verifier.hpp"
+
+// The shared semantics over a bare operand stack: the frame [fp, sp) of a
+// contiguous run of slots that may grow up to limit. Engines with handlers of
+// their own (tos caching, register code, tail calls, stencils) keep them for
+// the common opcodes and run the rest through here, one call per instruction.
+// Only straight-line opcodes run this way; control flow stays with the engine.
+class SlotStack {
+    friend struct OpcodeSemantics<SlotStack>;
+
+    uint32_t* const fp;
+    uint32_t* sp;
+    char* const buffer;
+    uint32_t& debug_num;
+
+    SlotStack(uint32_t* frame, uint32_t* top, char* memory, uint32_t& seek)
+        : fp(frame), sp(top), buffer(memory), debug_num(seek) {}
+
+    void push(uint32_t value) { *sp++ = value; }
+    uint32_t pop() { return *--sp; }
+    uint32_t top() { return sp[-1]; }
+    bool empty() { return sp == fp; }
+
+    static constexpr bool transfersControl(uint32_t opcode) {
+        switch (opcode) {
+            case DT_END: case DT_JMP: case DT_JZ: case DT_JUMP_IF: case DT_IF_ELSE:
+            case DT_CALL: case DT_RET: case DT_IMMI_GT_JZ:
+                return true;
+        }
+        return false;
+    }
+
+public:
+    // Runs Op on the frame after checking its stack effect, and returns the
+    // new stack pointer. Traps throw std::runtime_error.
+    template <uint32_t Op, typename Operands>
+    static uint32_t* execute(Operands operand, uint32_t* fp, uint32_t* sp, uint32_t* limit, char* buffer, uint32_t& debug_num) {
+        static_assert(!transfersControl(Op));
+        uint32_t needs;
+        int32_t delta;
+        verifier::stackEffect(Op, needs, delta);
+        if (sp - fp < static_cast<ptrdiff_t>(needs)) {
+            throw std::runtime_error("Operand stack underflow");
+        }
+        if (limit - sp < delta) {
+            throw std::runtime_error("Operand stack overflow");
+        }
+        SlotStack stack(fp, sp, buffer, debug_num);
+        OpcodeSemantics<SlotStack>::template execute<Op>(stack, operand);
+        return stack.sp;
+    }
+
+    // The same, decoding the opcode at run time.
+    static uint32_t* execute(uint32_t opcode, const uint32_t* operand, uint32_t* fp, uint32_t* sp, uint32_t* limit, char* buffer, uint32_t& debug_num) {
+        switch (opcode) {
+#define SLOTSTACK_CASE(op) \
+            case op: if constexpr (!transfersControl(op)) return execute<op>(operand, fp, sp, limit, buffer, debug_num); break;
+            FOR_EACH_OPCODE(SLOTSTACK_CASE)
+#undef SLOTSTACK_CASE
+        }
+        throw std::runtime_error("Unknown instruction");
+    }
+};
+
+#endif // SLOTSTACK_HPP
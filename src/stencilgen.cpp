@@ -0,0 +1,205 @@
+// Build-time tool: cuts the stencil_* functions out of the compiled
+// stencils.cpp object and writes them, with their holes, as a C++ header
+// for the copy-and-patch engine.
+//
+//   stencilgen <stencils.o> <stencils.h>
+#include <elf.h>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Hole {
+    uint64_t offset;
+    std::string hole;
+    std::string patch;
+    int64_t addend;
+};
+
+struct Stencil {
+    std::string name;
+    std::vector<uint8_t> code;
+    std::vector<Hole> holes;
+    uint32_t tailJump = 0;
+};
+
+std::vector<uint8_t> readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Can't open " + path);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+}
+
+template <typename T>
+const T& at(const std::vector<uint8_t>& image, uint64_t offset) {
+    if (offset + sizeof(T) > image.size()) {
+        throw std::runtime_error("Truncated object file");
+    }
+    return *reinterpret_cast<const T*>(image.data() + offset);
+}
+
+std::string holeName(const std::string& symbol) {
+    static const char* const names[][2] = {
+        {"HOLE_OP0", "CP_HOLE_OP0"},
+        {"HOLE_OP1", "CP_HOLE_OP1"},
+        {"HOLE_OP2", "CP_HOLE_OP2"},
+        {"HOLE_NEXT_INDEX", "CP_HOLE_NEXT_INDEX"},
+        {"HOLE_CONTINUE", "CP_HOLE_CONTINUE"},
+        {"HOLE_TARGET", "CP_HOLE_TARGET"},
+        {"HOLE_TARGET2", "CP_HOLE_TARGET2"},
+    };
+    for (const auto& n : names) {
+        if (symbol == n[0]) return n[1];
+    }
+    return "";
+}
+
+std::vector<Stencil> extract(const std::vector<uint8_t>& image) {
+    const auto& ehdr = at<Elf64_Ehdr>(image, 0);
+    if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr.e_machine != EM_X86_64 || ehdr.e_type != ET_REL) {
+        throw std::runtime_error("Expected an x86-64 ELF relocatable object");
+    }
+    auto section = [&](uint32_t i) -> const Elf64_Shdr& {
+        return at<Elf64_Shdr>(image, ehdr.e_shoff + uint64_t(i) * ehdr.e_shentsize);
+    };
+    auto cstr = [&](const Elf64_Shdr& strtab, uint32_t offset) {
+        return std::string(reinterpret_cast<const char*>(image.data() + strtab.sh_offset + offset));
+    };
+
+    const Elf64_Shdr* symtab = nullptr;
+    for (uint32_t i = 0; i < ehdr.e_shnum; ++i) {
+        if (section(i).sh_type == SHT_SYMTAB) symtab = &section(i);
+    }
+    if (!symtab) {
+        throw std::runtime_error("Object file has no symbol table");
+    }
+    const Elf64_Shdr& strtab = section(symtab->sh_link);
+    uint64_t symbolCount = symtab->sh_size / sizeof(Elf64_Sym);
+    auto symbol = [&](uint64_t i) -> const Elf64_Sym& {
+        return at<Elf64_Sym>(image, symtab->sh_offset + i * sizeof(Elf64_Sym));
+    };
+
+    std::vector<Stencil> stencils;
+    for (uint64_t i = 0; i < symbolCount; ++i) {
+        const Elf64_Sym& sym = symbol(i);
+        std::string name = cstr(strtab, sym.st_name);
+        if (ELF64_ST_TYPE(sym.st_info) != STT_FUNC || name.rfind("stencil_", 0) != 0) {
+            continue;
+        }
+        const Elf64_Shdr& text = section(sym.st_shndx);
+        Stencil stencil;
+        stencil.name = name.substr(strlen("stencil_"));
+        const uint8_t* begin = image.data() + text.sh_offset + sym.st_value;
+        stencil.code.assign(begin, begin + sym.st_size);
+
+        for (uint32_t r = 0; r < ehdr.e_shnum; ++r) {
+            const Elf64_Shdr& rela = section(r);
+            if (rela.sh_type == SHT_REL) {
+                throw std::runtime_error("REL relocations are not supported");
+            }
+            if (rela.sh_type != SHT_RELA || rela.sh_info != sym.st_shndx) {
+                continue;
+            }
+            for (uint64_t k = 0; k < rela.sh_size / sizeof(Elf64_Rela); ++k) {
+                const auto& rel = at<Elf64_Rela>(image, rela.sh_offset + k * sizeof(Elf64_Rela));
+                if (rel.r_offset < sym.st_value || rel.r_offset >= sym.st_value + sym.st_size) {
+                    continue;
+                }
+                std::string target = cstr(strtab, symbol(ELF64_R_SYM(rel.r_info)).st_name);
+                std::string hole = holeName(target);
+                if (hole.empty()) {
+                    throw std::runtime_error("stencil_" + stencil.name + " refers to '" + target +
+                                             "'; stencils may only reference HOLE_* symbols");
+                }
+                std::string patch;
+                switch (ELF64_R_TYPE(rel.r_info)) {
+                    case R_X86_64_32:
+                        patch = "CP_PATCH_ABS32";
+                        break;
+                    case R_X86_64_PC32:
+                    case R_X86_64_PLT32:
+                        patch = "CP_PATCH_REL32";
+                        break;
+                    default:
+                        throw std::runtime_error("stencil_" + stencil.name + " has an unsupported relocation type " +
+                                                 std::to_string(ELF64_R_TYPE(rel.r_info)));
+                }
+                stencil.holes.push_back({rel.r_offset - sym.st_value, hole, patch, rel.r_addend});
+            }
+        }
+
+        // A trailing `jmp HOLE_CONTINUE` can be dropped when the next stencil
+        // is placed right behind this one, which is always the case.
+        size_t n = stencil.code.size();
+        for (const Hole& h : stencil.holes) {
+            if (n >= 5 && stencil.code[n - 5] == 0xE9 && h.offset == n - 4 && h.hole == "CP_HOLE_CONTINUE" &&
+                h.patch == "CP_PATCH_REL32" && h.addend == -4) {
+                stencil.tailJump = 5;
+            }
+        }
+        stencils.push_back(std::move(stencil));
+    }
+    if (stencils.empty()) {
+        throw std::runtime_error("No stencil_* functions found");
+    }
+    return stencils;
+}
+
+std::string render(const std::vector<Stencil>& stencils) {
+    std::ostringstream out;
+    out << "// Generated by stencilgen from stencils.cpp. Do not edit.\n"
+        << "#pragma once\n"
+        << "#include \"copypatch.hpp\"\n"
+        << "#include \"symbol.hpp\"\n\n";
+    for (const Stencil& s : stencils) {
+        out << "static const uint8_t cp_code_" << s.name << "[] = {";
+        for (size_t i = 0; i < s.code.size(); ++i) {
+            out << (i % 16 == 0 ? "\n    " : " ") << "0x" << std::hex << int(s.code[i]) << std::dec << ",";
+        }
+        out << "\n};\n";
+        if (!s.holes.empty()) {
+            out << "static const CPStencilHole cp_holes_" << s.name << "[] = {\n";
+            for (const Hole& h : s.holes) {
+                out << "    {" << h.offset << ", " << h.hole << ", " << h.patch << ", " << h.addend << "},\n";
+            }
+            out << "};\n";
+        }
+    }
+    out << "\nstatic const CPStencil cpStencils[] = {\n";
+    for (const Stencil& s : stencils) {
+        out << "    {" << s.name << ", cp_code_" << s.name << ", " << s.code.size() << ", "
+            << (s.holes.empty() ? "nullptr" : "cp_holes_" + s.name) << ", " << s.holes.size() << ", "
+            << s.tailJump << "},\n";
+    }
+    out << "};\n";
+    return out.str();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <stencils.o> <stencils.h>" << std::endl;
+        return 1;
+    }
+    try {
+        std::string header = render(extract(readFile(argv[1])));
+        std::ofstream out(argv[2]);
+        out << header;
+        if (!out) {
+            throw std::runtime_error(std::string("Can't write ") + argv[2]);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "stencilgen: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
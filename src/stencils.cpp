@@ -0,0 +1,191 @@
+// Handler stencils for the copy-and-patch engine.
+//
+// This file is not linked into anything. It is compiled at build time with
+// -fno-pic -mcmodel=small -ffunction-sections and stencilgen cuts every
+// stencil_* function out of the object file together with its relocations.
+// Operands are read from the addresses of HOLE_OP* (patched as 32-bit
+// immediates) and control leaves a stencil only through tail calls to the
+// HOLE_CONTINUE/HOLE_TARGET* functions (patched as rel32 jumps) or by
+// returning, which ends the run.
+#include <cstring>
+#include "copypatch.hpp"
+#include "symbol.hpp"
+
+extern "C" {
+extern char HOLE_OP0[];
+extern char HOLE_OP1[];
+extern char HOLE_OP2[];
+extern char HOLE_NEXT_INDEX[];
+void HOLE_CONTINUE(CPState*, uint32_t*, char*);
+void HOLE_TARGET(CPState*, uint32_t*, char*);
+void HOLE_TARGET2(CPState*, uint32_t*, char*);
+}
+
+// The empty asm keeps the value in a register, so the hole is always a
+// zero-extended `mov $imm32, reg` rather than a sign-extended displacement.
+#define HOLE(name) ([] { uint32_t v = (uint32_t)(uintptr_t)name; __asm__("" : "+r"(v)); return v; }())
+#define OP0 HOLE(HOLE_OP0)
+#define OP1 HOLE(HOLE_OP1)
+#define OP2 HOLE(HOLE_OP2)
+#define CONTINUE() return HOLE_CONTINUE(s, sp, mem)
+#define JUMP(target) return target(s, sp, mem)
+#define STOP(code) do { s->sp = sp; s->status = code; return; } while (0)
+#define PUSH(value) do { if (sp == s->stackLimit) STOP(CP_STACK_OVERFLOW); *sp++ = (value); } while (0)
+#define NEED(count) do { if (static_cast<size_t>(sp - s->fp) < (count)) STOP(CP_STACK_UNDERFLOW); } while (0)
+#define STENCIL(name) extern "C" void stencil_##name(CPState* s, uint32_t* sp, char* mem)
+
+static inline float to_float(uint32_t val) {
+    float f;
+    memcpy(&f, &val, 4);
+    return f;
+}
+
+static inline uint32_t from_float(float val) {
+    uint32_t u;
+    memcpy(&u, &val, 4);
+    return u;
+}
+
+static inline uint32_t load32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline void store32(char* p, uint32_t v) {
+    memcpy(p, &v, 4);
+}
+
+#define BINARY(name, expr) \
+    STENCIL(name) { NEED(2); uint32_t a = sp[-1]; uint32_t b = sp[-2]; sp[-2] = (expr); sp--; CONTINUE(); }
+
+BINARY(DT_ADD, a + b)
+BINARY(DT_SUB, b - a)
+BINARY(DT_MUL, a * b)
+BINARY(DT_SHL, b << a)
+BINARY(DT_SHR, b >> a)
+BINARY(DT_GT, b > a ? 1u : 0u)
+BINARY(DT_LT, b < a ? 1u : 0u)
+BINARY(DT_EQ, b == a ? 1u : 0u)
+BINARY(DT_GT_EQ, b >= a ? 1u : 0u)
+BINARY(DT_LT_EQ, b <= a ? 1u : 0u)
+
+#define FP_BINARY(name, expr) \
+    STENCIL(name) { NEED(2); float a = to_float(sp[-1]); float b = to_float(sp[-2]); sp[-2] = from_float(expr); sp--; CONTINUE(); }
+
+FP_BINARY(DT_FP_ADD, a + b)
+FP_BINARY(DT_FP_SUB, b - a)
+FP_BINARY(DT_FP_MUL, a * b)
+FP_BINARY(DT_FP_DIV, b / a)
+
+STENCIL(DT_DIV) {
+    NEED(2);
+    uint32_t a = sp[-1];
+    uint32_t b = sp[-2];
+    if (a == 0) STOP(CP_DIVIDE_BY_ZERO);
+    sp[-2] = b / a;
+    sp--;
+    CONTINUE();
+}
+
+STENCIL(DT_INC) { NEED(1); sp[-1] += 1; CONTINUE(); }
+STENCIL(DT_DEC) { NEED(1); sp[-1] -= 1; CONTINUE(); }
+
+STENCIL(DT_END) { STOP(CP_OK); }
+STENCIL(CP_HALT) { STOP(CP_OK); }
+STENCIL(CP_ILLEGAL) { STOP(CP_ILLEGAL_INSTRUCTION); }
+
+STENCIL(CP_SHARED) {
+    uint32_t* top = s->rt->shared(s, sp, mem, OP0);
+    if (!top) STOP(CP_TRAP);
+    sp = top;
+    CONTINUE();
+}
+
+STENCIL(DT_LOD) { PUSH(load32(mem + OP0)); CONTINUE(); }
+STENCIL(DT_STO) { NEED(1); store32(mem + OP0, *--sp); CONTINUE(); }
+STENCIL(DT_IMMI) { PUSH(OP0); CONTINUE(); }
+STENCIL(DT_STO_IMMI) { store32(mem + OP0, OP1); CONTINUE(); }
+STENCIL(DT_MEMCPY) { s->rt->memcpy(mem + OP0, mem + OP1, OP2); CONTINUE(); }
+STENCIL(DT_MEMSET) { s->rt->memset(mem + OP0, OP1, OP2); CONTINUE(); }
+
+STENCIL(DT_JMP) { JUMP(HOLE_TARGET); }
+
+STENCIL(DT_JZ) {
+    NEED(1);
+    if (*--sp == 0) {
+        JUMP(HOLE_TARGET);
+    }
+    CONTINUE();
+}
+
+STENCIL(DT_JUMP_IF) {
+    NEED(1);
+    if (*--sp) {
+        JUMP(HOLE_TARGET);
+    }
+    CONTINUE();
+}
+
+STENCIL(DT_IF_ELSE) {
+    NEED(1);
+    if (*--sp) {
+        JUMP(HOLE_TARGET);
+    }
+    JUMP(HOLE_TARGET2);
+}
+
+STENCIL(DT_CALL) {
+    uint32_t num_params = OP1;
+    NEED(num_params);
+    if (s->frameTop == s->frameLimit) STOP(CP_FRAME_OVERFLOW);
+    s->frameTop->fp = s->fp;
+    s->frameTop->returnIndex = HOLE(HOLE_NEXT_INDEX);
+    s->frameTop++;
+    uint32_t* base = sp - num_params;
+    for (uint32_t i = 0, j = num_params; i + 1 < j; ++i, --j) {
+        uint32_t t = base[i];
+        base[i] = base[j - 1];
+        base[j - 1] = t;
+    }
+    s->fp = base;
+    JUMP(HOLE_TARGET);
+}
+
+STENCIL(DT_RET) {
+    if (s->frameTop == s->frames) {
+        s->rt->error(s, CP_ERR_CALL_UNDERFLOW);
+        CONTINUE();
+    }
+    NEED(1);
+    uint32_t return_value = sp[-1];
+    sp = s->fp;
+    *sp++ = return_value;
+    s->frameTop--;
+    s->fp = s->frameTop->fp;
+    return reinterpret_cast<CPStencilFn>(s->entries[s->frameTop->returnIndex])(s, sp, mem);
+}
+
+STENCIL(DT_SEEK) { NEED(1); s->debug_num = sp[-1]; CONTINUE(); }
+
+STENCIL(DT_PRINT) {
+    if (sp > s->fp) {
+        s->rt->print(s, sp[-1]);
+    } else {
+        s->rt->error(s, CP_ERR_EMPTY_STACK);
+    }
+    CONTINUE();
+}
+
+STENCIL(DT_FP_PRINT) {
+    if (sp > s->fp) {
+        s->rt->print_fp(s, sp[-1]);
+    } else {
+        s->rt->error(s, CP_ERR_EMPTY_STACK);
+    }
+    CONTINUE();
+}
+
+STENCIL(DT_READ_INT) { store32(mem + OP0, s->rt->read_int(s)); CONTINUE(); }
+STENCIL(DT_FP_READ) { store32(mem + OP0, s->rt->read_fp(s)); CONTINUE(); }
+STENCIL(DT_Tik) { s->rt->tik(s); CONTINUE(); }
@@ -0,0 +1,92 @@
+#ifndef SUPERINSTRUCTIONS_HPP
+#define SUPERINSTRUCTIONS_HPP
+
+#include <vector>
+#include <span>
+#include <cstdint>
+#include "symbol.hpp"
+#include "verifier.hpp"
+
+// Static superinstructions. Each entry replaces a run of instructions with
+// one fused opcode whose operands are the operands of the run, concatenated
+// in order. Adding a pattern takes an entry here, its row in opcodeTable
+// (symbol.hpp) and its semantics (semantics.hpp).
+struct SuperInstruction {
+    Instruction fused;
+    std::vector<Instruction> pattern;
+};
+
+inline const SuperInstruction superInstructions[] = {
+    {DT_LOD_INC_STO, {DT_LOD, DT_INC, DT_STO}},   // mem[b] = mem[a] + 1
+    {DT_IMMI_GT_JZ, {DT_IMMI, DT_GT, DT_JZ}},     // if !(pop > k) goto t
+    {DT_LOD_LOD_ADD, {DT_LOD, DT_LOD, DT_ADD}},   // push mem[a] + mem[b]
+};
+
+// Rewrites `code` with every table pattern fused, remapping jump targets to
+// the shortened layout. A pattern is never fused across a jump target, and
+// programs with a jump into the middle of an instruction are left alone.
+inline std::vector<uint32_t> fuseSuperinstructions(std::span<const uint32_t> code) {
+    const InstructionBoundaries boundaries(code);
+    const std::vector<uint32_t>& starts = boundaries.starts;
+    if (boundaries.truncatedAt != UINT32_MAX) {
+        return std::vector<uint32_t>(code.begin(), code.end());
+    }
+
+    std::vector<bool> isTarget(code.size() + 1, false);
+    for (uint32_t start : starts) {
+        uint32_t mask = jumpOperandMask(code[start]);
+        for (uint32_t i = 0; mask; ++i, mask >>= 1) {
+            if (!(mask & 1)) continue;
+            uint32_t target = code[start + 1 + i];
+            if (target < code.size()) {
+                if (!boundaries.isBoundary(target)) return std::vector<uint32_t>(code.begin(), code.end());
+                isTarget[target] = true;
+            }
+        }
+    }
+
+    std::vector<uint32_t> fused;
+    std::vector<uint32_t> newAddress(code.size() + 1, 0);
+    fused.reserve(code.size());
+    for (size_t i = 0; i < starts.size();) {
+        const SuperInstruction* match = nullptr;
+        for (const SuperInstruction& s : superInstructions) {
+            if (i + s.pattern.size() > starts.size()) continue;
+            size_t k = 0;
+            for (Instruction part : s.pattern) {
+                if (code[starts[i + k]] != part || (k > 0 && isTarget[starts[i + k]])) break;
+                ++k;
+            }
+            if (k == s.pattern.size()) {
+                match = &s;
+                break;
+            }
+        }
+        newAddress[starts[i]] = fused.size();
+        if (match) {
+            fused.push_back(match->fused);
+            for (size_t k = 0; k < match->pattern.size(); ++k) {
+                uint32_t start = starts[i + k];
+                for (uint32_t j = 1; j <= operandCount(code[start]); ++j) fused.push_back(code[start + j]);
+            }
+            i += match->pattern.size();
+        } else {
+            uint32_t start = starts[i];
+            for (uint32_t j = 0; j <= operandCount(code[start]); ++j) fused.push_back(code[start + j]);
+            ++i;
+        }
+    }
+    newAddress[code.size()] = fused.size();
+
+    for (uint32_t pointer = 0; pointer < fused.size(); pointer += operandCount(fused[pointer]) + 1) {
+        uint32_t mask = jumpOperandMask(fused[pointer]);
+        for (uint32_t i = 0; mask; ++i, mask >>= 1) {
+            if (!(mask & 1)) continue;
+            uint32_t& target = fused[pointer + 1 + i];
+            target = target < code.size() ? newAddress[target] : fused.size();
+        }
+    }
+    return fused;
+}
+
+#endif // SUPERINSTRUCTIONS_HPP
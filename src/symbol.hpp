@@ -1,5 +1,7 @@
 // Define the set of instructions supported by the VM
 #pragma once
+#include <array>
+#include <cstdint>
 enum Instruction {
     // arithmetic 
     DT_ADD, 
@@ -43,4 +45,85 @@ enum Instruction {
     DT_Tik,
     //System
     DT_SYSCALL,
+    //Bulk memory
+    DT_MEMCMP,
+    DT_MEMCHR,
+    DT_STRLEN,
+    DT_MEMMOVE,
+    //Vector, over arrays of 32-bit elements
+    DT_VADD,
+    DT_VMUL,
+    DT_VFP_ADD,
+    DT_VFP_MUL,
+    DT_VDOT,
+    //Width-typed memory; 64-bit values take two stack slots, high word on top
+    DT_LOD8,
+    DT_LOD8S,
+    DT_LOD16,
+    DT_LOD16S,
+    DT_LOD64,
+    DT_STO8,
+    DT_STO16,
+    DT_STO64,
+    //64-bit arithmetic
+    DT_ADD64,
+    DT_SUB64,
+    DT_MUL64,
+    DT_DIV64,
+    DT_SHL64,
+    DT_SHR64,
+    DT_GT64,
+    DT_LT64,
+    DT_EQ64,
+    DT_SEXT,
+    DT_TRUNC,
+    DT_DP_ADD,
+    DT_DP_SUB,
+    DT_DP_MUL,
+    DT_DP_DIV,
+    //Superinstructions, produced at load time by fuseSuperinstructions()
+    DT_LOD_INC_STO = 128,
+    DT_IMMI_GT_JZ,
+    DT_LOD_LOD_ADD,
 };
+
+// Static layout of every opcode: how many operand words follow it and which
+// of them are code addresses. Loaders, preprocessors and the superinstruction
+// pass all decode the bytecode through this one table.
+struct OpcodeInfo {
+    uint8_t operands;
+    uint8_t jumpMask; // Bit i is set when operand i is a code address
+};
+
+inline constexpr std::array<OpcodeInfo, 256> opcodeTable = [] {
+    std::array<OpcodeInfo, 256> table{};
+    for (uint32_t opcode : {DT_LOD, DT_STO, DT_IMMI, DT_READ_INT, DT_FP_READ, DT_STRLEN,
+                            DT_LOD8, DT_LOD8S, DT_LOD16, DT_LOD16S, DT_LOD64, DT_STO8, DT_STO16, DT_STO64}) {
+        table[opcode] = {1, 0x0};
+    }
+    for (uint32_t opcode : {DT_JMP, DT_JZ, DT_JUMP_IF}) {
+        table[opcode] = {1, 0x1};
+    }
+    table[DT_STO_IMMI] = {2, 0x0};
+    table[DT_IF_ELSE] = {2, 0x3};
+    table[DT_CALL] = {2, 0x1};
+    for (uint32_t opcode : {DT_MEMCPY, DT_MEMSET, DT_MEMCMP, DT_MEMCHR, DT_MEMMOVE}) {
+        table[opcode] = {3, 0x0};
+    }
+    for (uint32_t opcode : {DT_VADD, DT_VMUL, DT_VFP_ADD, DT_VFP_MUL, DT_VDOT}) {
+        table[opcode] = {4, 0x0};
+    }
+    // Superinstructions carry the operands of their pattern, concatenated
+    table[DT_LOD_INC_STO] = {2, 0x0};
+    table[DT_IMMI_GT_JZ] = {2, 0x2};
+    table[DT_LOD_LOD_ADD] = {2, 0x0};
+    return table;
+}();
+
+constexpr uint32_t operandCount(uint32_t opcode) {
+    return opcode < opcodeTable.size() ? opcodeTable[opcode].operands : 0;
+}
+
+constexpr uint32_t jumpOperandMask(uint32_t opcode) {
+    return opcode < opcodeTable.size() ? opcodeTable[opcode].jumpMask : 0;
+}
@@ -0,0 +1,391 @@
+#ifndef TAILCALLTHREADING_H
+#define TAILCALLTHREADING_H
+#include <vector>
+#include <span>
+#include <iostream>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "symbol.hpp"
+#include "verifier.hpp"
+#include "slotstack.hpp"
+#include "readfile.hpp"
+#include "interface.hpp"
+#include "vmmemory.hpp"
+
+// Tail-call threading: every handler is a free function that receives the
+// whole interpreter state as arguments, (ip, sp, mem, frame), and ends by
+// tail-calling the handler of the next instruction. With a guaranteed tail
+// call the four values stay in argument registers for the entire run and
+// each dispatch is a single indirect jump.
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(clang::musttail)
+#define TC_MUSTTAIL [[clang::musttail]]
+#elif defined(__has_attribute) && __has_attribute(musttail)
+#define TC_MUSTTAIL __attribute__((musttail))
+#else
+// Older GCC has no musttail, but turns these sibling calls into jumps at -O2
+// (-foptimize-sibling-calls); unoptimized builds recurse once per instruction.
+#define TC_MUSTTAIL
+#endif
+
+namespace tailcall {
+
+struct Instruction;
+struct Frame;
+typedef void (*Handler)(const Instruction* ip, uint32_t* sp, char* mem, Frame* frame);
+
+// Pre-decoded instruction. Jump operands are distances in instructions
+// relative to this one, so no table base is needed to follow them. Only the
+// vector opcodes have a fourth operand; it fills what would be padding.
+struct Instruction {
+    Handler handler;
+    uint32_t a, b, c, d;
+};
+
+enum Status : uint32_t {
+    OK,
+    STACK_OVERFLOW,
+    STACK_UNDERFLOW,
+    FRAME_OVERFLOW,
+    ILLEGAL_INSTRUCTION,
+    MEMORY_FAULT,
+    DIVIDE_BY_ZERO,
+    TRAP, // Raised by the shared semantics, message in State::trap
+};
+
+struct State {
+    Frame* frameBase;
+    Frame* frameLimit;
+    uint32_t debug_num;
+    uint32_t status;
+    std::string trap;
+};
+
+// One per active call. The stack limit and state pointer are repeated in
+// every frame so that handlers reach them with a single load.
+struct Frame {
+    uint32_t* fp;                  // Base of this frame's operand stack
+    const Instruction* returnIp;   // Where DT_RET continues in the caller
+    uint32_t* stackLimit;
+    State* state;
+};
+
+static inline float to_float(uint32_t val) {
+    float f;
+    memcpy(&f, &val, 4);
+    return f;
+}
+
+static inline uint32_t from_float(float val) {
+    uint32_t u;
+    memcpy(&u, &val, 4);
+    return u;
+}
+
+static inline uint32_t read_mem32(const char* mem, uint32_t offset) {
+    uint32_t val;
+    memcpy(&val, mem + offset, 4);
+    return val;
+}
+
+static inline void write_mem32(char* mem, uint32_t val, uint32_t offset) {
+    memcpy(mem + offset, &val, 4);
+}
+
+// Not every handler reads every register, e.g. op_end.
+#define HANDLER(name) static void name([[maybe_unused]] const Instruction* ip, [[maybe_unused]] uint32_t* sp, [[maybe_unused]] char* mem, Frame* frame)
+#define DISPATCH(next) do { const Instruction* n_ = (next); TC_MUSTTAIL return n_->handler(n_, sp, mem, frame); } while (0)
+#define NEXT() DISPATCH(ip + 1)
+#define JUMP(distance) DISPATCH(ip + static_cast<int32_t>(distance))
+#define STOP(code) do { frame->state->status = (code); return; } while (0)
+#define PUSH(value) do { if (sp == frame->stackLimit) STOP(STACK_OVERFLOW); *sp++ = (value); } while (0)
+#define NEED(count) do { if (sp - frame->fp < static_cast<ptrdiff_t>(count)) STOP(STACK_UNDERFLOW); } while (0)
+
+#define BINARY(name, expr) \
+    HANDLER(name) { NEED(2); uint32_t a = sp[-1]; uint32_t b = sp[-2]; sp[-2] = (expr); sp--; NEXT(); }
+#define FP_BINARY(name, expr) \
+    HANDLER(name) { NEED(2); float a = to_float(sp[-1]); float b = to_float(sp[-2]); sp[-2] = from_float(expr); sp--; NEXT(); }
+
+BINARY(op_add, a + b)
+BINARY(op_sub, b - a)
+BINARY(op_mul, a * b)
+BINARY(op_shl, b << a)
+BINARY(op_shr, b >> a)
+BINARY(op_gt, b > a ? 1 : 0)
+BINARY(op_lt, b < a ? 1 : 0)
+BINARY(op_eq, b == a ? 1 : 0)
+BINARY(op_gt_eq, b >= a ? 1 : 0)
+BINARY(op_lt_eq, b <= a ? 1 : 0)
+FP_BINARY(op_fp_add, a + b)
+FP_BINARY(op_fp_sub, b - a)
+FP_BINARY(op_fp_mul, a * b)
+FP_BINARY(op_fp_div, b / a)
+
+HANDLER(op_div) {
+    NEED(2);
+    uint32_t a = sp[-1];
+    uint32_t b = sp[-2];
+    if (a == 0) STOP(DIVIDE_BY_ZERO);
+    sp[-2] = b / a;
+    sp--;
+    NEXT();
+}
+
+HANDLER(op_inc) { NEED(1); sp[-1] += 1; NEXT(); }
+HANDLER(op_dec) { NEED(1); sp[-1] -= 1; NEXT(); }
+HANDLER(op_lod) { PUSH(read_mem32(mem, ip->a)); NEXT(); }
+HANDLER(op_sto) { NEED(1); write_mem32(mem, *--sp, ip->a); NEXT(); }
+HANDLER(op_immi) { PUSH(ip->a); NEXT(); }
+HANDLER(op_sto_immi) { write_mem32(mem, ip->b, ip->a); NEXT(); }
+HANDLER(op_memcpy) { memcpy(mem + ip->a, mem + ip->b, ip->c); NEXT(); }
+HANDLER(op_memset) { memset(mem + ip->a, ip->b, ip->c); NEXT(); }
+
+HANDLER(op_jmp) { JUMP(ip->a); }
+HANDLER(op_jz) {
+    NEED(1);
+    if (*--sp == 0) JUMP(ip->a);
+    NEXT();
+}
+HANDLER(op_jump_if) {
+    NEED(1);
+    if (*--sp) JUMP(ip->a);
+    NEXT();
+}
+HANDLER(op_if_else) {
+    NEED(1);
+    JUMP(*--sp ? ip->a : ip->b);
+}
+
+HANDLER(op_call) {
+    uint32_t num_params = ip->b;
+    NEED(num_params);
+    if (frame + 1 == frame->state->frameLimit) STOP(FRAME_OVERFLOW);
+    uint32_t* base = sp - num_params;
+    for (uint32_t* i = base, *j = sp - 1; i < j; ++i, --j) {
+        uint32_t t = *i; *i = *j; *j = t;
+    }
+    frame[1] = {base, ip + 1, frame->stackLimit, frame->state};
+    frame++;
+    JUMP(ip->a);
+}
+
+HANDLER(op_ret) {
+    if (frame == frame->state->frameBase) {
+        std::cerr << "Error: Call stack underflow" << std::endl;
+        NEXT();
+    }
+    NEED(1);
+    uint32_t return_value = sp[-1];
+    sp = frame->fp;
+    *sp++ = return_value;
+    const Instruction* returnIp = frame->returnIp;
+    frame--;
+    DISPATCH(returnIp);
+}
+
+HANDLER(op_seek) { NEED(1); frame->state->debug_num = sp[-1]; NEXT(); }
+HANDLER(op_print) {
+    if (sp > frame->fp) {
+        std::cout << (int)sp[-1] << std::endl;
+    } else {
+        std::cerr << "Stack is empty." << std::endl;
+    }
+    NEXT();
+}
+HANDLER(op_print_fp) {
+    if (sp > frame->fp) {
+        std::cout << to_float(sp[-1]) << std::endl;
+    } else {
+        std::cerr << "Stack is empty." << std::endl;
+    }
+    NEXT();
+}
+// Input is read out of line: a local whose address escapes would keep the
+// compiler from turning the handler's final call into a jump.
+static uint32_t read_int() {
+    int val;
+    std::cin >> val;
+    return val;
+}
+
+static uint32_t read_fp() {
+    float val;
+    std::cin >> val;
+    return from_float(val);
+}
+
+HANDLER(op_read_int) { write_mem32(mem, read_int(), ip->a); NEXT(); }
+HANDLER(op_read_fp) { write_mem32(mem, read_fp(), ip->a); NEXT(); }
+HANDLER(op_tik) { std::cout << "tik" << std::endl; NEXT(); }
+// Opcodes without a handler of their own run on the shared semantics. Traps
+// are caught out of line, where they can't keep the handler's final call
+// from being a jump.
+template <uint32_t Op>
+static uint32_t* shared(const Instruction* ip, uint32_t* sp, char* mem, Frame* frame) {
+    const uint32_t operand[] = {ip->a, ip->b, ip->c, ip->d};
+    try {
+        return SlotStack::execute<Op>(operand, frame->fp, sp, frame->stackLimit, mem, frame->state->debug_num);
+    } catch (const std::runtime_error& e) {
+        frame->state->trap = e.what();
+        return nullptr;
+    }
+}
+
+template <uint32_t Op>
+HANDLER(op_shared) {
+    sp = shared<Op>(ip, sp, mem, frame);
+    if (!sp) STOP(TRAP);
+    NEXT();
+}
+
+HANDLER(op_end) { STOP(OK); }
+HANDLER(op_illegal) { STOP(ILLEGAL_INSTRUCTION); }
+
+#undef FP_BINARY
+#undef BINARY
+#undef NEED
+#undef PUSH
+#undef STOP
+#undef JUMP
+#undef NEXT
+#undef DISPATCH
+#undef HANDLER
+
+} // namespace tailcall
+
+class TailCallVM : public Interface {
+    std::vector<tailcall::Instruction> instructions; // Pre-decoded program plus a halt entry
+    std::vector<uint32_t> stack; // Operand stack shared by all frames
+    std::vector<tailcall::Frame> frames;
+    tailcall::State state;
+    VMMemory memory;
+    char* buffer; // memory.data()
+
+    static constexpr size_t frameSlots = 1 << 14;
+
+    static tailcall::Handler handler(uint32_t opcode) {
+        using namespace tailcall;
+        static const Handler table[] = {
+            op_add, op_sub, op_mul, op_div, op_shl, op_shr,
+            op_fp_add, op_fp_sub, op_fp_mul, op_fp_div,
+            op_end, op_lod, op_sto, op_immi, op_inc, op_dec,
+            op_sto_immi, op_memcpy, op_memset,
+            op_jmp, op_jz, op_if_else, op_jump_if,
+            op_gt, op_lt, op_eq, op_gt_eq, op_lt_eq,
+            op_call, op_ret,
+            op_seek, op_print, op_read_int, op_print_fp, op_read_fp, op_tik,
+            op_illegal,
+            op_shared<DT_MEMCMP>, op_shared<DT_MEMCHR>, op_shared<DT_STRLEN>, op_shared<DT_MEMMOVE>,
+            op_shared<DT_VADD>, op_shared<DT_VMUL>, op_shared<DT_VFP_ADD>, op_shared<DT_VFP_MUL>, op_shared<DT_VDOT>,
+            op_shared<DT_LOD8>, op_shared<DT_LOD8S>, op_shared<DT_LOD16>, op_shared<DT_LOD16S>,
+            op_shared<DT_LOD64>, op_shared<DT_STO8>, op_shared<DT_STO16>, op_shared<DT_STO64>,
+            op_shared<DT_ADD64>, op_shared<DT_SUB64>, op_shared<DT_MUL64>, op_shared<DT_DIV64>,
+            op_shared<DT_SHL64>, op_shared<DT_SHR64>, op_shared<DT_GT64>, op_shared<DT_LT64>, op_shared<DT_EQ64>,
+            op_shared<DT_SEXT>, op_shared<DT_TRUNC>,
+            op_shared<DT_DP_ADD>, op_shared<DT_DP_SUB>, op_shared<DT_DP_MUL>, op_shared<DT_DP_DIV>,
+        };
+        return opcode < sizeof(table) / sizeof(table[0]) ? table[opcode] : op_illegal;
+    }
+
+    void load(std::span<const uint32_t> code) {
+        const InstructionBoundaries boundaries = decodeBoundaries(code);
+        const std::vector<uint32_t>& starts = boundaries.starts;
+
+        instructions.clear();
+        for (uint32_t i = 0; i < starts.size(); ++i) {
+            const uint32_t opcode = code[starts[i]];
+            const uint32_t* op = code.data() + starts[i] + 1;
+            // Jump operands become distances to the target instruction
+            auto distance = [&](uint32_t target) {
+                uint32_t index = boundaries.target(target);
+                return static_cast<uint32_t>(static_cast<int32_t>(index) - static_cast<int32_t>(i));
+            };
+            tailcall::Instruction ins = {handler(opcode), 0, 0, 0, 0};
+            uint32_t operands = operandCount(opcode);
+            if (operands > 0) ins.a = op[0];
+            if (operands > 1) ins.b = op[1];
+            if (operands > 2) ins.c = op[2];
+            if (operands > 3) ins.d = op[3];
+            switch (opcode) {
+                case DT_JMP:
+                case DT_JZ:
+                case DT_JUMP_IF:
+                case DT_CALL:
+                    ins.a = distance(op[0]);
+                    break;
+                case DT_IF_ELSE:
+                    ins.a = distance(op[0]);
+                    ins.b = distance(op[1]);
+                    break;
+            }
+            instructions.push_back(ins);
+        }
+        // Running off the end of the program behaves like DT_END.
+        instructions.push_back({tailcall::op_end, 0, 0, 0, 0});
+    }
+
+    void execute() {
+        state = {frames.data(), frames.data() + frames.size(), debug_num, tailcall::OK, {}};
+        frames[0] = {stack.data(), nullptr, stack.data() + stack.size(), &state};
+        const tailcall::Instruction* ip = instructions.data();
+        if (!memory.guarded([&] { ip->handler(ip, stack.data(), buffer, frames.data()); })) {
+            state.status = tailcall::MEMORY_FAULT;
+        }
+        debug_num = state.debug_num;
+        switch (state.status) {
+            case tailcall::STACK_OVERFLOW:
+                throw std::runtime_error("Operand stack overflow");
+            case tailcall::STACK_UNDERFLOW:
+                throw std::runtime_error("Operand stack underflow");
+            case tailcall::FRAME_OVERFLOW:
+                throw std::runtime_error("Call stack overflow");
+            case tailcall::ILLEGAL_INSTRUCTION:
+                throw std::runtime_error("Unknown instruction");
+            case tailcall::MEMORY_FAULT:
+                throw std::runtime_error("Memory access out of bounds");
+            case tailcall::DIVIDE_BY_ZERO:
+                throw std::runtime_error("Division by zero");
+            case tailcall::TRAP:
+                throw std::runtime_error(state.trap);
+        }
+    }
+
+public:
+    // Operand stack slots, shared by all frames
+    static constexpr size_t defaultDepth = 1 << 16;
+
+    uint32_t debug_num;
+    explicit TailCallVM(size_t stackDepth = defaultDepth, const VMMemory::Options& memoryOptions = VMMemory::Options()) : stack(stackDepth), frames(frameSlots), memory(memoryOptions), buffer(memory.data()) {
+        debug_num = 0xFFFFFFFF;
+    }
+
+
+    void run_vm(std::string filename, bool benchmarkMode) {
+        try {
+            MappedProgram program(filename);
+            load(program.code());
+            if (benchmarkMode) {
+                std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
+            }
+            execute();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    void run_vm(const std::vector<uint32_t>& code) {
+        try {
+            load(code);
+            execute();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    char* getBuffer() {
+        return buffer;
+    }
+};
+#endif // TAILCALLTHREADING_H
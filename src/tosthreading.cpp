@@ -0,0 +1,347 @@
+#ifndef TOSTHREADING_H
+#define TOSTHREADING_H
+#include <vector>
+#include <span>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include "symbol.hpp"
+#include "verifier.hpp"
+#include "slotstack.hpp"
+#include "readfile.hpp"
+#include "interface.hpp"
+#include "vmmemory.hpp"
+
+#if !defined(__GNUC__)
+#error "TosThreadingVM needs the labels-as-values extension (GCC or Clang)"
+#endif
+
+// Dynamic top-of-stack caching over a contiguous operand stack. The top one
+// or two stack items live in the locals r0/r1, which the compiler keeps in
+// registers, and the interpreter is always in one of three cache states:
+//
+//   state 0: nothing cached, the whole stack is in memory
+//   state 1: r0 is the top of stack
+//   state 2: r1 is the top of stack, r0 the item below it
+//
+// Every opcode has one handler per state and each handler knows the state it
+// leaves behind, so it dispatches through that state's table. Arithmetic,
+// comparisons, loads and branches never touch the memory stack in the common
+// states. Opcodes that need the whole stack (calls, printing, and the rarer
+// opcodes that run on the shared semantics) only have a state 0 handler; in
+// the other states they spill the cache first.
+class TosThreadingVM : public Interface {
+    struct Frame {
+        uint32_t* fp;           // Caller's frame base
+        const uint32_t* returnPc;
+    };
+
+    std::vector<uint32_t> stack; // Operand stack shared by all frames
+    std::vector<Frame> frames;
+    std::vector<uint32_t> thread; // Program with opcodes checked, plus a halt cell
+    VMMemory memory;
+    char* buffer; // memory.data()
+
+    static constexpr size_t frameSlots = 1 << 14;
+    static constexpr uint32_t op_illegal_index = DT_DP_DIV + 1;
+    static constexpr uint32_t op_halt_index = DT_DP_DIV + 2;
+
+    inline float to_float(uint32_t val) {
+        float f;
+        memcpy(&f, &val, 4);
+        return f;
+    }
+
+    inline uint32_t from_float(float val) {
+        uint32_t u;
+        memcpy(&u, &val, 4);
+        return u;
+    }
+
+    inline void write_mem32(char* buffer, uint32_t val, uint32_t offset) {
+        memcpy(buffer + offset, &val, 4);
+    }
+
+    inline uint32_t read_mem32(char* buffer, uint32_t offset) {
+        uint32_t val;
+        memcpy(&val, buffer + offset, 4);
+        return val;
+    }
+
+    // Copies the program into the thread. Opcodes without a handler become
+    // op_illegal_index and a halt cell is appended, so every instruction
+    // boundary indexes the dispatch tables safely; jumps may only land on one,
+    // and targets past the end land on the halt cell.
+    void load(std::span<const uint32_t> code) {
+        const InstructionBoundaries boundaries = decodeBoundaries(code);
+        thread.assign(code.begin(), code.end());
+        thread.push_back(op_halt_index);
+        for (uint32_t start : boundaries.starts) {
+            if (code[start] == DT_SYSCALL || code[start] > DT_DP_DIV) {
+                thread[start] = op_illegal_index;
+            }
+            uint32_t mask = jumpOperandMask(code[start]);
+            for (uint32_t k = 0; mask; ++k, mask >>= 1) {
+                if (mask & 1) {
+                    uint32_t target = code[start + 1 + k];
+                    boundaries.target(target);
+                    thread[start + 1 + k] = std::min<size_t>(target, code.size());
+                }
+            }
+        }
+    }
+
+    void execute() {
+#define STATE_TABLE(s)                                                                     \
+        &&s##_add, &&s##_sub, &&s##_mul, &&s##_div, &&s##_shl, &&s##_shr,                  \
+        &&s##_fp_add, &&s##_fp_sub, &&s##_fp_mul, &&s##_fp_div,                            \
+        &&op_end, &&s##_lod, &&s##_sto, &&s##_immi, &&s##_inc, &&s##_dec,                  \
+        &&s##_sto_immi, &&s##_memcpy, &&s##_memset,                                        \
+        &&s##_jmp, &&s##_jz, &&s##_if_else, &&s##_jump_if,                                 \
+        &&s##_gt, &&s##_lt, &&s##_eq, &&s##_gt_eq, &&s##_lt_eq,                            \
+        &&s##_call, &&s##_ret,                                                             \
+        &&s##_seek, &&s##_print, &&s##_read_int, &&s##_print_fp, &&s##_read_fp, &&s##_tik, \
+        &&op_illegal, /* DT_SYSCALL */                                                     \
+        &&s##_shared, &&s##_shared, &&s##_shared, &&s##_shared,                            \
+        &&s##_shared, &&s##_shared, &&s##_shared, &&s##_shared, &&s##_shared,              \
+        &&s##_shared, &&s##_shared, &&s##_shared, &&s##_shared,                            \
+        &&s##_shared, &&s##_shared, &&s##_shared, &&s##_shared,                            \
+        &&s##_shared, &&s##_shared, &&s##_shared, &&s##_shared,                            \
+        &&s##_shared, &&s##_shared, &&s##_shared, &&s##_shared,                            \
+        &&s##_shared, &&s##_shared, &&s##_shared, &&s##_shared,                            \
+        &&s##_shared, &&s##_shared, &&s##_shared,                                          \
+        &&op_illegal, &&op_halt
+        static void* const s0[] = { STATE_TABLE(s0) };
+        static void* const s1[] = { STATE_TABLE(s1) };
+        static void* const s2[] = { STATE_TABLE(s2) };
+#undef STATE_TABLE
+        static_assert(sizeof(s0) / sizeof(s0[0]) == op_halt_index + 1);
+
+        const uint32_t* const base = thread.data();
+        const uint32_t* pc = base;
+        uint32_t* const stackLimit = stack.data() + stack.size();
+        Frame* const frameLimit = frames.data() + frames.size();
+        Frame* frameTop = frames.data();
+        uint32_t* fp = stack.data();
+        uint32_t* sp = stack.data();
+        uint32_t r0 = 0;
+        uint32_t r1 = 0;
+
+#define NEXT0(n) do { pc += (n); goto *s0[*pc]; } while (0)
+#define NEXT1(n) do { pc += (n); goto *s1[*pc]; } while (0)
+#define NEXT2(n) do { pc += (n); goto *s2[*pc]; } while (0)
+#define JUMP0(target) do { pc = base + (target); goto *s0[*pc]; } while (0)
+#define JUMP1(target) do { pc = base + (target); goto *s1[*pc]; } while (0)
+#define JUMP2(target) do { pc = base + (target); goto *s2[*pc]; } while (0)
+#define PUSH(value) do { if (sp == stackLimit) goto overflow; *sp++ = (value); } while (0)
+#define POP(var) do { if (sp == fp) goto underflow; var = *--sp; } while (0)
+
+// b OP a, where a is the top of stack; the result is left cached in r0.
+#define BINARY(name, expr)                                                          \
+    s2_##name: { uint32_t a = r1; uint32_t b = r0; r0 = (expr); NEXT1(1); }         \
+    s1_##name: { uint32_t a = r0; uint32_t b; POP(b); r0 = (expr); NEXT1(1); }      \
+    s0_##name: { uint32_t a; POP(a); uint32_t b; POP(b); r0 = (expr); NEXT1(1); }
+
+#define FP_BINARY(name, expr) \
+    BINARY(name, from_float([](float a, float b) { return expr; }(to_float(a), to_float(b))))
+
+// A zero divisor traps once both operands are off the stack.
+#define DIVISION(name)                                                          \
+    s2_##name: { uint32_t a = r1; uint32_t b = r0; DIVIDE() }                   \
+    s1_##name: { uint32_t a = r0; uint32_t b; POP(b); DIVIDE() }                \
+    s0_##name: { uint32_t a; POP(a); uint32_t b; POP(b); DIVIDE() }
+#define DIVIDE() if (a == 0) goto divide_by_zero; r0 = b / a; NEXT1(1);
+
+#define PUSHER(name, value)                                     \
+    s0_##name: { r0 = (value); NEXT1(2); }                      \
+    s1_##name: { r1 = (value); NEXT2(2); }                      \
+    s2_##name: { PUSH(r0); r0 = r1; r1 = (value); NEXT2(2); }
+
+// Stack-neutral instructions behave the same in every state.
+#define NEUTRAL(name, n, body)          \
+    s0_##name: { body; NEXT0(n); }      \
+    s1_##name: { body; NEXT1(n); }      \
+    s2_##name: { body; NEXT2(n); }
+
+// Needs the whole stack in memory: spill the cache and retry in state 0.
+#define SPILLING(name)                                  \
+    s1_##name: { PUSH(r0); goto *s0[*pc]; }             \
+    s2_##name: { PUSH(r0); PUSH(r1); goto *s0[*pc]; }
+
+        goto *s0[*pc];
+
+    BINARY(add, a + b)
+    BINARY(sub, b - a)
+    BINARY(mul, a * b)
+    BINARY(shl, b << a)
+    BINARY(shr, b >> a)
+    BINARY(gt, b > a ? 1 : 0)
+    BINARY(lt, b < a ? 1 : 0)
+    BINARY(eq, b == a ? 1 : 0)
+    BINARY(gt_eq, b >= a ? 1 : 0)
+    BINARY(lt_eq, b <= a ? 1 : 0)
+    FP_BINARY(fp_add, a + b)
+    FP_BINARY(fp_sub, b - a)
+    FP_BINARY(fp_mul, a * b)
+    FP_BINARY(fp_div, b / a)
+    DIVISION(div)
+
+    PUSHER(lod, read_mem32(buffer, pc[1]))
+    PUSHER(immi, pc[1])
+
+    s2_sto: { write_mem32(buffer, r1, pc[1]); NEXT1(2); }
+    s1_sto: { write_mem32(buffer, r0, pc[1]); NEXT0(2); }
+    s0_sto: { uint32_t a; POP(a); write_mem32(buffer, a, pc[1]); NEXT0(2); }
+
+    s2_inc: { r1 += 1; NEXT2(1); }
+    s1_inc: { r0 += 1; NEXT1(1); }
+    s0_inc: { POP(r0); r0 += 1; NEXT1(1); }
+    s2_dec: { r1 -= 1; NEXT2(1); }
+    s1_dec: { r0 -= 1; NEXT1(1); }
+    s0_dec: { POP(r0); r0 -= 1; NEXT1(1); }
+
+    NEUTRAL(sto_immi, 3, write_mem32(buffer, pc[2], pc[1]))
+    NEUTRAL(memcpy, 4, memcpy(buffer + pc[1], buffer + pc[2], pc[3]))
+    NEUTRAL(memset, 4, memset(buffer + pc[1], pc[2], pc[3]))
+    NEUTRAL(read_int, 2, int val; std::cin >> val; write_mem32(buffer, val, pc[1]))
+    NEUTRAL(read_fp, 2, float val; std::cin >> val; write_mem32(buffer, from_float(val), pc[1]))
+    NEUTRAL(tik, 1, std::cout << "tik" << std::endl)
+
+    s0_jmp: { JUMP0(pc[1]); }
+    s1_jmp: { JUMP1(pc[1]); }
+    s2_jmp: { JUMP2(pc[1]); }
+
+    s2_jz: { if (r1 == 0) JUMP1(pc[1]); NEXT1(2); }
+    s1_jz: { if (r0 == 0) JUMP0(pc[1]); NEXT0(2); }
+    s0_jz: { uint32_t condition; POP(condition); if (condition == 0) JUMP0(pc[1]); NEXT0(2); }
+    s2_jump_if: { if (r1) JUMP1(pc[1]); NEXT1(2); }
+    s1_jump_if: { if (r0) JUMP0(pc[1]); NEXT0(2); }
+    s0_jump_if: { uint32_t condition; POP(condition); if (condition) JUMP0(pc[1]); NEXT0(2); }
+    s2_if_else: { JUMP1(r1 ? pc[1] : pc[2]); }
+    s1_if_else: { JUMP0(r0 ? pc[1] : pc[2]); }
+    s0_if_else: { uint32_t condition; POP(condition); JUMP0(condition ? pc[1] : pc[2]); }
+
+    s2_seek: { debug_num = r1; NEXT2(1); }
+    s1_seek: { debug_num = r0; NEXT1(1); }
+    s0_seek: { if (sp == fp) goto underflow; debug_num = sp[-1]; NEXT0(1); }
+
+    SPILLING(call)
+    s0_call: {
+        uint32_t num_params = pc[2];
+        if (static_cast<size_t>(sp - fp) < num_params) goto underflow;
+        if (frameTop == frameLimit) throw std::runtime_error("Call stack overflow");
+        *frameTop++ = {fp, pc + 3};
+        fp = sp - num_params;
+        for (uint32_t* i = fp, *j = sp - 1; i < j; ++i, --j) {
+            uint32_t t = *i; *i = *j; *j = t;
+        }
+        JUMP0(pc[1]);
+    }
+    SPILLING(ret)
+    s0_ret: {
+        if (frameTop == frames.data()) {
+            std::cerr << "Error: Call stack underflow" << std::endl;
+            NEXT0(1);
+        }
+        POP(r0);
+        sp = fp;
+        --frameTop;
+        fp = frameTop->fp;
+        pc = frameTop->returnPc;
+        goto *s1[*pc];
+    }
+
+    SPILLING(print)
+    s0_print: {
+        if (sp > fp) {
+            std::cout << (int)sp[-1] << std::endl;
+        } else {
+            std::cerr << "Stack is empty." << std::endl;
+        }
+        NEXT0(1);
+    }
+    SPILLING(print_fp)
+    s0_print_fp: {
+        if (sp > fp) {
+            std::cout << to_float(sp[-1]) << std::endl;
+        } else {
+            std::cerr << "Stack is empty." << std::endl;
+        }
+        NEXT0(1);
+    }
+
+    // Bulk memory, vector, width-typed and 64-bit opcodes run on the shared
+    // semantics.
+    SPILLING(shared)
+    s0_shared: {
+        sp = SlotStack::execute(*pc, pc + 1, fp, sp, stackLimit, buffer, debug_num);
+        NEXT0(operandCount(*pc) + 1);
+    }
+
+    op_illegal:
+        throw std::runtime_error("Unknown instruction");
+    overflow:
+        throw std::runtime_error("Operand stack overflow");
+    underflow:
+        throw std::runtime_error("Operand stack underflow");
+    divide_by_zero:
+        throw std::runtime_error("Division by zero");
+    op_end:
+    op_halt:
+        return;
+#undef SPILLING
+#undef NEUTRAL
+#undef PUSHER
+#undef DIVIDE
+#undef DIVISION
+#undef FP_BINARY
+#undef BINARY
+#undef POP
+#undef PUSH
+#undef JUMP2
+#undef JUMP1
+#undef JUMP0
+#undef NEXT2
+#undef NEXT1
+#undef NEXT0
+    }
+
+public:
+    // Operand stack slots, shared by all frames
+    static constexpr size_t defaultDepth = 1 << 16;
+
+    uint32_t debug_num;
+    explicit TosThreadingVM(size_t stackDepth = defaultDepth, const VMMemory::Options& memoryOptions = VMMemory::Options()) : stack(stackDepth), frames(frameSlots), memory(memoryOptions), buffer(memory.data()) {
+        debug_num = 0xFFFFFFFF;
+    }
+
+
+    void run_vm(std::string filename, bool benchmarkMode) {
+        try {
+            MappedProgram program(filename);
+            load(program.code());
+            if (benchmarkMode) {
+                std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
+            }
+            memory.trapFaults([&] { execute(); });
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    void run_vm(const std::vector<uint32_t>& code) {
+        try {
+            load(code);
+            memory.trapFaults([&] { execute(); });
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    char* getBuffer() {
+        return buffer;
+    }
+};
+#endif // TOSTHREADING_H
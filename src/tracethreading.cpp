@@ -0,0 +1,630 @@
+#ifndef TRACETHREADING_H
+#define TRACETHREADING_H
+#include <vector>
+#include <span>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "symbol.hpp"
+#include "verifier.hpp"
+#include "readfile.hpp"
+#include "interface.hpp"
+#include "vmmemory.hpp"
+#include "semantics.hpp"
+#include "registercode.hpp"
+
+#if !defined(__GNUC__)
+#error "TraceVM needs the labels-as-values extension (GCC or Clang)"
+#endif
+
+// Tracing tier on top of a pre-decoded interpreter. Backward jumps count how
+// often their target is reached. Once a target is hot, the interpreter
+// records the instructions of the next loop iteration, and that linear trace
+// is compiled into specialised trace ops:
+//   - unconditional jumps disappear;
+//   - conditional branches become guards that side-exit back to the
+//     interpreter when execution leaves the recorded path;
+//   - constants are folded into the operations that use them.
+class TraceVM : public Interface {
+public:
+    struct Stats {
+        uint64_t tracesFormed = 0;
+        uint64_t tracesAborted = 0;
+        uint64_t traceEntries = 0;
+        uint64_t sideExits = 0;
+        double traceSeconds = 0;
+        double totalSeconds = 0;
+    };
+
+private:
+    friend struct OpcodeSemantics<TraceVM>;
+    typedef OpcodeSemantics<TraceVM> Semantics;
+
+    // Pre-decoded instruction; jump operands are instruction indices.
+    struct Decoded {
+        uint32_t op;
+        uint32_t operand[4];
+    };
+
+    struct Frame {
+        uint32_t* fp;
+        uint32_t returnIp;
+    };
+
+    enum TraceKind : uint32_t {
+        T_IMMI, T_LOD, T_STO, T_STO_IMMI, T_MEMCPY, T_MEMSET, T_MEM_INC,
+        T_ADD, T_SUB, T_MUL, T_DIV, T_SHL, T_SHR,
+        T_FP_ADD, T_FP_SUB, T_FP_MUL, T_FP_DIV, T_INC, T_DEC,
+        T_GT, T_LT, T_EQ, T_GT_EQ, T_LT_EQ,
+        T_ADD_IMM, T_SUB_IMM, T_MUL_IMM,
+        T_GT_IMM, T_LT_IMM, T_EQ_IMM, T_GT_EQ_IMM, T_LT_EQ_IMM,
+        T_POP, T_GUARD,
+        T_GUARD_GT, T_GUARD_LT, T_GUARD_EQ, T_GUARD_GT_EQ, T_GUARD_LT_EQ,
+        T_GUARD_GT_IMM, T_GUARD_LT_IMM, T_GUARD_EQ_IMM, T_GUARD_GT_EQ_IMM, T_GUARD_LT_EQ_IMM,
+        T_SEEK, T_PRINT, T_FP_PRINT, T_READ_INT, T_FP_READ, T_TIK,
+        T_LOOP,
+        T_KIND_COUNT
+    };
+
+    // a/b are operands or immediates; guards continue only when the condition
+    // equals b and otherwise leave the trace at `exit`.
+    struct TraceOp {
+        uint32_t kind;
+        uint32_t a, b;
+        uint32_t exit;
+    };
+
+    struct Trace {
+        std::vector<TraceOp> ops;
+        uint32_t anchor;
+        uint32_t need; // Stack items one iteration reads from below its start
+        uint32_t grow; // Highest the stack rises above its start during one iteration
+    };
+
+    static constexpr size_t frameSlots = 1 << 14;
+    static constexpr uint32_t hotThreshold = 64;     // Backward jumps before recording starts
+    static constexpr uint32_t maxTraceLength = 512;  // Recorded instructions before giving up
+    static constexpr uint8_t maxAborts = 4;          // Failed recordings before a target is left alone
+
+    std::vector<Decoded> program; // Pre-decoded program plus a halt entry
+    std::vector<uint32_t> stack;
+    std::vector<Frame> frames;
+    std::vector<Trace> traces;
+    std::vector<int32_t> traceAt;   // Trace anchored at each instruction, or -1
+    std::vector<uint32_t> counters; // Backward jumps seen per target
+    std::vector<uint8_t> aborts;
+    std::vector<uint32_t> recorded; // Instruction indices of the trace being recorded
+    bool recording;
+    uint32_t anchor;
+    uint32_t* sp;
+    Frame* frameTop;
+    uint32_t ip;
+    uint32_t next;
+    bool halted;
+    bool statsEnabled;
+    Stats stats;
+    VMMemory memory;
+    char* buffer; // memory.data()
+
+    // Stack and control-flow policy for semantics.hpp
+    void push(uint32_t value) {
+        if (sp == stack.data() + stack.size()) {
+            throw std::runtime_error("Operand stack overflow");
+        }
+        *sp++ = value;
+    }
+
+    uint32_t pop() {
+        if (sp == frameTop->fp) {
+            throw std::runtime_error("Operand stack underflow");
+        }
+        return *--sp;
+    }
+
+    uint32_t top() {
+        if (sp == frameTop->fp) {
+            throw std::runtime_error("Operand stack underflow");
+        }
+        return sp[-1];
+    }
+
+    bool empty() {
+        return sp == frameTop->fp;
+    }
+
+    void jump(uint32_t target) {
+        next = target;
+    }
+
+    void call(uint32_t target, uint32_t num_params) {
+        if (frameTop + 1 == frames.data() + frames.size()) {
+            throw std::runtime_error("Call stack overflow");
+        }
+        uint32_t* base = sp - num_params;
+        if (sp - frameTop->fp < static_cast<ptrdiff_t>(num_params)) {
+            throw std::runtime_error("Operand stack underflow");
+        }
+        for (uint32_t* i = base, *j = sp - 1; i < j; ++i, --j) {
+            uint32_t t = *i; *i = *j; *j = t;
+        }
+        *++frameTop = {base, ip + 1};
+        next = target;
+    }
+
+    void ret() {
+        if (frameTop == frames.data()) {
+            std::cerr << "Error: Call stack underflow" << std::endl;
+            return;
+        }
+        uint32_t return_value = top();
+        sp = frameTop->fp;
+        *sp++ = return_value;
+        next = frameTop->returnIp;
+        --frameTop;
+    }
+
+    void end() {
+        halted = true;
+    }
+
+    void load(std::span<const uint32_t> code) {
+        const InstructionBoundaries boundaries = decodeBoundaries(code);
+
+        program.clear();
+        for (uint32_t start : boundaries.starts) {
+            Decoded ins = {code[start], {0, 0, 0}};
+            uint32_t mask = jumpOperandMask(ins.op);
+            for (uint32_t k = 0; k < operandCount(ins.op); ++k, mask >>= 1) {
+                uint32_t value = code[start + 1 + k];
+                if (mask & 1) {
+                    value = boundaries.target(value);
+                }
+                ins.operand[k] = value;
+            }
+            program.push_back(ins);
+        }
+        // Running off the end of the program behaves like DT_END.
+        program.push_back({DT_END, {0, 0, 0}});
+
+        traces.clear();
+        traceAt.assign(program.size(), -1);
+        counters.assign(program.size(), 0);
+        aborts.assign(program.size(), 0);
+        recording = false;
+    }
+
+    static bool isLoopBranch(uint32_t op) {
+        return op == DT_JMP || op == DT_JZ || op == DT_JUMP_IF || op == DT_IF_ELSE;
+    }
+
+    // Called after a jump from `ip` back to `target`.
+    void backwardJump(uint32_t target) {
+        if (traceAt[target] >= 0) {
+            next = enterTrace(traces[traceAt[target]]);
+            return;
+        }
+        if (recording || aborts[target] >= maxAborts) {
+            return;
+        }
+        if (++counters[target] >= hotThreshold) {
+            recording = true;
+            anchor = target;
+            recorded.clear();
+        }
+    }
+
+    void abortRecording() {
+        recording = false;
+        counters[anchor] = 0;
+        ++aborts[anchor];
+        ++stats.tracesAborted;
+    }
+
+    // Recording stops at calls, returns and anything that leaves the loop
+    // for good, and when the path runs into another trace.
+    bool recordable(uint32_t at, uint32_t op) const {
+        if (recorded.size() >= maxTraceLength || (at != anchor && traceAt[at] >= 0)) {
+            return false;
+        }
+        return op <= DT_Tik && op != DT_END && op != DT_CALL && op != DT_RET;
+    }
+
+    static uint32_t immediateKind(uint32_t kind) {
+        switch (kind) {
+            case T_ADD: return T_ADD_IMM;
+            case T_SUB: return T_SUB_IMM;
+            case T_MUL: return T_MUL_IMM;
+            case T_GT: return T_GT_IMM;
+            case T_LT: return T_LT_IMM;
+            case T_EQ: return T_EQ_IMM;
+            case T_GT_EQ: return T_GT_EQ_IMM;
+            case T_LT_EQ: return T_LT_EQ_IMM;
+        }
+        return T_KIND_COUNT;
+    }
+
+    static uint32_t guardKind(uint32_t kind) {
+        switch (kind) {
+            case T_GT: return T_GUARD_GT;
+            case T_LT: return T_GUARD_LT;
+            case T_EQ: return T_GUARD_EQ;
+            case T_GT_EQ: return T_GUARD_GT_EQ;
+            case T_LT_EQ: return T_GUARD_LT_EQ;
+            case T_GT_IMM: return T_GUARD_GT_IMM;
+            case T_LT_IMM: return T_GUARD_LT_IMM;
+            case T_EQ_IMM: return T_GUARD_EQ_IMM;
+            case T_GT_EQ_IMM: return T_GUARD_GT_EQ_IMM;
+            case T_LT_EQ_IMM: return T_GUARD_LT_EQ_IMM;
+        }
+        return T_KIND_COUNT;
+    }
+
+    static uint32_t traceKind(uint32_t op) {
+        switch (op) {
+            case DT_IMMI: return T_IMMI;
+            case DT_LOD: return T_LOD;
+            case DT_STO: return T_STO;
+            case DT_STO_IMMI: return T_STO_IMMI;
+            case DT_MEMCPY: return T_MEMCPY;
+            case DT_MEMSET: return T_MEMSET;
+            case DT_ADD: return T_ADD;
+            case DT_SUB: return T_SUB;
+            case DT_MUL: return T_MUL;
+            case DT_DIV: return T_DIV;
+            case DT_SHL: return T_SHL;
+            case DT_SHR: return T_SHR;
+            case DT_FP_ADD: return T_FP_ADD;
+            case DT_FP_SUB: return T_FP_SUB;
+            case DT_FP_MUL: return T_FP_MUL;
+            case DT_FP_DIV: return T_FP_DIV;
+            case DT_INC: return T_INC;
+            case DT_DEC: return T_DEC;
+            case DT_GT: return T_GT;
+            case DT_LT: return T_LT;
+            case DT_EQ: return T_EQ;
+            case DT_GT_EQ: return T_GT_EQ;
+            case DT_LT_EQ: return T_LT_EQ;
+            case DT_SEEK: return T_SEEK;
+            case DT_PRINT: return T_PRINT;
+            case DT_FP_PRINT: return T_FP_PRINT;
+            case DT_READ_INT: return T_READ_INT;
+            case DT_FP_READ: return T_FP_READ;
+            case DT_Tik: return T_TIK;
+        }
+        return T_KIND_COUNT;
+    }
+
+    // Turns the recorded path into trace ops. Each branch is replaced by a
+    // guard on the direction it took while recording.
+    void compileTrace() {
+        Trace trace;
+        trace.anchor = anchor;
+        std::vector<TraceOp>& out = trace.ops;
+        int32_t depth = 0, lowest = 0, highest = 0;
+
+        auto emitGuard = [&](bool expected, uint32_t exit) {
+            uint32_t fused = out.empty() ? T_KIND_COUNT : guardKind(out.back().kind);
+            if (fused != T_KIND_COUNT) {
+                out.back() = {fused, out.back().a, expected, exit};
+            } else {
+                out.push_back({T_GUARD, 0, expected, exit});
+            }
+        };
+
+        for (size_t k = 0; k < recorded.size(); ++k) {
+            const uint32_t at = recorded[k];
+            const Decoded& ins = program[at];
+            const uint32_t after = k + 1 < recorded.size() ? recorded[k + 1] : anchor;
+            uint32_t pops, pushes;
+            registercode::stackEffect(ins.op, pops, pushes);
+            depth -= pops;
+            lowest = std::min(lowest, depth);
+            depth += pushes;
+            highest = std::max(highest, depth);
+
+            switch (ins.op) {
+                case DT_JMP:
+                    continue;
+                case DT_JZ:
+                case DT_JUMP_IF:
+                case DT_IF_ELSE: {
+                    // Where control goes when the popped condition is non-zero / zero
+                    uint32_t whenTrue = ins.op == DT_IF_ELSE ? ins.operand[0] : ins.op == DT_JUMP_IF ? ins.operand[0] : at + 1;
+                    uint32_t whenFalse = ins.op == DT_IF_ELSE ? ins.operand[1] : ins.op == DT_JUMP_IF ? at + 1 : ins.operand[0];
+                    if (whenTrue == whenFalse) {
+                        out.push_back({T_POP, 0, 0, 0});
+                    } else if (after == whenTrue) {
+                        emitGuard(true, whenFalse);
+                    } else {
+                        emitGuard(false, whenTrue);
+                    }
+                    continue;
+                }
+            }
+
+            uint32_t kind = traceKind(ins.op);
+            TraceOp op = {kind, ins.operand[0], ins.operand[1], at};
+            if (kind == T_MEMCPY || kind == T_MEMSET) {
+                op.exit = ins.operand[2];
+            }
+            uint32_t withImmediate = immediateKind(kind);
+            if (withImmediate != T_KIND_COUNT && !out.empty() && out.back().kind == T_IMMI) {
+                out.back() = {withImmediate, out.back().a, 0, 0};
+                continue;
+            }
+            if (kind == T_STO && out.size() >= 2 && out.back().kind == T_INC && out[out.size() - 2].kind == T_LOD) {
+                uint32_t source = out[out.size() - 2].a;
+                out.pop_back();
+                out.back() = {T_MEM_INC, source, ins.operand[0], 0};
+                continue;
+            }
+            out.push_back(op);
+        }
+        out.push_back({T_LOOP, 0, 0, 0});
+        trace.need = static_cast<uint32_t>(-lowest);
+        trace.grow = static_cast<uint32_t>(highest);
+
+        traceAt[anchor] = traces.size();
+        traces.push_back(std::move(trace));
+        recording = false;
+        ++stats.tracesFormed;
+    }
+
+    uint32_t enterTrace(const Trace& trace) {
+        ++stats.traceEntries;
+        if (!statsEnabled) {
+            return runTrace(trace);
+        }
+        auto start = std::chrono::steady_clock::now();
+        uint32_t exit = runTrace(trace);
+        stats.traceSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return exit;
+    }
+
+    // Runs `trace` until a guard fails; returns the instruction to resume
+    // interpreting at. Every iteration first checks that the stack has room,
+    // so the ops themselves need no bounds checks.
+    uint32_t runTrace(const Trace& trace) {
+        static void* const labels[] = {
+            &&t_immi, &&t_lod, &&t_sto, &&t_sto_immi, &&t_memcpy, &&t_memset, &&t_mem_inc,
+            &&t_add, &&t_sub, &&t_mul, &&t_div, &&t_shl, &&t_shr,
+            &&t_fp_add, &&t_fp_sub, &&t_fp_mul, &&t_fp_div, &&t_inc, &&t_dec,
+            &&t_gt, &&t_lt, &&t_eq, &&t_gt_eq, &&t_lt_eq,
+            &&t_add_imm, &&t_sub_imm, &&t_mul_imm,
+            &&t_gt_imm, &&t_lt_imm, &&t_eq_imm, &&t_gt_eq_imm, &&t_lt_eq_imm,
+            &&t_pop, &&t_guard,
+            &&t_guard_gt, &&t_guard_lt, &&t_guard_eq, &&t_guard_gt_eq, &&t_guard_lt_eq,
+            &&t_guard_gt_imm, &&t_guard_lt_imm, &&t_guard_eq_imm, &&t_guard_gt_eq_imm, &&t_guard_lt_eq_imm,
+            &&t_seek, &&t_print, &&t_fp_print, &&t_read_int, &&t_fp_read, &&t_tik,
+            &&t_loop,
+        };
+        static_assert(sizeof(labels) / sizeof(labels[0]) == T_KIND_COUNT);
+
+        const TraceOp* const first = trace.ops.data();
+        const TraceOp* t = first;
+        uint32_t* s = sp;
+        uint32_t* const base = frameTop->fp; // Traces never leave the frame they start in
+        uint32_t* const limit = stack.data() + stack.size();
+        uint32_t exit;
+
+#define DISPATCH() goto *labels[t->kind]
+#define NEXT() do { ++t; DISPATCH(); } while (0)
+#define SIDE_EXIT(target) do { exit = (target); ++stats.sideExits; goto leave; } while (0)
+#define BINARY(name, expr) \
+    name: { uint32_t a = s[-1]; uint32_t b = s[-2]; --s; s[-1] = (expr); NEXT(); }
+#define FP_BINARY(name, expr) \
+    name: { float a = Semantics::to_float(s[-1]); float b = Semantics::to_float(s[-2]); --s; s[-1] = Semantics::from_float(expr); NEXT(); }
+#define IMMEDIATE(name, expr) \
+    name: { uint32_t a = t->a; uint32_t b = s[-1]; s[-1] = (expr); NEXT(); }
+#define GUARD(name, cond) \
+    name: { uint32_t a = s[-1]; uint32_t b = s[-2]; s -= 2; if ((cond) != (t->b != 0)) SIDE_EXIT(t->exit); NEXT(); }
+#define GUARD_IMMEDIATE(name, cond) \
+    name: { uint32_t a = t->a; uint32_t b = *--s; if ((cond) != (t->b != 0)) SIDE_EXIT(t->exit); NEXT(); }
+
+    t_loop:
+        t = first;
+        if (s - base < static_cast<ptrdiff_t>(trace.need) || limit - s < static_cast<ptrdiff_t>(trace.grow)) {
+            exit = trace.anchor; // Let the interpreter run (and report) this iteration
+            goto leave;
+        }
+        DISPATCH();
+
+    t_immi: { *s++ = t->a; NEXT(); }
+    t_lod: { *s++ = Semantics::read_mem32(buffer, t->a); NEXT(); }
+    t_sto: { Semantics::write_mem32(buffer, *--s, t->a); NEXT(); }
+    t_sto_immi: { Semantics::write_mem32(buffer, t->b, t->a); NEXT(); }
+    t_memcpy: { memcpy(buffer + t->a, buffer + t->b, t->exit); NEXT(); }
+    t_memset: { memset(buffer + t->a, t->b, t->exit); NEXT(); }
+    t_mem_inc: { Semantics::write_mem32(buffer, Semantics::read_mem32(buffer, t->a) + 1, t->b); NEXT(); }
+
+    BINARY(t_add, b + a)
+    BINARY(t_sub, b - a)
+    BINARY(t_mul, b * a)
+    BINARY(t_shl, b << a)
+    BINARY(t_shr, b >> a)
+    BINARY(t_gt, b > a ? 1 : 0)
+    BINARY(t_lt, b < a ? 1 : 0)
+    BINARY(t_eq, b == a ? 1 : 0)
+    BINARY(t_gt_eq, b >= a ? 1 : 0)
+    BINARY(t_lt_eq, b <= a ? 1 : 0)
+    FP_BINARY(t_fp_add, b + a)
+    FP_BINARY(t_fp_sub, b - a)
+    FP_BINARY(t_fp_mul, b * a)
+    FP_BINARY(t_fp_div, b / a)
+
+    // A zero divisor leaves the trace before the division, so the
+    // interpreter traps exactly as it would without the trace.
+    t_div: {
+        if (s[-1] == 0) SIDE_EXIT(t->exit);
+        uint32_t a = s[-1]; uint32_t b = s[-2]; --s; s[-1] = b / a;
+        NEXT();
+    }
+    t_inc: { s[-1] += 1; NEXT(); }
+    t_dec: { s[-1] -= 1; NEXT(); }
+
+    IMMEDIATE(t_add_imm, b + a)
+    IMMEDIATE(t_sub_imm, b - a)
+    IMMEDIATE(t_mul_imm, b * a)
+    IMMEDIATE(t_gt_imm, b > a ? 1 : 0)
+    IMMEDIATE(t_lt_imm, b < a ? 1 : 0)
+    IMMEDIATE(t_eq_imm, b == a ? 1 : 0)
+    IMMEDIATE(t_gt_eq_imm, b >= a ? 1 : 0)
+    IMMEDIATE(t_lt_eq_imm, b <= a ? 1 : 0)
+
+    t_pop: { --s; NEXT(); }
+    t_guard: { if ((*--s != 0) != (t->b != 0)) SIDE_EXIT(t->exit); NEXT(); }
+    GUARD(t_guard_gt, b > a)
+    GUARD(t_guard_lt, b < a)
+    GUARD(t_guard_eq, b == a)
+    GUARD(t_guard_gt_eq, b >= a)
+    GUARD(t_guard_lt_eq, b <= a)
+    GUARD_IMMEDIATE(t_guard_gt_imm, b > a)
+    GUARD_IMMEDIATE(t_guard_lt_imm, b < a)
+    GUARD_IMMEDIATE(t_guard_eq_imm, b == a)
+    GUARD_IMMEDIATE(t_guard_gt_eq_imm, b >= a)
+    GUARD_IMMEDIATE(t_guard_lt_eq_imm, b <= a)
+
+    t_seek: { debug_num = s[-1]; NEXT(); }
+    t_print: {
+        if (s != frameTop->fp) {
+            std::cout << (int)s[-1] << std::endl;
+        } else {
+            std::cerr << "Stack is empty." << std::endl;
+        }
+        NEXT();
+    }
+    t_fp_print: {
+        if (s != frameTop->fp) {
+            std::cout << Semantics::to_float(s[-1]) << std::endl;
+        } else {
+            std::cerr << "Stack is empty." << std::endl;
+        }
+        NEXT();
+    }
+    t_read_int: {
+        int val;
+        std::cin >> val;
+        Semantics::write_mem32(buffer, val, t->a);
+        NEXT();
+    }
+    t_fp_read: {
+        float val;
+        std::cin >> val;
+        Semantics::write_mem32(buffer, Semantics::from_float(val), t->a);
+        NEXT();
+    }
+    t_tik: { std::cout << "tik" << std::endl; NEXT(); }
+
+    leave:
+        sp = s;
+        return exit;
+#undef GUARD_IMMEDIATE
+#undef GUARD
+#undef IMMEDIATE
+#undef FP_BINARY
+#undef BINARY
+#undef SIDE_EXIT
+#undef NEXT
+#undef DISPATCH
+    }
+
+    void execute() {
+        auto start = std::chrono::steady_clock::now();
+        sp = stack.data();
+        frameTop = frames.data();
+        *frameTop = {stack.data(), 0};
+        halted = false;
+        ip = 0;
+        while (!halted) {
+            const Decoded& ins = program[ip];
+            if (recording && !recordable(ip, ins.op)) {
+                abortRecording();
+            }
+            if (recording) {
+                recorded.push_back(ip);
+            }
+            next = ip + 1;
+            Semantics::dispatch(*this, ins.op, ins.operand);
+            if (recording && next == anchor) {
+                compileTrace();
+            }
+            if (next <= ip && isLoopBranch(ins.op) && !halted) {
+                backwardJump(next);
+            }
+            ip = next;
+        }
+        stats.totalSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void run(std::span<const uint32_t> code) {
+        load(code);
+        stats = Stats();
+        try {
+            memory.trapFaults([&] { execute(); });
+        } catch (...) {
+            printStats();
+            throw;
+        }
+        printStats();
+    }
+
+    void printStats() {
+        if (!statsEnabled) {
+            return;
+        }
+        double share = stats.totalSeconds > 0 ? 100.0 * stats.traceSeconds / stats.totalSeconds : 0.0;
+        std::cerr << "Traces formed: " << stats.tracesFormed << " (" << stats.tracesAborted << " recordings aborted)" << std::endl;
+        std::cerr << "Trace entries: " << stats.traceEntries << ", guard exits: " << stats.sideExits << std::endl;
+        std::cerr << "Time in traces: " << share << "% (" << stats.traceSeconds * 1000 << " of "
+                  << stats.totalSeconds * 1000 << " ms)" << std::endl;
+    }
+
+public:
+    // Operand stack slots, shared by all frames
+    static constexpr size_t defaultDepth = 1 << 16;
+
+    uint32_t debug_num;
+    explicit TraceVM(size_t stackDepth = defaultDepth, const VMMemory::Options& memoryOptions = VMMemory::Options())
+        : stack(stackDepth), frames(frameSlots), recording(false), anchor(0), sp(nullptr), frameTop(nullptr),
+          ip(0), next(0), halted(false), statsEnabled(false), memory(memoryOptions), buffer(memory.data()) {
+        debug_num = 0xFFFFFFFF;
+    }
+
+
+    void run_vm(std::string filename, bool benchmarkMode) {
+        try {
+            MappedProgram program(filename);
+            if (benchmarkMode) {
+                std::cout << "Preprocessing completed, starting benchmark..." << std::endl;
+            }
+            run(program.code());
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    void run_vm(const std::vector<uint32_t>& code) {
+        try {
+            run(code);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    // Prints traces formed, guard exits and the share of time spent in
+    // traces to stderr after each run.
+    void setTraceStats(bool enabled) {
+        statsEnabled = enabled;
+    }
+
+    const Stats& traceStats() const {
+        return stats;
+    }
+
+    char* getBuffer() {
+        return buffer;
+    }
+};
+#endif // TRACETHREADING_H
@@ -0,0 +1,142 @@
+#ifndef VECTOROPS_HPP
+#define VECTOROPS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Kernels behind DT_VADD, DT_VMUL, DT_VFP_ADD, DT_VFP_MUL and DT_VDOT. The
+// arrays are n 32-bit elements at any byte offset in VM memory.
+//
+// Element-wise results are those of a scalar loop running upwards, whatever
+// the arrays overlap. The kernels load a block of 8 elements before storing
+// it, which gives the same result unless the destination starts less than a
+// block after a source; that case takes the scalar loop.
+//
+// DT_VDOT adds element i into lane i % 8 and then sums the lanes pairwise,
+// so the float result is the same at every SIMD width.
+//
+// With GCC or Clang on x86-64 Linux every kernel is built for AVX2 and for
+// the baseline, and the loader picks one for the CPU (target_clones).
+namespace vectorops {
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define VECTOROPS_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define VECTOROPS_CLONES
+#endif
+
+enum class Operation { Add, Mul };
+
+constexpr uint32_t blockSize = 8;
+
+inline bool chases(const char* dst, const char* src) {
+    return dst > src && dst - src < static_cast<ptrdiff_t>(blockSize * 4);
+}
+
+// Blocks stay in locals: passing them by value would tie the kernels to the
+// AVX calling convention.
+template <Operation Op, typename T>
+inline T combine(T x, T y) {
+    if constexpr (Op == Operation::Add) {
+        return x + y;
+    } else {
+        return x * y;
+    }
+}
+
+template <Operation Op, typename T>
+inline void scalar(char* dst, const char* a, const char* b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        T x, y;
+        memcpy(&x, a + 4 * i, 4);
+        memcpy(&y, b + 4 * i, 4);
+        T result = combine<Op>(x, y);
+        memcpy(dst + 4 * i, &result, 4);
+    }
+}
+
+#ifdef __GNUC__
+typedef uint32_t WordBlock __attribute__((vector_size(32)));
+typedef float FloatBlock __attribute__((vector_size(32)));
+
+template <Operation Op, typename T, typename Block>
+inline void elementwise(char* dst, const char* a, const char* b, uint32_t n) {
+    if (chases(dst, a) || chases(dst, b)) {
+        scalar<Op, T>(dst, a, b, n);
+        return;
+    }
+    size_t i = 0;
+    for (; i + blockSize <= n; i += blockSize) {
+        Block x, y;
+        memcpy(&x, a + 4 * i, sizeof(Block));
+        memcpy(&y, b + 4 * i, sizeof(Block));
+        if constexpr (Op == Operation::Add) {
+            x += y;
+        } else {
+            x *= y;
+        }
+        memcpy(dst + 4 * i, &x, sizeof(Block));
+    }
+    scalar<Op, T>(dst + 4 * i, a + 4 * i, b + 4 * i, n - i);
+}
+
+VECTOROPS_CLONES inline float dot(const char* a, const char* b, uint32_t n) {
+    FloatBlock lanes = {};
+    size_t i = 0;
+    for (; i + blockSize <= n; i += blockSize) {
+        FloatBlock x, y;
+        memcpy(&x, a + 4 * i, sizeof(x));
+        memcpy(&y, b + 4 * i, sizeof(y));
+        lanes += x * y;
+    }
+    for (; i < n; ++i) {
+        float x, y;
+        memcpy(&x, a + 4 * i, 4);
+        memcpy(&y, b + 4 * i, 4);
+        lanes[i % blockSize] += x * y;
+    }
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+#else
+typedef uint32_t WordBlock;
+typedef float FloatBlock;
+
+template <Operation Op, typename T, typename Block>
+inline void elementwise(char* dst, const char* a, const char* b, uint32_t n) {
+    scalar<Op, T>(dst, a, b, n);
+}
+
+inline float dot(const char* a, const char* b, uint32_t n) {
+    float lanes[blockSize] = {};
+    for (size_t i = 0; i < n; ++i) {
+        float x, y;
+        memcpy(&x, a + 4 * i, 4);
+        memcpy(&y, b + 4 * i, 4);
+        lanes[i % blockSize] += x * y;
+    }
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+#endif
+
+VECTOROPS_CLONES inline void add(char* dst, const char* a, const char* b, uint32_t n) {
+    elementwise<Operation::Add, uint32_t, WordBlock>(dst, a, b, n);
+}
+
+VECTOROPS_CLONES inline void mul(char* dst, const char* a, const char* b, uint32_t n) {
+    elementwise<Operation::Mul, uint32_t, WordBlock>(dst, a, b, n);
+}
+
+VECTOROPS_CLONES inline void fpAdd(char* dst, const char* a, const char* b, uint32_t n) {
+    elementwise<Operation::Add, float, FloatBlock>(dst, a, b, n);
+}
+
+VECTOROPS_CLONES inline void fpMul(char* dst, const char* a, const char* b, uint32_t n) {
+    elementwise<Operation::Mul, float, FloatBlock>(dst, a, b, n);
+}
+
+#undef VECTOROPS_CLONES
+
+} // namespace vectorops
+
+#endif // VECTOROPS_HPP
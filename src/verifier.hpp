@@ -0,0 +1,323 @@
+#ifndef VERIFIER_HPP
+#define VERIFIER_HPP
+
+#include <vector>
+#include <span>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include "symbol.hpp"
+#include "semantics.hpp"
+
+// Instruction boundaries of a word-format program, decoded once for every
+// loader that resolves jump operands. indexOf maps a word offset to its
+// instruction index (UINT32_MAX inside an operand); the end of the program
+// maps to count(), where engines put their halt. A last instruction that runs
+// past the end is left out and its offset kept in truncatedAt.
+struct InstructionBoundaries {
+    std::vector<uint32_t> starts; // Word offset of every instruction, in order
+    std::vector<uint32_t> indexOf;
+    uint32_t truncatedAt = UINT32_MAX;
+
+    explicit InstructionBoundaries(std::span<const uint32_t> code) : indexOf(code.size() + 1, UINT32_MAX) {
+        starts.reserve(code.size());
+        for (size_t pointer = 0; pointer < code.size(); pointer += operandCount(code[pointer]) + 1) {
+            if (pointer + operandCount(code[pointer]) >= code.size()) {
+                truncatedAt = static_cast<uint32_t>(pointer);
+                break;
+            }
+            indexOf[pointer] = static_cast<uint32_t>(starts.size());
+            starts.push_back(static_cast<uint32_t>(pointer));
+        }
+        indexOf[code.size()] = count();
+    }
+
+    uint32_t count() const {
+        return static_cast<uint32_t>(starts.size());
+    }
+
+    // The end of the program counts; anything past it does not.
+    bool isBoundary(uint32_t address) const {
+        return address < indexOf.size() && indexOf[address] != UINT32_MAX;
+    }
+
+    // Instruction a jump operand lands on; targets past the end halt.
+    uint32_t target(uint32_t address) const {
+        uint32_t index = indexOf[std::min<size_t>(address, indexOf.size() - 1)];
+        if (index == UINT32_MAX) {
+            throw std::runtime_error("Jump target is not an instruction boundary");
+        }
+        return index;
+    }
+};
+
+// For loaders, which reject truncated programs.
+inline InstructionBoundaries decodeBoundaries(std::span<const uint32_t> code) {
+    InstructionBoundaries boundaries(code);
+    if (boundaries.truncatedAt != UINT32_MAX) {
+        throw std::runtime_error("Truncated instruction at " + std::to_string(boundaries.truncatedAt));
+    }
+    return boundaries;
+}
+
+// Load-time verification of stack bytecode. A program verifies when
+//
+//   - every opcode has semantics and no instruction is truncated,
+//   - jump and call targets are instruction boundaries (or the end, which
+//     halts),
+//   - memory operands lie inside the VM memory,
+//   - every function (the program entry and each DT_CALL target) is always
+//     called with the same parameter count, reaches each of its instructions
+//     with one operand stack height and never pops below its frame, and no
+//     instruction belongs to two functions.
+//
+// The operand stack of a verified program can only overflow, and stackBound
+// says by how much it can grow: the deepest call chain, or UINT64_MAX when
+// the call graph is recursive. An engine whose stack holds stackBound values
+// can run the program without per-instruction checks.
+struct Verification {
+    struct Function {
+        uint32_t entry;    // Code offset
+        uint32_t params;
+        uint32_t maxDepth; // Deepest the frame gets, parameters included
+    };
+
+    bool ok = false;
+    std::string error; // Why verification failed
+    std::vector<Function> functions; // functions[0] is the program entry
+    uint64_t stackBound = 0;
+};
+
+namespace verifier {
+
+inline bool hasSemantics(uint32_t opcode) {
+    switch (opcode) {
+#define VERIFIER_CASE(op) case op:
+        FOR_EACH_OPCODE(VERIFIER_CASE)
+#undef VERIFIER_CASE
+            return true;
+    }
+    return false;
+}
+
+// Values an opcode needs on the stack and its net effect, for everything that
+// falls through to the next instruction.
+inline void stackEffect(uint32_t opcode, uint32_t& needs, int32_t& delta) {
+    needs = 0;
+    delta = 0;
+    switch (opcode) {
+        case DT_ADD: case DT_SUB: case DT_MUL: case DT_DIV: case DT_SHL: case DT_SHR:
+        case DT_FP_ADD: case DT_FP_SUB: case DT_FP_MUL: case DT_FP_DIV:
+        case DT_GT: case DT_LT: case DT_EQ: case DT_GT_EQ: case DT_LT_EQ:
+            needs = 2; delta = -1; break;
+        case DT_INC: case DT_DEC: case DT_SEEK:
+            needs = 1; break;
+        case DT_LOD: case DT_IMMI: case DT_LOD_LOD_ADD:
+        case DT_MEMCMP: case DT_MEMCHR: case DT_STRLEN:
+        case DT_LOD8: case DT_LOD8S: case DT_LOD16: case DT_LOD16S:
+            delta = 1; break;
+        case DT_STO: case DT_JZ: case DT_JUMP_IF: case DT_IF_ELSE: case DT_IMMI_GT_JZ:
+        case DT_STO8: case DT_STO16:
+            needs = 1; delta = -1; break;
+        // 64-bit values are two slots
+        case DT_LOD64:
+            delta = 2; break;
+        case DT_STO64:
+            needs = 2; delta = -2; break;
+        case DT_ADD64: case DT_SUB64: case DT_MUL64: case DT_DIV64:
+        case DT_DP_ADD: case DT_DP_SUB: case DT_DP_MUL: case DT_DP_DIV:
+            needs = 4; delta = -2; break;
+        case DT_SHL64: case DT_SHR64:
+            needs = 3; delta = -1; break;
+        case DT_GT64: case DT_LT64: case DT_EQ64:
+            needs = 4; delta = -3; break;
+        case DT_SEXT:
+            needs = 1; delta = 1; break;
+        case DT_TRUNC:
+            needs = 2; delta = -1; break;
+    }
+}
+
+// Memory ranges [offset, offset + size) an instruction touches.
+inline bool memoryInBounds(uint32_t opcode, const uint32_t* op, uint64_t memorySize) {
+    auto fits = [&](uint64_t offset, uint64_t size) { return offset + size <= memorySize; };
+    switch (opcode) {
+        case DT_LOD: case DT_STO: case DT_STO_IMMI: case DT_READ_INT: case DT_FP_READ:
+            return fits(op[0], 4);
+        case DT_STRLEN: case DT_LOD8: case DT_LOD8S: case DT_STO8:
+            return fits(op[0], 1);
+        case DT_LOD16: case DT_LOD16S: case DT_STO16:
+            return fits(op[0], 2);
+        case DT_LOD64: case DT_STO64:
+            return fits(op[0], 8);
+        case DT_LOD_INC_STO: case DT_LOD_LOD_ADD:
+            return fits(op[0], 4) && fits(op[1], 4);
+        case DT_MEMCPY: case DT_MEMMOVE: case DT_MEMCMP:
+            return fits(op[0], op[2]) && fits(op[1], op[2]);
+        case DT_MEMSET: case DT_MEMCHR:
+            return fits(op[0], op[2]);
+        case DT_VADD: case DT_VMUL: case DT_VFP_ADD: case DT_VFP_MUL:
+            return fits(op[0], 4 * uint64_t(op[3])) && fits(op[1], 4 * uint64_t(op[3])) && fits(op[2], 4 * uint64_t(op[3]));
+        case DT_VDOT:
+            return fits(op[0], 4) && fits(op[1], 4 * uint64_t(op[3])) && fits(op[2], 4 * uint64_t(op[3]));
+    }
+    return true;
+}
+
+inline Verification verifyOrThrow(std::span<const uint32_t> code, uint64_t memorySize) {
+    Verification result;
+
+    const InstructionBoundaries boundaries(code);
+    const std::vector<uint32_t>& starts = boundaries.starts;
+    const std::vector<uint32_t>& indexOf = boundaries.indexOf;
+    for (uint32_t start : starts) {
+        if (!hasSemantics(code[start])) {
+            throw std::runtime_error("Unknown instruction " + std::to_string(code[start]) + " at " + std::to_string(start));
+        }
+        if (!memoryInBounds(code[start], code.data() + start + 1, memorySize)) {
+            throw std::runtime_error("Memory operand out of bounds at " + std::to_string(start));
+        }
+    }
+    if (boundaries.truncatedAt != UINT32_MAX) {
+        throw std::runtime_error("Truncated instruction at " + std::to_string(boundaries.truncatedAt));
+    }
+    const uint32_t count = boundaries.count();
+
+    // Walk each function from its entry; DT_CALL discovers new functions.
+    struct CallSite {
+        uint32_t base; // Caller's height below the parameters
+        uint32_t callee;
+    };
+    std::vector<std::vector<CallSite>> calls;
+    std::vector<uint32_t> functionAt(count + 1, UINT32_MAX); // Entry index -> function
+    std::vector<uint32_t> owner(count, UINT32_MAX);
+    std::vector<uint32_t> depth(count, 0);
+    auto function = [&](uint32_t entry, uint32_t params) {
+        if (functionAt[entry] == UINT32_MAX) {
+            functionAt[entry] = result.functions.size();
+            result.functions.push_back({entry < count ? starts[entry] : static_cast<uint32_t>(code.size()), params, params});
+            calls.emplace_back();
+        } else if (result.functions[functionAt[entry]].params != params) {
+            throw std::runtime_error("Function at " + std::to_string(result.functions[functionAt[entry]].entry) +
+                                     " called with different parameter counts");
+        }
+        return functionAt[entry];
+    };
+    function(0, 0);
+    for (uint32_t f = 0; f < result.functions.size(); ++f) {
+        const uint32_t entry = indexOf[result.functions[f].entry];
+        std::vector<uint32_t> work;
+        auto reach = [&](uint32_t index, uint32_t d) {
+            // By index: DT_CALL can grow result.functions under us.
+            result.functions[f].maxDepth = std::max(result.functions[f].maxDepth, d);
+            if (index == count) return;
+            if (owner[index] == UINT32_MAX) {
+                owner[index] = f;
+                depth[index] = d;
+                work.push_back(index);
+            } else if (owner[index] != f) {
+                throw std::runtime_error("Instruction at " + std::to_string(starts[index]) + " belongs to two functions");
+            } else if (depth[index] != d) {
+                throw std::runtime_error("Operand stack depth differs between paths into instruction at " +
+                                         std::to_string(starts[index]));
+            }
+        };
+        reach(entry, result.functions[f].params);
+        while (!work.empty()) {
+            uint32_t i = work.back();
+            work.pop_back();
+            const uint32_t opcode = code[starts[i]];
+            const uint32_t* op = code.data() + starts[i] + 1;
+            const uint32_t d = depth[i];
+            auto need = [&](uint32_t n) {
+                if (d < n) {
+                    throw std::runtime_error("Operand stack underflow at " + std::to_string(starts[i]));
+                }
+            };
+            switch (opcode) {
+                case DT_JMP:
+                    reach(boundaries.target(op[0]), d);
+                    break;
+                case DT_JZ: case DT_JUMP_IF:
+                    need(1);
+                    reach(boundaries.target(op[0]), d - 1);
+                    reach(i + 1, d - 1);
+                    break;
+                case DT_IF_ELSE:
+                    need(1);
+                    reach(boundaries.target(op[0]), d - 1);
+                    reach(boundaries.target(op[1]), d - 1);
+                    break;
+                case DT_IMMI_GT_JZ:
+                    need(1);
+                    reach(boundaries.target(op[1]), d - 1);
+                    reach(i + 1, d - 1);
+                    break;
+                case DT_CALL: {
+                    need(op[1]);
+                    uint32_t callee = function(boundaries.target(op[0]), op[1]);
+                    calls[f].push_back({d - op[1], callee});
+                    reach(i + 1, d - op[1] + 1);
+                    break;
+                }
+                case DT_RET:
+                    if (f == 0) {
+                        throw std::runtime_error("DT_RET outside a function at " + std::to_string(starts[i]));
+                    }
+                    need(1);
+                    break;
+                case DT_END:
+                    break;
+                default: {
+                    uint32_t needs;
+                    int32_t delta;
+                    stackEffect(opcode, needs, delta);
+                    need(needs);
+                    reach(i + 1, d + delta);
+                }
+            }
+        }
+    }
+
+    // Deepest call chain; recursion leaves it unbounded.
+    std::vector<uint64_t> bound(result.functions.size(), 0);
+    std::vector<uint8_t> state(result.functions.size(), 0); // 0 new, 1 on the path, 2 done
+    auto chain = [&](auto&& self, uint32_t f) -> uint64_t {
+        if (state[f] == 1) return UINT64_MAX;
+        if (state[f] == 2) return bound[f];
+        state[f] = 1;
+        uint64_t deepest = result.functions[f].maxDepth;
+        for (const CallSite& site : calls[f]) {
+            uint64_t callee = self(self, site.callee);
+            deepest = callee == UINT64_MAX ? UINT64_MAX : std::max(deepest, site.base + callee);
+            if (deepest == UINT64_MAX) break;
+        }
+        state[f] = 2;
+        return bound[f] = deepest;
+    };
+    result.stackBound = chain(chain, 0);
+    result.ok = true;
+    return result;
+}
+
+} // namespace verifier
+
+// Never throws: a program that does not verify comes back with ok == false
+// and the reason in error.
+inline Verification verifyBytecode(std::span<const uint32_t> code, uint64_t memorySize) {
+    try {
+        return verifier::verifyOrThrow(code, memorySize);
+    } catch (const std::runtime_error& e) {
+        Verification result;
+        result.error = e.what();
+        return result;
+    }
+}
+
+// Braced lists don't convert to a span.
+inline Verification verifyBytecode(const std::vector<uint32_t>& code, uint64_t memorySize) {
+    return verifyBytecode(std::span<const uint32_t>(code), memorySize);
+}
+
+#endif // VERIFIER_HPP
@@ -0,0 +1,292 @@
+#ifndef VMMEMORY_HPP
+#define VMMEMORY_HPP
+
+#include <csetjmp>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct VMMemoryOptions {
+    // Everything an opcode can reach: a 32-bit offset plus 2^32 four-byte
+    // elements for the vector opcodes.
+    static constexpr size_t fullReservation = size_t(5) << 32;
+
+    size_t size = 4 * 1024 * 1024; // Bytes
+    bool hugePages = false;
+    size_t reservation = fullReservation; // Address space for the memory and its guard zone
+};
+
+// The memory a VM program addresses with DT_LOD/DT_STO and friends. It is an
+// anonymous mapping reserved without swap accounting, so pages are only
+// committed (zero-filled) when the program first touches them, and a VM that
+// never writes memory costs no RSS. With hugePages the range is advised for
+// transparent huge pages where the kernel supports them.
+//
+// Opcodes address memory with a 32-bit offset plus at most a 32-bit length,
+// or 2^32 - 1 four-byte elements for the vector opcodes, so nothing they do
+// reaches past data() + 20 GiB. By default the mapping reserves all of
+// that and leaves everything after the usable pages PROT_NONE. Engines run
+// programs under guarded(), where a SIGSEGV inside the reservation abandons
+// the program instead of the host; the loads and stores themselves stay
+// unchecked. Protection is page-granular: a size that is not a multiple of
+// the page size leaves the rest of its last page addressable.
+//
+// The reservation counts against RLIMIT_AS (ulimit -v, AFL's -m). A smaller
+// Options::reservation fits under such a limit, but only accesses that stay
+// inside it become traps, so it is meant for programs that pass
+// verifyBytecode() against size().
+//
+// snapshot() and restore() let a fuzzer rewind the memory between runs in
+// time proportional to the pages the run wrote, using the same handler to
+// track them (see snapshot()).
+class VMMemory {
+public:
+    typedef VMMemoryOptions Options;
+
+    explicit VMMemory(const Options& options = Options())
+        : base(nullptr), length(0), mapped(0), reserved(0), page(static_cast<size_t>(sysconf(_SC_PAGESIZE))),
+          saved(nullptr), dirtyCount(0), nextTracked(nullptr) {
+        length = options.size;
+        mapped = (options.size + page - 1) & ~(page - 1);
+        if (mapped == 0) {
+            mapped = page;
+        }
+        reserved = std::max(mapped + page, options.reservation);
+        void* p = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("Can't map VM memory");
+        }
+        base = static_cast<char*>(p);
+        if (mprotect(base, mapped, PROT_READ | PROT_WRITE) != 0) {
+            munmap(base, reserved);
+            throw std::runtime_error("Can't map VM memory");
+        }
+#ifdef MADV_HUGEPAGE
+        if (options.hugePages) {
+            madvise(base, mapped, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    VMMemory(const VMMemory&) = delete;
+    VMMemory& operator=(const VMMemory&) = delete;
+
+    ~VMMemory() {
+        forgetSnapshot();
+        munmap(base, reserved);
+    }
+
+    char* data() const {
+        return base;
+    }
+
+    // Bytes the program may address.
+    size_t size() const {
+        return length;
+    }
+
+    // Gives every committed page back; the memory reads as zero again. Drops
+    // the snapshot, if there is one.
+    void reset() {
+        forgetSnapshot();
+        madvise(base, mapped, MADV_DONTNEED);
+    }
+
+    // Remembers the current contents and write-protects the memory. The
+    // first write to a page afterwards, by the program or the host, faults
+    // once: the handler notes the page as dirty and unprotects it. Pages that
+    // read as zero are not copied. Snapshotting memories are tracked
+    // process-wide, so snapshot(), reset() and destruction must not race
+    // with writes to another snapshotting memory.
+    void snapshot() {
+        if (!saved) {
+            void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::runtime_error("Can't map VM memory snapshot");
+            }
+            saved = static_cast<char*>(p);
+            dirty.reset(new uint32_t[mapped / page]);
+            ensureHandler();
+            nextTracked = tracked();
+            tracked() = this;
+        } else {
+            madvise(saved, mapped, MADV_DONTNEED);
+        }
+        mprotect(base, mapped, PROT_READ);
+        for (size_t offset = 0; offset < mapped; offset += page) {
+            if (!isZero(base + offset)) {
+                memcpy(saved + offset, base + offset, page);
+            }
+        }
+        dirtyCount = 0;
+    }
+
+    // Puts back the snapshot contents of every page written since snapshot()
+    // or the last restore(), and write-protects them again.
+    void restore() {
+        for (size_t i = 0; i < dirtyCount; ++i) {
+            const size_t offset = size_t(dirty[i]) * page;
+            memcpy(base + offset, saved + offset, page);
+            mprotect(base + offset, page, PROT_READ);
+        }
+        dirtyCount = 0;
+    }
+
+    // Pages written since snapshot() or the last restore().
+    size_t dirtyPages() const {
+        return dirtyCount;
+    }
+
+    // Runs body. A fault inside this memory's reservation abandons it and
+    // returns false; any other fault is left to the previous SIGSEGV handler.
+    // Frames body leaves this way are not unwound, so it must not own
+    // anything that needs destroying.
+    template <typename Body>
+    bool guarded(Body&& body) {
+        FaultScope scope(*this);
+        if (sigsetjmp(scope.resume, 1)) {
+            return false;
+        }
+        invoke(body);
+        return true;
+    }
+
+    // guarded(), with the fault reported as a VM trap.
+    template <typename Body>
+    void trapFaults(Body&& body) {
+        if (!guarded(body)) {
+            throw std::runtime_error("Memory access out of bounds");
+        }
+    }
+
+private:
+    struct FaultScope {
+        const VMMemory& memory;
+        sigjmp_buf resume;
+        FaultScope* outer;
+
+        explicit FaultScope(const VMMemory& guardedMemory) : memory(guardedMemory), outer(active()) {
+            ensureHandler();
+            active() = this;
+        }
+
+        ~FaultScope() {
+            active() = outer;
+        }
+    };
+
+    // Kept out of line so the interpreter loop is not compiled into the
+    // function that calls sigsetjmp, which would pin its locals to memory.
+    template <typename Body>
+    [[gnu::noinline]] static void invoke(Body& body) {
+        body();
+    }
+
+    static FaultScope*& active() {
+        static thread_local FaultScope* scope = nullptr;
+        return scope;
+    }
+
+    // Memories with a snapshot, for the fault handler.
+    static VMMemory*& tracked() {
+        static VMMemory* head = nullptr;
+        return head;
+    }
+
+    bool isZero(const char* at) const {
+        for (size_t i = 0; i < page; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, at + i, sizeof(word));
+            if (word) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void forgetSnapshot() {
+        if (!saved) {
+            return;
+        }
+        for (VMMemory** link = &tracked(); *link; link = &(*link)->nextTracked) {
+            if (*link == this) {
+                *link = nextTracked;
+                break;
+            }
+        }
+        mprotect(base, mapped, PROT_READ | PROT_WRITE);
+        munmap(saved, mapped);
+        saved = nullptr;
+        dirty.reset();
+        dirtyCount = 0;
+    }
+
+    static struct sigaction& previousHandler() {
+        static struct sigaction previous;
+        return previous;
+    }
+
+    static void ensureHandler() {
+        static const bool installed = installHandler();
+        (void)installed;
+    }
+
+    static bool installHandler() {
+        struct sigaction action = {};
+        action.sa_sigaction = onFault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        return sigaction(SIGSEGV, &action, &previousHandler()) == 0;
+    }
+
+    static void onFault(int signal, siginfo_t* info, void* context) {
+        uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+        // First write to a write-protected page since the snapshot
+        for (VMMemory* memory = tracked(); memory; memory = memory->nextTracked) {
+            uintptr_t offset = address - reinterpret_cast<uintptr_t>(memory->base);
+            if (offset < memory->mapped) {
+                offset &= ~uintptr_t(memory->page - 1);
+                memory->dirty[memory->dirtyCount] = offset / memory->page;
+                memory->dirtyCount = memory->dirtyCount + 1;
+                mprotect(memory->base + offset, memory->page, PROT_READ | PROT_WRITE);
+                return;
+            }
+        }
+        FaultScope* scope = active();
+        if (scope) {
+            uintptr_t start = reinterpret_cast<uintptr_t>(scope->memory.base);
+            if (address - start < scope->memory.reserved) {
+                siglongjmp(scope->resume, 1);
+            }
+        }
+        struct sigaction& previous = previousHandler();
+        if ((previous.sa_flags & SA_SIGINFO) && previous.sa_sigaction) {
+            previous.sa_sigaction(signal, info, context);
+        } else if (!(previous.sa_flags & SA_SIGINFO) && previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+            previous.sa_handler(signal);
+        } else {
+            // Not a VM access: put the old disposition back and let the
+            // faulting instruction run again under it.
+            sigaction(SIGSEGV, &previous, nullptr);
+        }
+    }
+
+    char* base;
+    size_t length;
+    size_t mapped;   // length rounded up to whole pages
+    size_t reserved; // mapped plus the PROT_NONE guard zone
+    size_t page;
+    char* saved; // Snapshot contents, mapped bytes
+    std::unique_ptr<uint32_t[]> dirty; // Pages written since the snapshot
+    volatile size_t dirtyCount; // Bumped by the fault handler
+    VMMemory* nextTracked;
+};
+
+#endif // VMMEMORY_HPP
@@ -1,9 +1,23 @@
 #include <gtest/gtest.h>
 #include <vector>
+#include <fstream>
 #include "symbol.hpp"
 #include "directthreading.cpp"
 #include "indirectthreading.cpp"
 #include "routinethreading.cpp"
+#include "gotothreading.cpp"
+#include "tosthreading.cpp"
+#include "registerthreading.cpp"
+#include "tailcallthreading.cpp"
+#include "tracethreading.cpp"
+#include "aotcode.hpp"
+#include "verifier.hpp"
+#include "vmmemory.hpp"
+#include "compactcode.hpp"
+#if __has_include("stencils.h")
+#include "copypatchthreading.cpp"
+#define HAVE_COPY_PATCH
+#endif
 uint32_t float_to_uint32(float value) {
     return *reinterpret_cast<uint32_t*>(&value);
 }
@@ -38,6 +52,15 @@ TEST(Arithmetic, HandlesDivision) {
     EXPECT_EQ(vm.debug_num, 4);
 }
 
+TEST(Arithmetic, TrapsOnZeroDivisor) {
+    // 0 / 5 divides; 7 / 0 stops the program before the second DT_SEEK
+    std::vector<uint32_t> instructions = {DT_IMMI, 0, DT_IMMI, 5, DT_DIV, DT_INC, DT_SEEK,
+                                          DT_IMMI, 7, DT_IMMI, 0, DT_DIV, DT_IMMI, 9, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1u);
+}
+
 TEST(FloatingPoint, HandlesFPAddition) {
     std::vector<uint32_t> instructions = {
         DT_IMMI, float_to_uint32(4.5f),
@@ -250,6 +273,321 @@ TEST(FunctionCalls, HandleFunctionCallAndReturn) {
     EXPECT_EQ(vm.debug_num, 12);
 }
 
+TEST(ControlFlow, SkipsUnknownInstruction) {
+    std::vector<uint32_t> instructions = {DT_SYSCALL, DT_IMMI, 5, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5);
+}
+
+TEST(StackTraps, StopsOnOverflow) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_SEEK, DT_END};
+    DirectThreadingVM vm(2);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, StopsOnUnderflow) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_ADD, DT_IMMI, 7, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(ControlFlow, SkipsOpcodePastTables) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, 0x7fffffff, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1);
+}
+
+TEST(ControlFlow, RejectsJumpIntoOperand) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 9, DT_SEEK, DT_JMP, 1};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(FunctionCalls, KeepsCallerStack) {
+    // The callee sees its parameters reversed (7 - 5); 100 stays below them.
+    std::vector<uint32_t> instructions = {DT_IMMI, 100, DT_IMMI, 5, DT_IMMI, 7, DT_CALL, 12, 2, DT_ADD, DT_SEEK, DT_END, DT_SUB, DT_RET};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 102);
+}
+
+TEST(Verification, RunsVerifiedProgramUnchecked) {
+    std::vector<uint32_t> instructions = {DT_STO_IMMI, 0, 0, DT_LOD, 0, DT_INC, DT_STO, 0, DT_LOD, 0, DT_IMMI, 10, DT_LT, DT_JUMP_IF, 3, DT_LOD, 0, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_TRUE(vm.verified());
+    EXPECT_EQ(vm.debug_num, 10);
+}
+
+TEST(Verification, FallsBackToCheckedHandlers) {
+    std::vector<uint32_t> instructions = {DT_SYSCALL, DT_IMMI, 5, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_FALSE(vm.verified());
+    EXPECT_EQ(vm.debug_num, 5);
+}
+
+TEST(Verification, ChecksStackBoundAgainstDepth) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_SEEK, DT_END};
+    DirectThreadingVM vm(2);
+    vm.run_vm(instructions);
+    EXPECT_FALSE(vm.verified());
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(Verification, DivisionsHaveOneStackEffect) {
+    // A zero dividend still pushes its quotient, so the verified depth holds
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_IMMI, 0, DT_IMMI, 5, DT_DIV, DT_ADD, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_TRUE(vm.verified());
+    EXPECT_EQ(vm.debug_num, 7u);
+
+    instructions = {DT_IMMI, 7, DT_IMMI, float_to_uint32(0.0f), DT_IMMI, float_to_uint32(2.0f), DT_FP_DIV, DT_ADD, DT_SEEK, DT_END};
+    vm.run_vm(instructions);
+    EXPECT_TRUE(vm.verified());
+    EXPECT_EQ(vm.debug_num, 7u);
+
+    instructions = {DT_IMMI, 7, DT_SEEK, DT_IMMI, 0, DT_IMMI, 0, DT_IMMI, 5, DT_IMMI, 0, DT_DIV64, DT_TRUNC, DT_ADD, DT_SEEK,
+                    DT_IMMI, 1, DT_IMMI, 0, DT_IMMI, 0, DT_IMMI, 0, DT_DIV64, DT_TRUNC, DT_SEEK, DT_END};
+    vm.run_vm(instructions);
+    EXPECT_TRUE(vm.verified());
+    EXPECT_EQ(vm.debug_num, 7u); // The second DT_DIV64 traps
+}
+
+TEST(MemoryOperations, UsesConfiguredMemorySize) {
+    std::vector<uint32_t> instructions = {DT_STO_IMMI, 12 << 20, 77, DT_LOD, 12 << 20, DT_SEEK, DT_END};
+    VMMemory::Options memory;
+    memory.size = 16 << 20;
+    DirectThreadingVM vm(OperandStack::defaultDepth, memory);
+    vm.run_vm(instructions);
+    EXPECT_TRUE(vm.verified());
+    EXPECT_EQ(vm.debug_num, 77);
+}
+
+TEST(MemoryFaults, StopsOnOutOfBoundsLoad) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_LOD, 0x80000000, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(BulkMemory, ComparesBuffers) {
+    std::vector<uint32_t> instructions = {DT_MEMCMP, 0, 16, 3, DT_SEEK, DT_MEMCMP, 16, 0, 3, DT_SEEK, DT_MEMCMP, 0, 16, 2, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    strcpy(vm.getBuffer(), "abc");
+    strcpy(vm.getBuffer() + 16, "abd");
+    vm.load(instructions);
+    vm.resume();
+    EXPECT_EQ(vm.debug_num, 0u);
+    instructions.resize(10);
+    vm.load(instructions);
+    vm.resume();
+    EXPECT_EQ(vm.debug_num, 1u);
+    instructions.resize(5);
+    vm.load(instructions);
+    vm.resume();
+    EXPECT_EQ(vm.debug_num, UINT32_MAX);
+}
+
+TEST(BulkMemory, ScansStrings) {
+    DirectThreadingVM vm;
+    strcpy(vm.getBuffer() + 100, "fuzzing");
+    std::vector<uint32_t> length = {DT_STRLEN, 100, DT_SEEK, DT_END};
+    vm.run_vm(length);
+    EXPECT_EQ(vm.debug_num, 7u);
+    std::vector<uint32_t> found = {DT_MEMCHR, 100, 'z', 7, DT_SEEK, DT_END};
+    vm.run_vm(found);
+    EXPECT_EQ(vm.debug_num, 102u);
+    std::vector<uint32_t> missing = {DT_MEMCHR, 100, 'x', 7, DT_SEEK, DT_END};
+    vm.run_vm(missing);
+    EXPECT_EQ(vm.debug_num, UINT32_MAX);
+}
+
+TEST(BulkMemory, MovesOverlappingRanges) {
+    std::vector<uint32_t> instructions = {DT_MEMMOVE, 2, 0, 4, DT_END};
+    DirectThreadingVM vm;
+    strcpy(vm.getBuffer(), "abcdef");
+    vm.run_vm(instructions);
+    EXPECT_STREQ(vm.getBuffer(), "ababcd");
+}
+
+TEST(BulkMemory, TrapsOnUnterminatedString) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_STRLEN, 4096, DT_SEEK, DT_END};
+    VMMemory::Options memory;
+    memory.size = 8192;
+    DirectThreadingVM vm(OperandStack::defaultDepth, memory);
+    memset(vm.getBuffer(), 'a', 8192);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7u);
+}
+
+TEST(VectorOps, AddsWordArrays) {
+    // 19 elements: two full blocks and a tail
+    std::vector<uint32_t> instructions = {DT_VADD, 512, 0, 256, 19, DT_VMUL, 768, 0, 256, 19, DT_END};
+    DirectThreadingVM vm;
+    uint32_t* words = reinterpret_cast<uint32_t*>(vm.getBuffer());
+    for (uint32_t i = 0; i < 19; ++i) {
+        words[i] = i;
+        words[64 + i] = 0xFFFFFFFF - i;
+    }
+    vm.run_vm(instructions);
+    for (uint32_t i = 0; i < 19; ++i) {
+        EXPECT_EQ(words[128 + i], 0xFFFFFFFFu);
+        EXPECT_EQ(words[192 + i], i * (0xFFFFFFFF - i));
+    }
+    EXPECT_EQ(words[128 + 19], 0u);
+}
+
+TEST(VectorOps, MultipliesFloatArrays) {
+    std::vector<uint32_t> instructions = {DT_VFP_MUL, 201, 1, 101, 11, DT_VFP_ADD, 201, 201, 1, 11, DT_END};
+    DirectThreadingVM vm;
+    for (uint32_t i = 0; i < 11; ++i) {
+        float a = 0.5f * i, b = 3.0f - i;
+        memcpy(vm.getBuffer() + 1 + 4 * i, &a, 4);
+        memcpy(vm.getBuffer() + 101 + 4 * i, &b, 4);
+    }
+    vm.run_vm(instructions);
+    for (uint32_t i = 0; i < 11; ++i) {
+        float result;
+        memcpy(&result, vm.getBuffer() + 201 + 4 * i, 4);
+        EXPECT_FLOAT_EQ(result, 0.5f * i * (3.0f - i) + 0.5f * i);
+    }
+}
+
+TEST(VectorOps, ComputesDotProduct) {
+    std::vector<uint32_t> instructions = {DT_VDOT, 0, 64, 1024, 100, DT_LOD, 0, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    float* floats = reinterpret_cast<float*>(vm.getBuffer());
+    for (uint32_t i = 0; i < 100; ++i) {
+        floats[16 + i] = static_cast<float>(i);
+        floats[256 + i] = 2.0f;
+    }
+    vm.run_vm(instructions);
+    EXPECT_FLOAT_EQ(floats[0], 9900.0f);
+    EXPECT_EQ(vm.debug_num, 0x461AB000u); // 9900.0f
+}
+
+TEST(VectorOps, OverlappingArraysMatchScalarLoop) {
+    // dst one element past src: each sum feeds the next, as in a scalar loop
+    std::vector<uint32_t> instructions = {DT_VADD, 4, 0, 200, 20, DT_END};
+    DirectThreadingVM vm;
+    uint32_t* words = reinterpret_cast<uint32_t*>(vm.getBuffer());
+    words[0] = 1;
+    for (uint32_t i = 0; i < 20; ++i) {
+        words[50 + i] = 1;
+    }
+    vm.run_vm(instructions);
+    for (uint32_t i = 0; i <= 20; ++i) {
+        EXPECT_EQ(words[i], i + 1);
+    }
+}
+
+TEST(VectorOps, TrapsOutOfBounds) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_VADD, 0, 0xFFFFFF00, 0, 0xFFFFFFFF, DT_IMMI, 8, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7u);
+}
+
+TEST(WideValues, LoadsNarrowWidths) {
+    std::vector<uint32_t> instructions = {DT_LOD8, 0, DT_STO, 100, DT_LOD8S, 1, DT_STO, 104,
+                                          DT_LOD16, 0, DT_STO, 108, DT_LOD16S, 0, DT_STO, 112, DT_END};
+    DirectThreadingVM vm;
+    vm.getBuffer()[0] = '\xFF';
+    vm.getBuffer()[1] = '\x80';
+    vm.run_vm(instructions);
+    uint32_t* words = reinterpret_cast<uint32_t*>(vm.getBuffer());
+    EXPECT_EQ(words[25], 0xFFu);
+    EXPECT_EQ(words[26], 0xFFFFFF80u);
+    EXPECT_EQ(words[27], 0x80FFu);
+    EXPECT_EQ(words[28], 0xFFFF80FFu);
+}
+
+TEST(WideValues, StoresNarrowWidths) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 0x12345678, DT_STO8, 9, DT_IMMI, 0xABCDEF01, DT_STO16, 13, DT_END};
+    DirectThreadingVM vm;
+    memset(vm.getBuffer(), 0xAA, 16);
+    vm.run_vm(instructions);
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(vm.getBuffer());
+    EXPECT_EQ(bytes[8], 0xAA);
+    EXPECT_EQ(bytes[9], 0x78);
+    EXPECT_EQ(bytes[10], 0xAA);
+    EXPECT_EQ(bytes[13], 0x01);
+    EXPECT_EQ(bytes[14], 0xEF);
+    EXPECT_EQ(bytes[15], 0xAA);
+}
+
+TEST(WideValues, Adds64BitCounters) {
+    // counter += 1 across the 32-bit boundary, then (counter * 3) >> 1
+    std::vector<uint32_t> instructions = {DT_LOD64, 0, DT_IMMI, 1, DT_IMMI, 0, DT_ADD64, DT_STO64, 0,
+                                          DT_LOD64, 0, DT_IMMI, 3, DT_IMMI, 0, DT_MUL64, DT_IMMI, 1, DT_SHR64, DT_STO64, 8,
+                                          DT_END};
+    DirectThreadingVM vm;
+    uint64_t* counters = reinterpret_cast<uint64_t*>(vm.getBuffer());
+    counters[0] = 0xFFFFFFFF;
+    vm.run_vm(instructions);
+    EXPECT_EQ(counters[0], 0x100000000ull);
+    EXPECT_EQ(counters[1], 0x180000000ull);
+}
+
+TEST(WideValues, Adds64BitCounters4) {
+    std::vector<uint32_t> instructions = {DT_LOD64, 0, DT_IMMI, 1, DT_IMMI, 0, DT_ADD64, DT_STO64, 0,
+                                          DT_LOD64, 0, DT_IMMI, 3, DT_IMMI, 0, DT_MUL64, DT_IMMI, 1, DT_SHR64, DT_STO64, 8,
+                                          DT_END};
+    GotoThreadingVM vm;
+    uint64_t* counters = reinterpret_cast<uint64_t*>(vm.getBuffer());
+    counters[0] = 0xFFFFFFFF;
+    vm.run_vm(instructions);
+    EXPECT_EQ(counters[0], 0x100000000ull);
+    EXPECT_EQ(counters[1], 0x180000000ull);
+}
+
+TEST(WideValues, ComparesAndNarrows) {
+    // -2 sign-extended plus 2^32 + 3 is 2^32 + 1; above 2^32, and its low word is 1
+    std::vector<uint32_t> instructions = {DT_IMMI, 0xFFFFFFFE, DT_SEXT, DT_IMMI, 3, DT_IMMI, 1, DT_ADD64, DT_STO64, 0,
+                                          DT_LOD64, 0, DT_IMMI, 0, DT_IMMI, 1, DT_GT64, DT_SEEK, DT_STO, 16,
+                                          DT_LOD64, 0, DT_TRUNC, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(reinterpret_cast<uint32_t*>(vm.getBuffer())[4], 1u);
+    EXPECT_EQ(vm.debug_num, 1u);
+    EXPECT_EQ(reinterpret_cast<uint64_t*>(vm.getBuffer())[0], 0x100000001ull);
+}
+
+TEST(WideValues, DoubleArithmetic) {
+    std::vector<uint32_t> instructions = {DT_LOD64, 0, DT_LOD64, 8, DT_DP_DIV, DT_LOD64, 8, DT_DP_ADD, DT_STO64, 16, DT_END};
+    DirectThreadingVM vm;
+    double* values = reinterpret_cast<double*>(vm.getBuffer());
+    values[0] = 1.0;
+    values[1] = 3.0;
+    vm.run_vm(instructions);
+    EXPECT_DOUBLE_EQ(values[2], 1.0 / 3.0 + 3.0);
+}
+
+TEST(Snapshots, RestoresStateForEveryInput) {
+    std::vector<uint32_t> instructions = {DT_LOD, 0, DT_INC, DT_STO, 0, DT_LOD, 0, DT_SEEK, DT_END};
+    DirectThreadingVM vm;
+    vm.load(instructions);
+    vm.getBuffer()[4096] = 41;
+    vm.snapshot();
+    for (uint32_t input : {1, 9, 100}) {
+        vm.restore();
+        EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+        vm.getBuffer()[0] = input;
+        vm.resume();
+        EXPECT_EQ(vm.debug_num, input + 1);
+    }
+    vm.restore();
+    EXPECT_EQ(vm.getBuffer()[0], 0);
+    EXPECT_EQ(vm.getBuffer()[4096], 41);
+}
+
 //Indirect Threading
 TEST(Arithmetic, HandlesAddition2) {
     std::vector<unsigned> instructions = {DT_IMMI, 5, DT_IMMI, 3, DT_ADD, DT_SEEK, DT_END};
@@ -283,6 +621,14 @@ TEST(Arithmetic, HandlesDivision2) {
     EXPECT_EQ(vm.debug_num, 4);
 }
 
+TEST(Arithmetic, TrapsOnZeroDivisor2) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 0, DT_IMMI, 5, DT_DIV, DT_INC, DT_SEEK,
+                                          DT_IMMI, 7, DT_IMMI, 0, DT_DIV, DT_IMMI, 9, DT_SEEK, DT_END};
+    IndirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1u);
+}
+
 TEST(FloatingPoint, HandlesFPAddition2) {
     std::vector<uint32_t> instructions = {
         DT_IMMI, float_to_uint32(4.5f),
@@ -491,6 +837,88 @@ TEST(FunctionCalls, HandleFunctionCallAndReturn2) {
     EXPECT_EQ(vm.debug_num, 12);
 }
 
+TEST(ControlFlow, PreprocessesConditionalJump2) {
+    // DT_JUMP_IF takes one operand; the thread must not treat it like DT_CALL
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_JUMP_IF, 8, DT_IMMI, 0, DT_SEEK, DT_END, DT_IMMI, 123, DT_SEEK, DT_END};
+    IndirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 123);
+}
+
+TEST(ControlFlow, ResolvesIfElseTargets2) {
+    // Both DT_IF_ELSE operands are rewritten to record indices
+    std::vector<uint32_t> instructions = {DT_IMMI, 0, DT_IF_ELSE, 7, 11, DT_END, DT_END, DT_IMMI, 1, DT_SEEK, DT_END, DT_IMMI, 2, DT_SEEK, DT_END};
+    IndirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 2);
+}
+
+TEST(StackTraps, StopsOnUnderflow2) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_ADD, DT_SEEK, DT_END};
+    IndirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(FunctionCalls, KeepsCallerStack2) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 100, DT_IMMI, 5, DT_IMMI, 7, DT_CALL, 12, 2, DT_ADD, DT_SEEK, DT_END, DT_SUB, DT_RET};
+    IndirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 102);
+}
+
+TEST(Verification, RunsVerifiedProgramUnchecked2) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 100, DT_IMMI, 5, DT_IMMI, 7, DT_CALL, 12, 2, DT_ADD, DT_SEEK, DT_END, DT_SUB, DT_RET};
+    IndirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_TRUE(vm.verified());
+    EXPECT_EQ(vm.debug_num, 102);
+}
+
+TEST(ControlFlow, RejectsJumpIntoOperand2) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 9, DT_SEEK, DT_JMP, 1, DT_END};
+    IndirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(MemoryFaults, StopsOnOutOfBoundsStore2) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_STO, 0xFFFFFFFF, DT_END};
+    IndirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(BulkMemory, ComparesBuffers2) {
+    std::vector<uint32_t> instructions = {DT_MEMCMP, 0, 16, 3, DT_SEEK, DT_END};
+    IndirectThreadingVM vm;
+    strcpy(vm.getBuffer(), "abd");
+    strcpy(vm.getBuffer() + 16, "abc");
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1u);
+}
+
+TEST(VectorOps, AddsWordArrays2) {
+    std::vector<uint32_t> instructions = {DT_VADD, 128, 0, 64, 9, DT_LOD, 160, DT_SEEK, DT_END};
+    IndirectThreadingVM vm;
+    uint32_t* words = reinterpret_cast<uint32_t*>(vm.getBuffer());
+    for (uint32_t i = 0; i < 9; ++i) {
+        words[i] = i;
+        words[16 + i] = 10 * i;
+    }
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 88u);
+}
+
+TEST(WideValues, Adds64BitCounters2) {
+    std::vector<uint32_t> instructions = {DT_LOD64, 0, DT_LOD64, 0, DT_ADD64, DT_STO64, 0, DT_END};
+    IndirectThreadingVM vm;
+    uint64_t* counter = reinterpret_cast<uint64_t*>(vm.getBuffer());
+    *counter = 0x80000001;
+    vm.run_vm(instructions);
+    EXPECT_EQ(*counter, 0x100000002ull);
+}
+
 //Routine Threading
 TEST(Arithmetic, HandlesAddition3) {
     std::vector<std::vector<unsigned> > instructions = {{DT_IMMI, 5}, {DT_IMMI, 3}, {DT_ADD}, {DT_SEEK}, {DT_END}};
@@ -520,6 +948,25 @@ TEST(Arithmetic, HandlesDivision3) {
     EXPECT_EQ(vm.debug_num, 4);
 }
 
+TEST(Arithmetic, TrapsOnZeroDivisor3) {
+    std::vector<uint32_t> code = {DT_IMMI, 0, DT_IMMI, 5, DT_DIV, DT_INC, DT_SEEK,
+                                  DT_IMMI, 7, DT_IMMI, 0, DT_DIV, DT_IMMI, 9, DT_SEEK, DT_END};
+    RoutineProgram program = RoutineThreadingVM::decode(code);
+    for (bool native : {true, false}) {
+        RoutineThreadingVM vm;
+        vm.setNativeMode(native);
+        EXPECT_THROW(vm.run_vm(program.view()), std::runtime_error);
+        EXPECT_EQ(vm.debug_num, 1u);
+    }
+}
+
+TEST(ControlFlow, RejectsJumpIntoOperand3) {
+    std::vector<uint32_t> code = {DT_IMMI, 9, DT_SEEK, DT_JMP, 1, DT_END};
+    EXPECT_THROW(RoutineThreadingVM::decode(code), std::runtime_error);
+    std::vector<uint32_t> truncated = {DT_IMMI, 9, DT_SEEK, DT_JMP};
+    EXPECT_THROW(RoutineThreadingVM::decode(truncated), std::runtime_error);
+}
+
 TEST(FloatingPoint, HandlesFPAddition3) {
     std::vector<std::vector<unsigned> > instructions = {
         {DT_IMMI, float_to_uint32(4.5f)},
@@ -710,6 +1157,1607 @@ TEST(FunctionCalls, HandleFunctionCallAndReturn3) {
     EXPECT_EQ(vm.debug_num, 12);
 }
 
+TEST(FunctionCalls, HandleNestedCallNative3) {
+    std::vector<std::vector<unsigned> > instructions = { {DT_IMMI, 10},{DT_CALL, 4, 1},{DT_SEEK},{DT_END},{DT_CALL, 6, 1},{DT_RET},{DT_IMMI, 2},{DT_ADD},{DT_RET} };
+    RoutineThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 12);
+#ifdef THD_NATIVE_X64
+    EXPECT_TRUE(vm.ranNative());
+#endif
+}
+
+TEST(ControlFlow, HandleJumpInterpreted3) {
+    std::vector<std::vector<unsigned> > instructions = { {DT_IMMI, 0},{DT_STO_IMMI, 0, 1},{DT_LOD, 0},{DT_ADD},{DT_LOD, 0},{DT_INC},{DT_STO, 0},{DT_LOD, 0},{DT_IMMI, 100},{DT_GT},{DT_JZ, 2},{DT_SEEK},{DT_END} };
+    RoutineThreadingVM vm;
+    vm.setNativeMode(false);
+    vm.run_vm(instructions);
+    EXPECT_FALSE(vm.ranNative());
+    EXPECT_EQ(vm.debug_num, 5050); 
+}
+
+TEST(BasicBlocks, SplitsAtBranchesAndTargets3) {
+    // Leaders: 0, the loop head 2 (jump target), 11 (after DT_JZ).
+    std::vector<std::vector<unsigned> > instructions = { {DT_IMMI, 0},{DT_STO_IMMI, 0, 1},{DT_LOD, 0},{DT_ADD},{DT_LOD, 0},{DT_INC},{DT_STO, 0},{DT_LOD, 0},{DT_IMMI, 100},{DT_GT},{DT_JZ, 2},{DT_SEEK},{DT_END} };
+    RoutineThreadingVM vm;
+    vm.setNativeMode(false);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.blockCount(), 3u);
+    EXPECT_EQ(vm.debug_num, 5050);
+}
+
+TEST(BasicBlocks, HandleFunctionCallInterpreted3) {
+    std::vector<uint32_t> code = {DT_IMMI, 5, DT_IMMI, 7, DT_CALL, 10, 2, DT_SEEK, DT_END, DT_END, DT_ADD, DT_RET};
+    RoutineProgram program = RoutineThreadingVM::decode(code);
+    ASSERT_EQ(program.size(), 8);
+    EXPECT_EQ(program.view().operandsOf(2)[0], 6); // DT_CALL's target remapped to an instruction index
+    RoutineThreadingVM vm;
+    vm.setNativeMode(false);
+    vm.run_vm(program.view());
+    EXPECT_EQ(vm.debug_num, 12);
+    EXPECT_EQ(vm.blockCount(), 4);
+}
+
+TEST(CodeLayout, PacksOperandsInOnePool3) {
+    std::vector<uint32_t> code = {DT_IMMI, 4, DT_STO_IMMI, 0, 9, DT_ADD, DT_MEMSET, 8, 1, 2, DT_END};
+    RoutineProgram program = RoutineThreadingVM::decode(code);
+    ASSERT_EQ(program.size(), 5);
+    EXPECT_EQ(program.operands, (std::vector<uint32_t>{4, 0, 9, 8, 1, 2}));
+    EXPECT_EQ(program.operandOffsets, (std::vector<uint32_t>{0, 1, 3, 3, 6}));
+}
+
+TEST(CodeLayout, RunsProgramViewWithoutCopy3) {
+    std::vector<uint32_t> code = {DT_STO_IMMI, 0, 0, DT_LOD, 0, DT_INC, DT_STO, 0, DT_LOD, 0, DT_IMMI, 10, DT_LT, DT_JUMP_IF, 3, DT_LOD, 0, DT_SEEK, DT_END};
+    RoutineProgram program = RoutineThreadingVM::decode(code);
+    for (bool native : {true, false}) {
+        RoutineThreadingVM vm;
+        vm.setNativeMode(native);
+        vm.run_vm(program.view());
+        EXPECT_EQ(vm.debug_num, 10);
+    }
+}
+
+TEST(StackTraps, ThrowsOnOverflow3) {
+    // Also from native code, which has to get the trap back to run_vm.
+    std::vector<uint32_t> code = {DT_IMMI, 1, DT_JMP, 0};
+    RoutineProgram program = RoutineThreadingVM::decode(code);
+    for (bool native : {true, false}) {
+        RoutineThreadingVM vm(64);
+        vm.setNativeMode(native);
+        EXPECT_THROW(vm.run_vm(program.view()), std::runtime_error);
+    }
+}
+
+TEST(StackTraps, ThrowsOnUnderflow3) {
+    std::vector<uint32_t> code = {DT_IMMI, 1, DT_JZ, 5, DT_ADD, DT_SEEK, DT_END};
+    RoutineProgram program = RoutineThreadingVM::decode(code);
+    for (bool native : {true, false}) {
+        RoutineThreadingVM vm;
+        vm.setNativeMode(native);
+        EXPECT_THROW(vm.run_vm(program.view()), std::runtime_error);
+    }
+}
+
+TEST(StackTraps, ThrowsOnRunawayRecursion3) {
+    std::vector<uint32_t> code = {DT_IMMI, 0, DT_CALL, 2, 0, DT_END};
+    RoutineProgram program = RoutineThreadingVM::decode(code);
+    RoutineThreadingVM vm;
+    EXPECT_THROW(vm.run_vm(program.view()), std::runtime_error);
+}
+
+TEST(FunctionCalls, KeepsCallerStack3) {
+    std::vector<uint32_t> code = {DT_IMMI, 100, DT_IMMI, 5, DT_IMMI, 7, DT_CALL, 12, 2, DT_ADD, DT_SEEK, DT_END, DT_SUB, DT_RET};
+    RoutineProgram program = RoutineThreadingVM::decode(code);
+    for (bool native : {true, false}) {
+        RoutineThreadingVM vm;
+        vm.setNativeMode(native);
+        vm.run_vm(program.view());
+        EXPECT_EQ(vm.debug_num, 102);
+    }
+}
+
+TEST(FunctionCalls, CalleeCannotPopCallerStack3) {
+    std::vector<uint32_t> code = {DT_IMMI, 1, DT_IMMI, 2, DT_CALL, 8, 1, DT_END, DT_ADD, DT_RET};
+    RoutineProgram program = RoutineThreadingVM::decode(code);
+    RoutineThreadingVM vm;
+    vm.setNativeMode(false);
+    EXPECT_THROW(vm.run_vm(program.view()), std::runtime_error);
+}
+
+TEST(BulkMemory, ScansStrings3) {
+    // strlen + address of the first 'i'
+    std::vector<std::vector<uint32_t>> instructions = {{DT_STRLEN, 8}, {DT_MEMCHR, 8, 'i', 5}, {DT_ADD}, {DT_SEEK}, {DT_END}};
+    RoutineThreadingVM vm;
+    strcpy(vm.getBuffer() + 8, "fuzzing");
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7u + 12u);
+    strcpy(vm.getBuffer() + 8, "pi");
+    vm.setNativeMode(false);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 2u + 9u);
+}
+
+TEST(VectorOps, ComputesDotProduct3) {
+    std::vector<std::vector<uint32_t>> instructions = {{DT_VDOT, 0, 4, 4, 3}, {DT_LOD, 0}, {DT_SEEK}, {DT_END}};
+    RoutineThreadingVM vm;
+    float values[3] = {1.0f, 2.0f, 3.0f};
+    memcpy(vm.getBuffer() + 4, values, sizeof(values));
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0x41600000u); // 14.0f
+    memcpy(vm.getBuffer() + 4, values, sizeof(values));
+    vm.setNativeMode(false);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0x41600000u);
+}
+
+TEST(WideValues, LoadsNarrowWidths3) {
+    std::vector<std::vector<uint32_t>> instructions = {{DT_LOD8S, 0}, {DT_LOD16, 2}, {DT_ADD}, {DT_SEEK}, {DT_END}};
+    RoutineThreadingVM vm;
+    const unsigned char bytes[4] = {0xFE, 0, 0x34, 0x12};
+    memcpy(vm.getBuffer(), bytes, sizeof(bytes));
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0x1234u - 2);
+    vm.setNativeMode(false);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0x1234u - 2);
+}
+
+TEST(MemoryFaults, ThrowsOnOutOfBoundsMemcpy3) {
+    std::vector<std::vector<uint32_t>> instructions = {{DT_IMMI, 7}, {DT_SEEK}, {DT_MEMCPY, 0x7FFFFFFF, 0, 16}, {DT_END}};
+    RoutineThreadingVM vm;
+    EXPECT_THROW(vm.run_vm(instructions), std::runtime_error);
+    EXPECT_EQ(vm.debug_num, 7);
+    vm.setNativeMode(false);
+    EXPECT_THROW(vm.run_vm(instructions), std::runtime_error);
+}
+
+//Goto Threading
+TEST(Arithmetic, HandlesAddition4) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 5, DT_IMMI, 3, DT_ADD, DT_SEEK, DT_END};
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 8); 
+}
+
+TEST(Arithmetic, HandlesDivision4) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 20, DT_IMMI, 5, DT_DIV, DT_SEEK, DT_END};
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 4);
+}
+
+TEST(Arithmetic, TrapsOnZeroDivisor4) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 0, DT_IMMI, 5, DT_DIV, DT_INC, DT_SEEK,
+                                          DT_IMMI, 7, DT_IMMI, 0, DT_DIV, DT_IMMI, 9, DT_SEEK, DT_END};
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1u);
+}
+
+TEST(FloatingPoint, HandlesFPSubtraction4) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, float_to_uint32(5.5f),
+        DT_IMMI, float_to_uint32(1.5f),
+        DT_FP_SUB, DT_SEEK, DT_END
+    };
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, float_to_uint32(4.0f));
+}
+
+TEST(MemoryOperations, HandleMemoryCopy4) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 123,  
+        DT_MEMCPY, 4, 0, 4,   
+        DT_LOD, 4,           
+        DT_SEEK, DT_END
+    };
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 123);
+}
+
+TEST(ControlFlow, HandleJump4) {
+    std::vector<uint32_t> instructions = {DT_IMMI,0,DT_STO_IMMI,0,1,DT_LOD,0,DT_ADD,DT_LOD,0,DT_INC,DT_STO,0,DT_LOD,0,DT_IMMI,100,DT_GT,DT_JZ,5,DT_SEEK,DT_END};
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5050); 
+}
+
+TEST(ControlFlow, HandleIfElse4) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 0,               
+        DT_IF_ELSE, 9, 13,         
+        DT_IMMI, 0,               
+        DT_SEEK, DT_END,
+        DT_IMMI, 123,             
+        DT_SEEK, DT_END,
+        DT_IMMI, 456,             
+        DT_SEEK, DT_END
+    };
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 456); 
+}
+
+TEST(ControlFlow, HandleConditionalJump4) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 1,               
+        DT_JUMP_IF, 8,           
+        DT_IMMI, 0,               
+        DT_SEEK, DT_END,
+        DT_IMMI, 123,            
+        DT_SEEK, DT_END
+    };
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 123); 
+}
+
+TEST(ControlFlow, HandleFallOffEnd4) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_JMP, 5};
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(FunctionCalls, HandleFunctionCallAndReturn4) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 10,              
+        DT_CALL, 7, 1,              
+        DT_SEEK, DT_END,          
+        DT_IMMI, 2,               
+        DT_ADD,                  
+        DT_RET                    
+    };
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 12);
+}
+
+TEST(MemoryFaults, StopsOnOutOfBoundsMemset4) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_MEMSET, 0x7FFFFFFF, 1, 16, DT_END};
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(StackTraps, StopsOnOverflow4) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_SEEK, DT_END};
+    GotoThreadingVM vm(2);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(FunctionCalls, KeepsCallerStack4) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 100, DT_IMMI, 5, DT_IMMI, 7, DT_CALL, 12, 2, DT_ADD, DT_SEEK, DT_END, DT_SUB, DT_RET};
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 102);
+}
+
+TEST(ControlFlow, RejectsJumpIntoOperand4) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 5, DT_SEEK, DT_JMP, 1, DT_END};
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(ControlFlow, HaltsOnJumpPastEnd4) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_JMP, 100, DT_IMMI, 8, DT_SEEK, DT_END};
+    GotoThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7u);
+}
+
+#ifdef HAVE_COPY_PATCH
+//Copy-and-patch
+TEST(Arithmetic, HandlesSubtraction5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 10, DT_IMMI, 4, DT_SUB, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 6);
+}
+
+TEST(Arithmetic, HandlesDivision5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 20, DT_IMMI, 5, DT_DIV, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 4);
+}
+
+TEST(Arithmetic, TrapsOnZeroDivisor5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 0, DT_IMMI, 5, DT_DIV, DT_INC, DT_SEEK,
+                                          DT_IMMI, 7, DT_IMMI, 0, DT_DIV, DT_IMMI, 9, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1u);
+}
+
+TEST(FloatingPoint, HandlesFPDivision5) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, float_to_uint32(7.5f),
+        DT_IMMI, float_to_uint32(2.5f),
+        DT_FP_DIV, DT_SEEK, DT_END
+    };
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, float_to_uint32(3.0f));
+}
+
+TEST(BitwiseOperations, HandleLeftShift5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 3, DT_SHL, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 8); 
+}
+
+TEST(MemoryOperations, HandleMemorySet5) {
+    std::vector<uint32_t> instructions = {
+        DT_MEMSET, 0, 255, 4, 
+        DT_LOD, 0,            
+        DT_SEEK, DT_END
+    };
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF); 
+}
+
+TEST(ControlFlow, HandleJump5) {
+    std::vector<uint32_t> instructions = {DT_IMMI,0,DT_STO_IMMI,0,1,DT_LOD,0,DT_ADD,DT_LOD,0,DT_INC,DT_STO,0,DT_LOD,0,DT_IMMI,100,DT_GT,DT_JZ,5,DT_SEEK,DT_END};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5050); 
+}
+
+TEST(ControlFlow, HandleIfElse5) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 1,               
+        DT_IF_ELSE, 9, 13,         
+        DT_IMMI, 0,               
+        DT_SEEK, DT_END,
+        DT_IMMI, 123,             
+        DT_SEEK, DT_END,
+        DT_IMMI, 456,             
+        DT_SEEK, DT_END
+    };
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 123); 
+}
+
+TEST(ComparisonOperations, HandleGreaterThanEqualTo5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 10, DT_IMMI, 5, DT_GT_EQ, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1); // 10 >= 5
+}
+
+TEST(FunctionCalls, HandleFunctionCallAndReturn5) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 10,              
+        DT_CALL, 7, 1,              
+        DT_SEEK, DT_END,          
+        DT_IMMI, 2,               
+        DT_ADD,                  
+        DT_RET                    
+    };
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 12);
+}
+
+TEST(ControlFlow, RejectsJumpIntoOperand5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 9, DT_SEEK, DT_JMP, 1};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, StopsOnUnderflow5) {
+    std::vector<uint32_t> instructions = {DT_ADD, DT_IMMI, 7, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, StopsOnUnderflowBelowFrame5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_CALL, 8, 0, DT_END, DT_ADD, DT_SEEK, DT_RET};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, StopsOnOverflow5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    CopyPatchVM vm(2);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, RunsWithinCapacity5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    CopyPatchVM vm(16);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5);
+}
+
+TEST(MemoryFaults, StopsOnOutOfBoundsLoad5) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_LOD, 0x80000000, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(BulkMemory, RunsOnSharedSemantics5) {
+    // 5 + strlen("abc") + memcmp("abd", "abc"), then "abc" -> "aab" and the 'b' at 102
+    std::vector<uint32_t> instructions = {DT_IMMI, 0x00636261, DT_STO, 100, DT_IMMI, 5, DT_STRLEN, 100,
+                                          DT_MEMCMP, 0, 16, 3, DT_ADD, DT_ADD, DT_MEMMOVE, 101, 100, 2,
+                                          DT_MEMCHR, 100, 'b', 3, DT_ADD, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    strcpy(vm.getBuffer(), "abd");
+    strcpy(vm.getBuffer() + 16, "abc");
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 111u);
+    EXPECT_STREQ(vm.getBuffer() + 100, "aab");
+}
+
+TEST(VectorOps, RunsOnSharedSemantics5) {
+    // The stored 1 feeds the sum; 2 + 3 + (8 + 80)
+    std::vector<uint32_t> instructions = {DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 1, DT_STO, 0, DT_VADD, 128, 0, 64, 9,
+                                          DT_LOD, 160, DT_ADD, DT_ADD, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    uint32_t* words = reinterpret_cast<uint32_t*>(vm.getBuffer());
+    for (uint32_t i = 0; i < 9; ++i) {
+        words[i] = i;
+        words[16 + i] = 10 * i;
+    }
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 93u);
+    EXPECT_EQ(words[32], 1u);
+}
+
+TEST(WideValues, RunsOnSharedSemantics5) {
+    // The 32-bit store lands in the high word of the first counter
+    std::vector<uint32_t> instructions = {DT_LOD64, 0, DT_IMMI, 1, DT_IMMI, 0, DT_ADD64, DT_STO64, 0,
+                                          DT_IMMI, 2, DT_STO, 4, DT_LOD64, 0, DT_IMMI, 3, DT_IMMI, 0, DT_MUL64,
+                                          DT_IMMI, 1, DT_SHR64, DT_STO64, 8, DT_LOD8S, 7, DT_SEEK, DT_END};
+    CopyPatchVM vm;
+    uint64_t* counters = reinterpret_cast<uint64_t*>(vm.getBuffer());
+    counters[0] = 0xFFFFFFFF;
+    vm.run_vm(instructions);
+    EXPECT_EQ(counters[0], 0x200000000ull);
+    EXPECT_EQ(counters[1], 0x300000000ull);
+    EXPECT_EQ(vm.debug_num, 0u);
+    std::vector<uint32_t> divide = {DT_IMMI, 7, DT_SEEK, DT_IMMI, 1, DT_IMMI, 0, DT_IMMI, 0, DT_IMMI, 0, DT_DIV64,
+                                    DT_IMMI, 8, DT_SEEK, DT_END};
+    vm.run_vm(divide);
+    EXPECT_EQ(vm.debug_num, 7u);
+}
+#endif
+
+//Top-of-stack caching
+TEST(Arithmetic, HandlesAddition6) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 5, DT_IMMI, 3, DT_ADD, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 8);
+}
+
+TEST(Arithmetic, HandlesSubtractionAllStates6) {
+    // Three pushes spill one item, so SUB runs in state 2 and then in state 1
+    std::vector<uint32_t> instructions = {DT_IMMI, 20, DT_IMMI, 8, DT_IMMI, 3, DT_SUB, DT_SUB, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 15);
+}
+
+TEST(Arithmetic, HandlesDivision6) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 10, DT_IMMI, 2, DT_DIV, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5);
+}
+
+TEST(Arithmetic, TrapsOnZeroDivisor6) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 0, DT_IMMI, 5, DT_DIV, DT_INC, DT_SEEK,
+                                          DT_IMMI, 7, DT_IMMI, 0, DT_DIV, DT_IMMI, 9, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1u);
+}
+
+TEST(StackTraps, StopsOnOverflow6) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    TosThreadingVM vm(2);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, RunsWithinCapacity6) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    TosThreadingVM vm(16);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5);
+}
+
+TEST(FloatingPoint, HandlesFPMultiplication6) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, float_to_uint32(2.5f),
+        DT_IMMI, float_to_uint32(4.0f),
+        DT_FP_MUL, DT_SEEK, DT_END
+    };
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, float_to_uint32(10.0f));
+}
+
+TEST(MemoryOperations, HandleLoadAndStore6) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 100, DT_STO, 0, DT_LOD, 0, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 100);
+}
+
+TEST(ControlFlow, HandleCountingLoop6) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 0,
+        DT_LOD, 0, DT_INC, DT_STO, 0,
+        DT_LOD, 0, DT_IMMI, 5, DT_GT, DT_JZ, 3,
+        DT_LOD, 0,
+        DT_SEEK, DT_END
+    };
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 6);
+}
+
+TEST(ControlFlow, HandleIfElse6) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 1,
+        DT_IF_ELSE, 9, 13,
+        DT_IMMI, 0,
+        DT_SEEK, DT_END,
+        DT_IMMI, 123,
+        DT_SEEK, DT_END,
+        DT_IMMI, 456,
+        DT_SEEK, DT_END
+    };
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 123);
+}
+
+TEST(FunctionCalls, HandleFunctionCallAndReturn6) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 10,
+        DT_CALL, 7, 1,
+        DT_SEEK, DT_END,
+        DT_IMMI, 2,
+        DT_ADD,
+        DT_RET
+    };
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 12);
+}
+
+TEST(FunctionCalls, KeepsCallerStack6) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 100,
+        DT_IMMI, 7, DT_IMMI, 3,
+        DT_CALL, 12, 2,
+        DT_ADD, DT_SEEK, DT_END,
+        DT_SUB, DT_RET
+    };
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 96);
+}
+
+TEST(ControlFlow, RejectsJumpIntoOperand6) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 9, DT_SEEK, DT_JMP, 1};
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(ControlFlow, HaltsOnJumpPastEnd6) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_JMP, 100, DT_IMMI, 8, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7u);
+}
+
+TEST(MemoryFaults, StopsOnOutOfBoundsLoad6) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_LOD, 0x80000000, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(BulkMemory, RunsOnSharedSemantics6) {
+    // 5 + strlen("abc") + memcmp("abd", "abc"), then "abc" -> "aab" and the 'b' at 102
+    std::vector<uint32_t> instructions = {DT_IMMI, 0x00636261, DT_STO, 100, DT_IMMI, 5, DT_STRLEN, 100,
+                                          DT_MEMCMP, 0, 16, 3, DT_ADD, DT_ADD, DT_MEMMOVE, 101, 100, 2,
+                                          DT_MEMCHR, 100, 'b', 3, DT_ADD, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    strcpy(vm.getBuffer(), "abd");
+    strcpy(vm.getBuffer() + 16, "abc");
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 111u);
+    EXPECT_STREQ(vm.getBuffer() + 100, "aab");
+}
+
+TEST(VectorOps, RunsOnSharedSemantics6) {
+    // The stored 1 feeds the sum; 2 + 3 + (8 + 80)
+    std::vector<uint32_t> instructions = {DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 1, DT_STO, 0, DT_VADD, 128, 0, 64, 9,
+                                          DT_LOD, 160, DT_ADD, DT_ADD, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    uint32_t* words = reinterpret_cast<uint32_t*>(vm.getBuffer());
+    for (uint32_t i = 0; i < 9; ++i) {
+        words[i] = i;
+        words[16 + i] = 10 * i;
+    }
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 93u);
+    EXPECT_EQ(words[32], 1u);
+}
+
+TEST(WideValues, RunsOnSharedSemantics6) {
+    // The 32-bit store lands in the high word of the first counter
+    std::vector<uint32_t> instructions = {DT_LOD64, 0, DT_IMMI, 1, DT_IMMI, 0, DT_ADD64, DT_STO64, 0,
+                                          DT_IMMI, 2, DT_STO, 4, DT_LOD64, 0, DT_IMMI, 3, DT_IMMI, 0, DT_MUL64,
+                                          DT_IMMI, 1, DT_SHR64, DT_STO64, 8, DT_LOD8S, 7, DT_SEEK, DT_END};
+    TosThreadingVM vm;
+    uint64_t* counters = reinterpret_cast<uint64_t*>(vm.getBuffer());
+    counters[0] = 0xFFFFFFFF;
+    vm.run_vm(instructions);
+    EXPECT_EQ(counters[0], 0x200000000ull);
+    EXPECT_EQ(counters[1], 0x300000000ull);
+    EXPECT_EQ(vm.debug_num, 0u);
+    std::vector<uint32_t> divide = {DT_IMMI, 7, DT_SEEK, DT_IMMI, 1, DT_IMMI, 0, DT_IMMI, 0, DT_IMMI, 0, DT_DIV64,
+                                    DT_IMMI, 8, DT_SEEK, DT_END};
+    vm.run_vm(divide);
+    EXPECT_EQ(vm.debug_num, 7u);
+}
+
+//Register VM
+TEST(Arithmetic, HandlesMultiplication7) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 6, DT_IMMI, 7, DT_MUL, DT_SEEK, DT_END};
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 42);
+}
+
+TEST(Arithmetic, HandlesSubtraction7) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 20, DT_IMMI, 8, DT_IMMI, 3, DT_SUB, DT_SUB, DT_SEEK, DT_END};
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 15);
+}
+
+TEST(Arithmetic, TrapsOnZeroDivisor7) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 0, DT_IMMI, 5, DT_DIV, DT_INC, DT_SEEK,
+                                          DT_IMMI, 7, DT_IMMI, 0, DT_DIV, DT_IMMI, 9, DT_SEEK, DT_END};
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1u);
+}
+
+TEST(StackTraps, StopsOnOverflow7) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    RegisterVM vm(2);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, RunsWithinCapacity7) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    RegisterVM vm(16);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5);
+}
+
+TEST(FloatingPoint, HandlesFPDivision7) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, float_to_uint32(7.5f),
+        DT_IMMI, float_to_uint32(2.5f),
+        DT_FP_DIV, DT_SEEK, DT_END
+    };
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, float_to_uint32(3.0f));
+}
+
+TEST(MemoryOperations, WritesBackPromotedSlots7) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 40, DT_STO_IMMI, 4, 2,
+        DT_LOD, 0, DT_LOD, 4, DT_ADD, DT_STO, 8,
+        DT_LOD, 8, DT_SEEK, DT_END
+    };
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 42);
+    uint32_t stored;
+    memcpy(&stored, vm.getBuffer() + 8, 4);
+    EXPECT_EQ(stored, 42);
+}
+
+TEST(MemoryOperations, KeepsLoadedValueAcrossStore7) {
+    // The first LOD must still see 5 after the slot is overwritten
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 5,
+        DT_LOD, 0, DT_STO_IMMI, 0, 9,
+        DT_LOD, 0, DT_SUB, DT_SEEK, DT_END
+    };
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, static_cast<uint32_t>(5 - 9));
+}
+
+TEST(MemoryOperations, HandleMemoryCopy7) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 77,
+        DT_MEMCPY, 16, 0, 4,
+        DT_LOD, 16, DT_SEEK, DT_END
+    };
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 77);
+}
+
+TEST(ControlFlow, HandleCountingLoop7) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 0, DT_STO_IMMI, 0, 1,
+        DT_LOD, 0, DT_ADD, DT_LOD, 0, DT_INC, DT_STO, 0,
+        DT_LOD, 0, DT_IMMI, 100, DT_GT, DT_JZ, 5,
+        DT_SEEK, DT_END
+    };
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5050);
+    // The loop body becomes ADD, ADD, JLT_EQ instead of nine stack instructions
+    EXPECT_LE(vm.translatedSize(), 8u);
+}
+
+TEST(ControlFlow, HandleIfElse7) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 0,
+        DT_IF_ELSE, 9, 13,
+        DT_IMMI, 0,
+        DT_SEEK, DT_END,
+        DT_IMMI, 123,
+        DT_SEEK, DT_END,
+        DT_IMMI, 456,
+        DT_SEEK, DT_END
+    };
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 456);
+}
+
+TEST(ControlFlow, HandleConditionalJump7) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 1,
+        DT_JUMP_IF, 8,
+        DT_IMMI, 0,
+        DT_SEEK, DT_END,
+        DT_IMMI, 123,
+        DT_SEEK, DT_END
+    };
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 123);
+}
+
+TEST(FunctionCalls, HandleFunctionCallAndReturn7) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 10,
+        DT_CALL, 7, 1,
+        DT_SEEK, DT_END,
+        DT_IMMI, 2,
+        DT_ADD,
+        DT_RET
+    };
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 12);
+}
+
+TEST(FunctionCalls, PassesParamsAndSlots7) {
+    // The callee sees the params reversed and its store to slot 0 survives the return
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 100,
+        DT_IMMI, 7, DT_IMMI, 3,
+        DT_CALL, 15, 2,
+        DT_ADD, DT_LOD, 0, DT_ADD, DT_SEEK, DT_END,
+        DT_STO_IMMI, 0, 1000, DT_SUB, DT_RET
+    };
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1096);
+}
+
+TEST(ControlFlow, RejectsUnbalancedStack7) {
+    // The loop pushes one item per iteration
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_JMP, 0};
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(MemoryFaults, StopsOnOutOfBoundsLoad7) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_LOD, 0x80000000, DT_SEEK, DT_END};
+    RegisterVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(BulkMemory, RunsOnSharedSemantics7) {
+    // 5 + strlen("abc") + memcmp("abd", "abc"), then "abc" -> "aab" and the 'b' at 102
+    std::vector<uint32_t> instructions = {DT_IMMI, 0x00636261, DT_STO, 100, DT_IMMI, 5, DT_STRLEN, 100,
+                                          DT_MEMCMP, 0, 16, 3, DT_ADD, DT_ADD, DT_MEMMOVE, 101, 100, 2,
+                                          DT_MEMCHR, 100, 'b', 3, DT_ADD, DT_SEEK, DT_END};
+    RegisterVM vm;
+    strcpy(vm.getBuffer(), "abd");
+    strcpy(vm.getBuffer() + 16, "abc");
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 111u);
+    EXPECT_STREQ(vm.getBuffer() + 100, "aab");
+}
+
+TEST(VectorOps, RunsOnSharedSemantics7) {
+    // The stored 1 feeds the sum; 2 + 3 + (8 + 80)
+    std::vector<uint32_t> instructions = {DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 1, DT_STO, 0, DT_VADD, 128, 0, 64, 9,
+                                          DT_LOD, 160, DT_ADD, DT_ADD, DT_SEEK, DT_END};
+    RegisterVM vm;
+    uint32_t* words = reinterpret_cast<uint32_t*>(vm.getBuffer());
+    for (uint32_t i = 0; i < 9; ++i) {
+        words[i] = i;
+        words[16 + i] = 10 * i;
+    }
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 93u);
+    EXPECT_EQ(words[32], 1u);
+}
+
+TEST(WideValues, RunsOnSharedSemantics7) {
+    // The 32-bit store lands in the high word of the first counter
+    std::vector<uint32_t> instructions = {DT_LOD64, 0, DT_IMMI, 1, DT_IMMI, 0, DT_ADD64, DT_STO64, 0,
+                                          DT_IMMI, 2, DT_STO, 4, DT_LOD64, 0, DT_IMMI, 3, DT_IMMI, 0, DT_MUL64,
+                                          DT_IMMI, 1, DT_SHR64, DT_STO64, 8, DT_LOD8S, 7, DT_SEEK, DT_END};
+    RegisterVM vm;
+    uint64_t* counters = reinterpret_cast<uint64_t*>(vm.getBuffer());
+    counters[0] = 0xFFFFFFFF;
+    vm.run_vm(instructions);
+    EXPECT_EQ(counters[0], 0x200000000ull);
+    EXPECT_EQ(counters[1], 0x300000000ull);
+    EXPECT_EQ(vm.debug_num, 0u);
+    std::vector<uint32_t> divide = {DT_IMMI, 7, DT_SEEK, DT_IMMI, 1, DT_IMMI, 0, DT_IMMI, 0, DT_IMMI, 0, DT_DIV64,
+                                    DT_IMMI, 8, DT_SEEK, DT_END};
+    vm.run_vm(divide);
+    EXPECT_EQ(vm.debug_num, 7u);
+}
+
+//Tail-call threading
+TEST(Arithmetic, HandlesAddition8) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 5, DT_IMMI, 3, DT_ADD, DT_SEEK, DT_END};
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 8);
+}
+
+TEST(Arithmetic, HandlesDivision8) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 10, DT_IMMI, 2, DT_DIV, DT_SEEK, DT_END};
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5);
+}
+
+TEST(Arithmetic, TrapsOnZeroDivisor8) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 0, DT_IMMI, 5, DT_DIV, DT_INC, DT_SEEK,
+                                          DT_IMMI, 7, DT_IMMI, 0, DT_DIV, DT_IMMI, 9, DT_SEEK, DT_END};
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 1u);
+}
+
+TEST(FloatingPoint, HandlesFPSubtraction8) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, float_to_uint32(5.5f),
+        DT_IMMI, float_to_uint32(2.0f),
+        DT_FP_SUB, DT_SEEK, DT_END
+    };
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, float_to_uint32(3.5f));
+}
+
+TEST(MemoryOperations, HandleLoadAndStore8) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 100, DT_STO, 0, DT_LOD, 0, DT_SEEK, DT_END};
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 100);
+}
+
+TEST(ControlFlow, HandleCountingLoop8) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 0,
+        DT_LOD, 0, DT_INC, DT_STO, 0,
+        DT_LOD, 0, DT_IMMI, 5, DT_GT, DT_JZ, 3,
+        DT_LOD, 0,
+        DT_SEEK, DT_END
+    };
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 6);
+}
+
+TEST(ControlFlow, HandleIfElse8) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 0,
+        DT_IF_ELSE, 9, 13,
+        DT_IMMI, 0,
+        DT_SEEK, DT_END,
+        DT_IMMI, 123,
+        DT_SEEK, DT_END,
+        DT_IMMI, 456,
+        DT_SEEK, DT_END
+    };
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 456);
+}
+
+TEST(FunctionCalls, HandleFunctionCallAndReturn8) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 10,
+        DT_CALL, 7, 1,
+        DT_SEEK, DT_END,
+        DT_IMMI, 2,
+        DT_ADD,
+        DT_RET
+    };
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 12);
+}
+
+TEST(FunctionCalls, KeepsCallerStack8) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 100,
+        DT_IMMI, 7, DT_IMMI, 3,
+        DT_CALL, 12, 2,
+        DT_ADD, DT_SEEK, DT_END,
+        DT_SUB, DT_RET
+    };
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 96);
+}
+
+TEST(ControlFlow, RejectsJumpIntoOperand8) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 9, DT_SEEK, DT_JMP, 1};
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, StopsOnUnderflow8) {
+    std::vector<uint32_t> instructions = {DT_ADD, DT_IMMI, 7, DT_SEEK, DT_END};
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, StopsOnUnderflowBelowFrame8) {
+    // The callee has no parameters, so the caller's 1 and 2 are out of reach.
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_CALL, 8, 0, DT_END, DT_ADD, DT_SEEK, DT_RET};
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, StopsOnOverflow8) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    TailCallVM vm(2);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, RunsWithinCapacity8) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    TailCallVM vm(16);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5);
+}
+
+TEST(MemoryFaults, StopsOnOutOfBoundsLoad8) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_LOD, 0x80000000, DT_SEEK, DT_END};
+    TailCallVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(BulkMemory, RunsOnSharedSemantics8) {
+    // 5 + strlen("abc") + memcmp("abd", "abc"), then "abc" -> "aab" and the 'b' at 102
+    std::vector<uint32_t> instructions = {DT_IMMI, 0x00636261, DT_STO, 100, DT_IMMI, 5, DT_STRLEN, 100,
+                                          DT_MEMCMP, 0, 16, 3, DT_ADD, DT_ADD, DT_MEMMOVE, 101, 100, 2,
+                                          DT_MEMCHR, 100, 'b', 3, DT_ADD, DT_SEEK, DT_END};
+    TailCallVM vm;
+    strcpy(vm.getBuffer(), "abd");
+    strcpy(vm.getBuffer() + 16, "abc");
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 111u);
+    EXPECT_STREQ(vm.getBuffer() + 100, "aab");
+}
+
+TEST(VectorOps, RunsOnSharedSemantics8) {
+    // The stored 1 feeds the sum; 2 + 3 + (8 + 80)
+    std::vector<uint32_t> instructions = {DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 1, DT_STO, 0, DT_VADD, 128, 0, 64, 9,
+                                          DT_LOD, 160, DT_ADD, DT_ADD, DT_SEEK, DT_END};
+    TailCallVM vm;
+    uint32_t* words = reinterpret_cast<uint32_t*>(vm.getBuffer());
+    for (uint32_t i = 0; i < 9; ++i) {
+        words[i] = i;
+        words[16 + i] = 10 * i;
+    }
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 93u);
+    EXPECT_EQ(words[32], 1u);
+}
+
+TEST(WideValues, RunsOnSharedSemantics8) {
+    // The 32-bit store lands in the high word of the first counter
+    std::vector<uint32_t> instructions = {DT_LOD64, 0, DT_IMMI, 1, DT_IMMI, 0, DT_ADD64, DT_STO64, 0,
+                                          DT_IMMI, 2, DT_STO, 4, DT_LOD64, 0, DT_IMMI, 3, DT_IMMI, 0, DT_MUL64,
+                                          DT_IMMI, 1, DT_SHR64, DT_STO64, 8, DT_LOD8S, 7, DT_SEEK, DT_END};
+    TailCallVM vm;
+    uint64_t* counters = reinterpret_cast<uint64_t*>(vm.getBuffer());
+    counters[0] = 0xFFFFFFFF;
+    vm.run_vm(instructions);
+    EXPECT_EQ(counters[0], 0x200000000ull);
+    EXPECT_EQ(counters[1], 0x300000000ull);
+    EXPECT_EQ(vm.debug_num, 0u);
+    std::vector<uint32_t> divide = {DT_IMMI, 7, DT_SEEK, DT_IMMI, 1, DT_IMMI, 0, DT_IMMI, 0, DT_IMMI, 0, DT_DIV64,
+                                    DT_IMMI, 8, DT_SEEK, DT_END};
+    vm.run_vm(divide);
+    EXPECT_EQ(vm.debug_num, 7u);
+}
+
+//Tracing
+TEST(Arithmetic, HandlesAddition9) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 5, DT_IMMI, 3, DT_ADD, DT_SEEK, DT_END};
+    TraceVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 8);
+}
+
+TEST(Arithmetic, TrapsOnZeroDivisorInTrace9) {
+    // mem[4] = 1000 / i for i = 100 down to 0; the trace leaves at i = 0 and
+    // the interpreter traps
+    std::vector<uint32_t> instructions = {DT_STO_IMMI, 0, 100,
+                                          DT_IMMI, 1000, DT_LOD, 0, DT_DIV, DT_STO, 4,
+                                          DT_LOD, 0, DT_DEC, DT_SEEK, DT_STO, 0,
+                                          DT_JMP, 3, DT_END};
+    TraceVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0u);
+    EXPECT_EQ(reinterpret_cast<uint32_t*>(vm.getBuffer())[1], 1000u);
+    EXPECT_GE(vm.traceStats().tracesFormed, 1u);
+    EXPECT_GE(vm.traceStats().sideExits, 1u);
+}
+
+TEST(FunctionCalls, HandleFunctionCallAndReturn9) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 10,
+        DT_CALL, 7, 1,
+        DT_SEEK, DT_END,
+        DT_IMMI, 2,
+        DT_ADD,
+        DT_RET
+    };
+    TraceVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 12);
+}
+
+TEST(Tracing, CompilesCountedLoop9) {
+    // Sum 1..1000, the summation program from main.cpp
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 0, DT_STO_IMMI, 0, 1,
+        DT_LOD, 0, DT_ADD, DT_LOD, 0, DT_INC, DT_STO, 0,
+        DT_LOD, 0, DT_IMMI, 1000, DT_GT, DT_JZ, 5,
+        DT_SEEK, DT_END
+    };
+    TraceVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 500500);
+    EXPECT_EQ(vm.traceStats().tracesFormed, 1);
+    EXPECT_EQ(vm.traceStats().sideExits, 1);
+}
+
+TEST(Tracing, SideExitsOnOtherBranch9) {
+    // Counts the even numbers below 200; every odd one leaves the trace
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 0, DT_STO_IMMI, 4, 0,
+        DT_LOD, 0, DT_IMMI, 1, DT_SHR, DT_IMMI, 1, DT_SHL, DT_LOD, 0, DT_EQ, DT_JZ, 24,
+        DT_LOD, 4, DT_INC, DT_STO, 4,
+        DT_LOD, 0, DT_INC, DT_STO, 0,
+        DT_LOD, 0, DT_IMMI, 200, DT_LT, DT_JUMP_IF, 6,
+        DT_LOD, 4, DT_SEEK, DT_END
+    };
+    TraceVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 100);
+    EXPECT_GE(vm.traceStats().tracesFormed, 1u);
+    EXPECT_GT(vm.traceStats().sideExits, 1u);
+}
+
+TEST(Tracing, HandlesNestedLoops9) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 0, DT_STO_IMMI, 8, 0,
+        DT_STO_IMMI, 4, 0,
+        DT_LOD, 8, DT_INC, DT_STO, 8,
+        DT_LOD, 4, DT_INC, DT_STO, 4,
+        DT_LOD, 4, DT_IMMI, 30, DT_LT, DT_JUMP_IF, 9,
+        DT_LOD, 0, DT_INC, DT_STO, 0,
+        DT_LOD, 0, DT_IMMI, 30, DT_LT, DT_JUMP_IF, 6,
+        DT_LOD, 8, DT_SEEK, DT_END
+    };
+    TraceVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 900);
+    EXPECT_GE(vm.traceStats().tracesFormed, 1);
+}
+
+TEST(ControlFlow, RejectsJumpIntoOperand9) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 9, DT_SEEK, DT_JMP, 1};
+    TraceVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(MemoryFaults, StopsOnOutOfBoundsLoad9) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 7, DT_SEEK, DT_LOD, 0x80000000, DT_SEEK, DT_END};
+    TraceVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(StackTraps, StopsOnUnderflowBelowFrame9) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_CALL, 8, 0, DT_END, DT_ADD, DT_SEEK, DT_RET};
+    TraceVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, StopsOnOverflow9) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    TraceVM vm(2);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 0xFFFFFFFF);
+}
+
+TEST(StackTraps, RunsWithinCapacity9) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_IMMI, 4, DT_IMMI, 5, DT_SEEK, DT_END};
+    TraceVM vm(16);
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 5);
+}
+
+//Ahead-of-time translation
+TEST(AheadOfTime, LabelsOnlyJumpTargets) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 0,
+        DT_LOD, 0, DT_INC, DT_STO, 0,
+        DT_LOD, 0, DT_IMMI, 5, DT_GT, DT_JZ, 3,
+        DT_SEEK, DT_END
+    };
+    std::string source = translateToCpp(instructions);
+    EXPECT_NE(source.find("L3:\n"), std::string::npos);
+    EXPECT_EQ(source.find("L8:"), std::string::npos);
+    EXPECT_NE(source.find("if (vm.pop() == 0) goto L3;"), std::string::npos);
+    EXPECT_NE(source.find("AotSemantics::execute<DT_IMMI>(vm, AotOperands{{5, 0, 0}});"), std::string::npos);
+}
+
+TEST(AheadOfTime, ReturnsThroughCallSites) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 10,
+        DT_CALL, 7, 1,
+        DT_SEEK, DT_END,
+        DT_IMMI, 2,
+        DT_ADD,
+        DT_RET
+    };
+    std::string source = translateToCpp(instructions);
+    EXPECT_NE(source.find("vm.enter(0, 1); goto L7; R0:;"), std::string::npos);
+    EXPECT_NE(source.find("case 0: goto R0;"), std::string::npos);
+}
+
+TEST(AheadOfTime, BranchesOnFusedCompare) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 0,
+        DT_LOD_INC_STO, 0, 0,
+        DT_LOD, 0, DT_IMMI_GT_JZ, 5, 3,
+        DT_LOD, 0, DT_SEEK, DT_END
+    };
+    std::string source = translateToCpp(instructions);
+    EXPECT_NE(source.find("L3:\n"), std::string::npos);
+    EXPECT_NE(source.find("if (!(vm.pop() > 5u)) goto L3;"), std::string::npos);
+}
+
+TEST(AheadOfTime, RunsUnderTrapFaults) {
+    std::vector<uint32_t> instructions = {DT_ADD, DT_END};
+    std::string source = translateToCpp(instructions);
+    EXPECT_NE(source.find("vm.memory.trapFaults([&] {"), std::string::npos);
+    EXPECT_NE(source.find("catch (const std::exception& e)"), std::string::npos);
+}
+
+TEST(AheadOfTime, RejectsJumpIntoOperand) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 9, DT_SEEK, DT_JMP, 1};
+    EXPECT_THROW(translateToCpp(instructions), std::runtime_error);
+}
+
+//Verifier
+TEST(Verifier, BoundsDeepestCallChain) {
+    std::vector<uint32_t> code = {DT_IMMI, 1, DT_CALL, 7, 1, DT_SEEK, DT_END, DT_IMMI, 2, DT_ADD, DT_RET};
+    Verification v = verifyBytecode(code, 64);
+    ASSERT_TRUE(v.ok) << v.error;
+    ASSERT_EQ(v.functions.size(), 2);
+    EXPECT_EQ(v.functions[0].maxDepth, 1);
+    EXPECT_EQ(v.functions[1].entry, 7);
+    EXPECT_EQ(v.functions[1].params, 1);
+    EXPECT_EQ(v.functions[1].maxDepth, 2);
+    EXPECT_EQ(v.stackBound, 2);
+}
+
+TEST(Verifier, RecursionIsUnbounded) {
+    std::vector<uint32_t> code = {DT_CALL, 4, 0, DT_END, DT_IMMI, 1, DT_CALL, 4, 0, DT_RET};
+    Verification v = verifyBytecode(code, 64);
+    ASSERT_TRUE(v.ok) << v.error;
+    EXPECT_EQ(v.stackBound, UINT64_MAX);
+}
+
+TEST(Verifier, InstructionBoundaries) {
+    std::vector<uint32_t> code = {DT_IMMI, 5, DT_JMP, 0, DT_END};
+    InstructionBoundaries boundaries(code);
+    EXPECT_EQ(boundaries.starts, (std::vector<uint32_t>{0, 2, 4}));
+    EXPECT_EQ(boundaries.target(2), 1);
+    EXPECT_EQ(boundaries.target(9), 3); // Past the end halts
+    EXPECT_THROW(boundaries.target(1), std::runtime_error);
+    EXPECT_FALSE(boundaries.isBoundary(6));
+    EXPECT_EQ(InstructionBoundaries(std::vector<uint32_t>{DT_END, DT_STO_IMMI, 0}).truncatedAt, 1);
+}
+
+TEST(Verifier, RejectsUnknownOpcode) {
+    std::vector<uint32_t> code = {DT_SYSCALL, DT_END};
+    EXPECT_FALSE(verifyBytecode(code, 64).ok);
+}
+
+TEST(Verifier, ChecksBulkMemoryOperands) {
+    std::vector<uint32_t> code = {DT_STRLEN, 0, DT_MEMCMP, 0, 32, 32, DT_ADD, DT_SEEK, DT_END};
+    Verification v = verifyBytecode(code, 64);
+    ASSERT_TRUE(v.ok) << v.error;
+    EXPECT_EQ(v.stackBound, 2);
+    code[5] = 33;
+    EXPECT_FALSE(verifyBytecode(code, 64).ok);
+}
+
+TEST(Verifier, ChecksVectorOperands) {
+    std::vector<uint32_t> code = {DT_VADD, 32, 0, 16, 8, DT_VDOT, 60, 0, 32, 8, DT_END};
+    Verification v = verifyBytecode(code, 64);
+    ASSERT_TRUE(v.ok) << v.error;
+    EXPECT_EQ(v.stackBound, 0);
+    code[6] = 61; // The dot product no longer fits
+    EXPECT_FALSE(verifyBytecode(code, 64).ok);
+    code[6] = 60;
+    code[4] = 0x40000008; // Element count that wraps when scaled to bytes in 32 bits
+    EXPECT_FALSE(verifyBytecode(code, 64).ok);
+}
+
+TEST(Verifier, CountsWideValuesAsTwoSlots) {
+    std::vector<uint32_t> code = {DT_LOD64, 0, DT_LOD64, 8, DT_ADD64, DT_STO64, 56, DT_LOD16, 62, DT_STO8, 63, DT_END};
+    Verification v = verifyBytecode(code, 64);
+    ASSERT_TRUE(v.ok) << v.error;
+    EXPECT_EQ(v.stackBound, 4);
+    code[6] = 57; // The 64-bit store no longer fits
+    EXPECT_FALSE(verifyBytecode(code, 64).ok);
+    std::vector<uint32_t> underflow = {DT_IMMI, 1, DT_IMMI, 2, DT_IMMI, 3, DT_ADD64, DT_END};
+    EXPECT_FALSE(verifyBytecode(underflow, 64).ok);
+}
+
+TEST(Verifier, RejectsJumpIntoOperand) {
+    std::vector<uint32_t> code = {DT_JMP, 3, DT_IMMI, 1, DT_END};
+    EXPECT_FALSE(verifyBytecode(code, 64).ok);
+}
+
+TEST(Verifier, RejectsDepthMismatchAtJoin) {
+    std::vector<uint32_t> code = {DT_IMMI, 0, DT_JZ, 6, DT_IMMI, 5, DT_END};
+    Verification v = verifyBytecode(code, 64);
+    EXPECT_FALSE(v.ok);
+    EXPECT_NE(v.error.find("depth differs"), std::string::npos);
+}
+
+TEST(Verifier, RejectsUnderflow) {
+    std::vector<uint32_t> code = {DT_IMMI, 1, DT_ADD, DT_END};
+    EXPECT_FALSE(verifyBytecode(code, 64).ok);
+}
+
+TEST(Verifier, RejectsMemoryOutOfBounds) {
+    EXPECT_TRUE(verifyBytecode({DT_STO_IMMI, 60, 1, DT_END}, 64).ok);
+    EXPECT_FALSE(verifyBytecode({DT_STO_IMMI, 61, 1, DT_END}, 64).ok);
+    EXPECT_FALSE(verifyBytecode({DT_MEMSET, 32, 0, 33, DT_END}, 64).ok);
+}
+
+//VM memory
+TEST(VMMemory, CommitsPagesOnFirstTouch) {
+    VMMemory::Options options;
+    options.size = 64 << 20;
+    VMMemory memory(options);
+    const size_t page = sysconf(_SC_PAGESIZE);
+    auto resident = [&](size_t offset) {
+        unsigned char vec = 0;
+        EXPECT_EQ(mincore(memory.data() + offset, page, &vec), 0);
+        return (vec & 1) != 0;
+    };
+    EXPECT_FALSE(resident(32 << 20));
+    memory.data()[32 << 20] = 1;
+    EXPECT_TRUE(resident(32 << 20));
+    EXPECT_FALSE(resident(48 << 20));
+}
+
+TEST(VMMemory, ResetReadsAsZero) {
+    VMMemory memory;
+    EXPECT_EQ(memory.size(), 4u << 20);
+    memory.data()[100] = 42;
+    memory.reset();
+    EXPECT_EQ(memory.data()[100], 0);
+}
+
+TEST(VMMemory, TurnsGuardZoneFaultsIntoTraps) {
+    VMMemory memory;
+    volatile char* data = memory.data();
+    EXPECT_TRUE(memory.guarded([&] { data[memory.size() - 1] = 1; }));
+    EXPECT_FALSE(memory.guarded([&] { data[memory.size()] = 1; }));
+    EXPECT_FALSE(memory.guarded([&] { (void)data[(size_t(1) << 33) - 1]; }));
+    EXPECT_THROW(memory.trapFaults([&] { data[size_t(1) << 32] = 1; }), std::runtime_error);
+}
+
+TEST(VMMemory, ReservesLessWhenAsked) {
+    VMMemory::Options options;
+    options.size = 4096;
+    options.reservation = 1 << 20;
+    VMMemory memory(options);
+    volatile char* data = memory.data();
+    EXPECT_TRUE(memory.guarded([&] { data[4095] = 1; }));
+    EXPECT_FALSE(memory.guarded([&] { data[(1 << 20) - 1] = 1; }));
+}
+
+TEST(VMMemoryDeathTest, LeavesOtherFaultsToTheHost) {
+    VMMemory memory;
+    void* page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(page, MAP_FAILED);
+    EXPECT_DEATH(memory.guarded([&] { *static_cast<volatile char*>(page) = 1; }), "");
+    munmap(page, sysconf(_SC_PAGESIZE));
+}
+
+TEST(VMMemory, RestoresOnlyDirtyPages) {
+    VMMemory memory;
+    const size_t page = sysconf(_SC_PAGESIZE);
+    char* data = memory.data();
+    data[0] = 1;
+    data[3 * page] = 2;
+    memory.snapshot();
+    EXPECT_EQ(memory.dirtyPages(), 0u);
+    data[0] = 5;
+    data[1] = 6;
+    data[10 * page] = 7;
+    EXPECT_EQ(memory.dirtyPages(), 2u);
+    memory.restore();
+    EXPECT_EQ(memory.dirtyPages(), 0u);
+    EXPECT_EQ(data[0], 1);
+    EXPECT_EQ(data[1], 0);
+    EXPECT_EQ(data[3 * page], 2);
+    EXPECT_EQ(data[10 * page], 0);
+    data[0] = 8;
+    EXPECT_EQ(memory.dirtyPages(), 1u);
+    memory.reset();
+    data[0] = 9;
+    EXPECT_EQ(memory.dirtyPages(), 0u);
+}
+
+TEST(OperandStack, SavesFramesWithValues) {
+    OperandStack st(8);
+    st.push(1);
+    st.push(2);
+    st.push(3);
+    uint32_t* callerBase = st.enter(1);
+    OperandStack::Saved saved;
+    st.save(saved);
+    st.pop();
+    st.push(9);
+    st.push(10);
+    st.restore(saved);
+    EXPECT_EQ(st.size(), 1u);
+    EXPECT_EQ(st.top(), 3u);
+    st.leave(callerBase);
+    EXPECT_EQ(st.size(), 3u);
+    EXPECT_EQ(st.pop(), 3u);
+    EXPECT_EQ(st.pop(), 2u);
+}
+
+//Superinstructions
+TEST(Superinstructions, FusesCountingLoop) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 0,
+        DT_LOD, 0, DT_INC, DT_STO, 0,
+        DT_LOD, 0, DT_IMMI, 5, DT_GT, DT_JZ, 3,
+        DT_LOD, 0,
+        DT_SEEK, DT_END
+    };
+    std::vector<uint32_t> expected = {
+        DT_STO_IMMI, 0, 0,
+        DT_LOD_INC_STO, 0, 0,
+        DT_LOD, 0, DT_IMMI_GT_JZ, 5, 3,
+        DT_LOD, 0,
+        DT_SEEK, DT_END
+    };
+    EXPECT_EQ(fuseSuperinstructions(instructions), expected);
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 6);
+}
+
+TEST(Superinstructions, KeepsJumpTargetsInsidePattern) {
+    std::vector<uint32_t> instructions = {
+        DT_IMMI, 1, DT_JMP, 6,
+        DT_LOD, 0, DT_LOD, 4, DT_ADD,
+        DT_IMMI, 7, DT_SEEK, DT_END
+    };
+    EXPECT_EQ(fuseSuperinstructions(instructions), instructions);
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 7);
+}
+
+TEST(Superinstructions, FusesLoadLoadAdd) {
+    std::vector<uint32_t> instructions = {
+        DT_STO_IMMI, 0, 40, DT_STO_IMMI, 4, 2,
+        DT_JMP, 8,
+        DT_LOD, 0, DT_LOD, 4, DT_ADD,
+        DT_SEEK, DT_END
+    };
+    std::vector<uint32_t> expected = {
+        DT_STO_IMMI, 0, 40, DT_STO_IMMI, 4, 2,
+        DT_JMP, 8,
+        DT_LOD_LOD_ADD, 0, 4,
+        DT_SEEK, DT_END
+    };
+    EXPECT_EQ(fuseSuperinstructions(instructions), expected);
+    DirectThreadingVM vm;
+    vm.run_vm(instructions);
+    EXPECT_EQ(vm.debug_num, 42);
+}
+
+TEST(Superinstructions, OpcodeTableMatchesPatterns) {
+    for (const SuperInstruction& s : superInstructions) {
+        uint32_t operands = 0;
+        uint32_t mask = 0;
+        for (Instruction part : s.pattern) {
+            mask |= jumpOperandMask(part) << operands;
+            operands += operandCount(part);
+        }
+        EXPECT_EQ(operandCount(s.fused), operands);
+        EXPECT_EQ(jumpOperandMask(s.fused), mask);
+    }
+}
+
+//Program loading
+static std::string writeProgram(const std::string& name, const void* data, size_t size) {
+    std::string path = ::testing::TempDir() + name;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    return path;
+}
+
+TEST(MappedProgram, ViewsTheFileInPlace) {
+    std::vector<uint32_t> instructions = {DT_IMMI, 5, DT_IMMI, 3, DT_ADD, DT_SEEK, DT_END};
+    std::string path = writeProgram("mapped.bin", instructions.data(), instructions.size() * 4);
+    MappedProgram program(path);
+    std::span<const uint32_t> code = program.code();
+    EXPECT_EQ(std::vector<uint32_t>(code.begin(), code.end()), instructions);
+    EXPECT_EQ(readFileToUint32Array(path), instructions);
+    DirectThreadingVM vm;
+    vm.run_vm(path, false);
+    EXPECT_EQ(vm.debug_num, 8u);
+    RoutineThreadingVM routine;
+    routine.run_vm(path, false);
+    EXPECT_EQ(routine.debug_num, 8u);
+}
+
+TEST(MappedProgram, RejectsBadFiles) {
+    EXPECT_THROW(MappedProgram(::testing::TempDir() + "missing.bin"), std::runtime_error);
+    std::string path = writeProgram("odd.bin", "abcdef", 6);
+    EXPECT_THROW(MappedProgram program(path), std::runtime_error);
+    std::string empty = writeProgram("empty.bin", "", 0);
+    EXPECT_TRUE(MappedProgram(empty).code().empty());
+}
+
+TEST(MappedProgram, ReportsTrapsFromFiles) {
+    std::vector<uint32_t> instructions = {DT_ADD, DT_END};
+    std::string path = writeProgram("underflow.bin", instructions.data(), instructions.size() * 4);
+    IndirectThreadingVM indirect;
+    EXPECT_NO_THROW(indirect.run_vm(path, false));
+    RoutineThreadingVM routine;
+    EXPECT_NO_THROW(routine.run_vm(path, false));
+    routine.setNativeMode(false);
+    EXPECT_NO_THROW(routine.run_vm(path, false));
+}
+
+//Compact encoding
+TEST(CompactCode, RoundTripsPrograms) {
+    std::vector<uint32_t> instructions = {DT_STO_IMMI, 0, 0x40490FDB, DT_IMMI, 127, DT_IMMI, 128, DT_IMMI, 0xFFFFFFFF,
+                                          DT_VADD, 64, 0, 32, 8, DT_JZ, 18, DT_JMP, 0, DT_END};
+    std::vector<uint8_t> compact = encodeCompact(instructions);
+    EXPECT_EQ(decodeCompact(compact), instructions);
+    // Opcodes are one byte and small operands one byte each
+    EXPECT_EQ(compact.size(), 4u + 7 + 2 + 3 + 6 + 5 + 2 + 2 + 1);
+    std::vector<uint32_t> loop(4000);
+    for (size_t i = 0; i < loop.size(); i += 4) {
+        loop[i] = DT_LOD_INC_STO;
+        loop[i + 1] = i % 128;
+        loop[i + 2] = (i + 4) % 128;
+        loop[i + 3] = DT_ADD;
+    }
+    std::vector<uint8_t> packed = encodeCompact(loop);
+    EXPECT_LT(packed.size() * 3, loop.size() * 4);
+    EXPECT_EQ(decodeCompact(packed), loop);
+}
+
+TEST(CompactCode, RejectsMalformedPrograms) {
+    std::vector<uint32_t> wide = {300, DT_END};
+    EXPECT_THROW(encodeCompact(wide), std::runtime_error);
+    std::vector<uint32_t> truncated = {DT_STO_IMMI, 0};
+    EXPECT_THROW(encodeCompact(truncated), std::runtime_error);
+    std::vector<uint8_t> cut = {'T', 'H', 'D', 'C', DT_IMMI, 0x80};
+    EXPECT_THROW(decodeCompact(cut), std::runtime_error);
+    std::vector<uint8_t> overlong = {'T', 'H', 'D', 'C', DT_IMMI, 0xFF, 0xFF, 0xFF, 0xFF, 0x1F, DT_END};
+    EXPECT_THROW(decodeCompact(overlong), std::runtime_error);
+    std::vector<uint8_t> raw = {DT_END, 0, 0, 0};
+    EXPECT_THROW(decodeCompact(raw), std::runtime_error);
+}
+
+TEST(CompactCode, EnginesLoadCompactFiles) {
+    // Sum of 10..1
+    std::vector<uint32_t> instructions = {DT_STO_IMMI, 0, 10, DT_STO_IMMI, 4, 0,
+                                          DT_LOD, 0, DT_JZ, 24,
+                                          DT_LOD, 4, DT_LOD, 0, DT_ADD, DT_STO, 4,
+                                          DT_LOD, 0, DT_DEC, DT_STO, 0, DT_JMP, 6,
+                                          DT_LOD, 4, DT_SEEK, DT_END};
+    std::vector<uint8_t> compact = encodeCompact(instructions);
+    std::string path = writeProgram("program.thdc", compact.data(), compact.size());
+    MappedProgram program(path);
+    std::span<const uint32_t> code = program.code();
+    EXPECT_EQ(std::vector<uint32_t>(code.begin(), code.end()), instructions);
+    DirectThreadingVM direct;
+    direct.run_vm(path, false);
+    EXPECT_EQ(direct.debug_num, 55u);
+    IndirectThreadingVM indirect;
+    indirect.run_vm(path, false);
+    EXPECT_EQ(indirect.debug_num, 55u);
+    TosThreadingVM tos;
+    tos.run_vm(path, false);
+    EXPECT_EQ(tos.debug_num, 55u);
+    RegisterVM registers;
+    registers.run_vm(path, false);
+    EXPECT_EQ(registers.debug_num, 55u);
+    TailCallVM tailcall;
+    tailcall.run_vm(path, false);
+    EXPECT_EQ(tailcall.debug_num, 55u);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();